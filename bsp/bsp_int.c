@@ -6,9 +6,32 @@
 #define MAX_INTERRUPTS 256u
 
 /*
- * Global interrupt vector table
+ * Global interrupt vector table; an entry holds either a plain handler or
+ * one that takes a context argument
  */
-static BSP_INT_FNCT_PTR bsp_int_vect_tbl[MAX_INTERRUPTS];
+struct bsp_int_vect {
+    BSP_INT_FNCT_PTR fnct;
+    BSP_INT_ARG_FNCT_PTR arg_fnct;
+    void *arg;
+};
+
+static struct bsp_int_vect bsp_int_vect_tbl[MAX_INTERRUPTS];
+static struct bsp_int_vect bsp_int_lpi_tbl[GIC_LPI_COUNT];
+
+/*
+ * Vector entry of an interrupt: SGIs, PPIs and SPIs index the main table,
+ * LPIs (MSIs through the ITS) their own
+ */
+static struct bsp_int_vect *bsp_int_vect_get(uint32_t int_id)
+{
+    if (int_id < MAX_INTERRUPTS) {
+        return &bsp_int_vect_tbl[int_id];
+    }
+    if (int_id >= GIC_LPI_BASE && int_id - GIC_LPI_BASE < GIC_LPI_COUNT) {
+        return &bsp_int_lpi_tbl[int_id - GIC_LPI_BASE];
+    }
+    return NULL;
+}
 
 /*
  * Register interrupt service routine
@@ -17,9 +40,32 @@ void BSP_IntVectSet(uint32_t int_id, uint32_t int_prio, uint32_t int_target, BSP
 {
     (void)int_prio;    /* Unused in this simple implementation */
     (void)int_target;  /* Unused in this simple implementation */
-    
-    if (int_id < MAX_INTERRUPTS) {
-        bsp_int_vect_tbl[int_id] = int_fnct;
+    struct bsp_int_vect *vect = bsp_int_vect_get(int_id);
+
+    if (vect != NULL) {
+        vect->arg_fnct = NULL;
+        vect->arg = NULL;
+        vect->fnct = int_fnct;
+        uart_puts("[BSP] Registered ISR for interrupt ");
+        uart_write_dec(int_id);
+        uart_putc('\n');
+    }
+}
+
+/*
+ * Register interrupt service routine with a context argument
+ */
+void BSP_IntVectSetArg(uint32_t int_id, uint32_t int_prio, uint32_t int_target,
+                       BSP_INT_ARG_FNCT_PTR int_fnct, void *p_arg)
+{
+    (void)int_prio;
+    (void)int_target;
+    struct bsp_int_vect *vect = bsp_int_vect_get(int_id);
+
+    if (vect != NULL) {
+        vect->fnct = NULL;
+        vect->arg = p_arg;
+        vect->arg_fnct = int_fnct;
         uart_puts("[BSP] Registered ISR for interrupt ");
         uart_write_dec(int_id);
         uart_putc('\n');
@@ -35,11 +81,15 @@ void BSP_IntSrcEn(uint32_t int_id)
     uart_write_dec(int_id);
     uart_putc('\n');
     
-    /* Enable interrupt in GIC for SPI interrupts (ID >= 32) */
-    if (int_id >= 32u) {
+    /* Enable interrupt in GIC for LPIs, SPIs (ID >= 32) and PPIs (16-31) */
+    if (int_id >= GIC_LPI_BASE) {
+        gic_enable_lpi(int_id);
+    } else if (int_id >= 32u) {
         gic_enable_spi_interrupt(int_id);
+    } else if (int_id >= 16u) {
+        gic_enable_ppi_interrupt(int_id);
     }
-    /* Note: PPI/SGI interrupts (ID < 32) are handled differently */
+    /* Note: SGIs (ID < 16) are not routed through here */
 }
 
 /*
@@ -57,7 +107,14 @@ void BSP_IntSrcDis(uint32_t int_id)
  */
 void BSP_IntHandler(uint32_t int_id)
 {
-    if (int_id < MAX_INTERRUPTS && bsp_int_vect_tbl[int_id] != NULL) {
-        bsp_int_vect_tbl[int_id](int_id);
+    const struct bsp_int_vect *vect = bsp_int_vect_get(int_id);
+
+    if (vect == NULL) {
+        return;
+    }
+    if (vect->arg_fnct != NULL) {
+        vect->arg_fnct(int_id, vect->arg);
+    } else if (vect->fnct != NULL) {
+        vect->fnct(int_id);
     }
 }
\ No newline at end of file
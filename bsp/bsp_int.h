@@ -8,10 +8,18 @@
  */
 typedef void (*BSP_INT_FNCT_PTR)(uint32_t int_id);
 
+/*
+ * Handler that receives the context registered with it, so a driver serving
+ * many instances reaches the right one without searching
+ */
+typedef void (*BSP_INT_ARG_FNCT_PTR)(uint32_t int_id, void *p_arg);
+
 /*
  * Function prototypes
  */
 void BSP_IntVectSet(uint32_t int_id, uint32_t int_prio, uint32_t int_target, BSP_INT_FNCT_PTR int_fnct);
+void BSP_IntVectSetArg(uint32_t int_id, uint32_t int_prio, uint32_t int_target,
+                       BSP_INT_ARG_FNCT_PTR int_fnct, void *p_arg);
 void BSP_IntSrcEn(uint32_t int_id);
 void BSP_IntSrcDis(uint32_t int_id);
 void BSP_IntHandler(uint32_t int_id);
@@ -0,0 +1,44 @@
+#include "dma.h"
+
+#include <stdint.h>
+
+#define DMA_MIN_ALIGN 64u   /* one cache line: maintenance never spills into a neighbour */
+
+extern uint8_t __dma_arena_start[];
+extern uint8_t __dma_arena_end[];
+
+static uintptr_t g_dma_next = 0u;
+
+static inline uintptr_t dma_next(void)
+{
+    return (g_dma_next != 0u) ? g_dma_next : (uintptr_t)__dma_arena_start;
+}
+
+void *dma_alloc(size_t size, size_t align)
+{
+    if (align < DMA_MIN_ALIGN) {
+        align = DMA_MIN_ALIGN;
+    }
+    if ((align & (align - 1u)) != 0u) {
+        return NULL;
+    }
+
+    uintptr_t end = (uintptr_t)__dma_arena_end;
+    uintptr_t start = (dma_next() + align - 1u) & ~(uintptr_t)(align - 1u);
+    if (start > end || size > end - start) {
+        return NULL;
+    }
+
+    g_dma_next = start + size;
+    return (void *)start;
+}
+
+size_t dma_arena_used(void)
+{
+    return (size_t)(dma_next() - (uintptr_t)__dma_arena_start);
+}
+
+size_t dma_arena_free(void)
+{
+    return (size_t)((uintptr_t)__dma_arena_end - dma_next());
+}
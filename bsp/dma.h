@@ -0,0 +1,65 @@
+#ifndef BSP_DMA_H
+#define BSP_DMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+
+/*
+ * Boot-time DMA arena: the RAM between the MMU tables and the boot stack
+ * (boot/linker.ld). Drivers carve rings and buffers from it at init, sized to
+ * what their devices offer; memory they leave is free for anything else.
+ * Allocations are permanent, not zeroed, and at least cache-line aligned.
+ * Task context only.
+ */
+void *dma_alloc(size_t size, size_t align);
+
+size_t dma_arena_used(void);
+size_t dma_arena_free(void);
+
+/*
+ * How a device sees memory. A coherent device snoops the CPU caches, so
+ * handing a buffer over only needs the accesses ordered; a non-coherent one
+ * reads and writes RAM, so the CPU cleans what the device is about to read
+ * and invalidates what it wrote before looking.
+ */
+#define DMA_COHERENT        0u
+#define DMA_NONCOHERENT     1u
+
+/* QEMU virt (TCG or KVM) keeps guest memory coherent with its emulated devices */
+#ifndef DMA_PLATFORM_COHERENCY
+#define DMA_PLATFORM_COHERENCY  DMA_COHERENT
+#endif
+
+/* CPU writes to [addr, addr + size) are done: make them visible to the device */
+static inline void dma_sync_for_device(uint8_t coherency, const void *addr, size_t size)
+{
+    if (coherency != DMA_COHERENT) {
+        cache_clean_range(addr, size);
+        return;
+    }
+    __asm__ volatile("dmb oshst" ::: "memory");
+}
+
+/* The device wrote [addr, addr + size): make it visible to the CPU reads that follow */
+static inline void dma_sync_for_cpu(uint8_t coherency, void *addr, size_t size)
+{
+    if (coherency != DMA_COHERENT) {
+        cache_invalidate_range(addr, size);
+        return;
+    }
+    __asm__ volatile("dmb osh" ::: "memory");
+}
+
+/* Memory both sides write (packed ring lines): publish CPU writes and pick up the device's */
+static inline void dma_sync_bidirectional(uint8_t coherency, void *addr, size_t size)
+{
+    if (coherency != DMA_COHERENT) {
+        cache_clean_invalidate_range(addr, size);
+        return;
+    }
+    __asm__ volatile("dmb osh" ::: "memory");
+}
+
+#endif /* BSP_DMA_H */
@@ -1,6 +1,11 @@
 #include "gic.h"
 #include "uart.h"
 #include "mmio.h"
+#include "cache.h"
+#include "dma.h"
+#include "lib.h"
+
+#include <stddef.h>
 
 #define TIMER_INTERRUPT_ID  27u
 
@@ -8,10 +13,48 @@
 #define GICD_BASE           0x08000000u
 #define GICD_CTLR           (GICD_BASE + 0x0000u)
 #define GICD_CTLR_ENABLE    0x37u
+#define GICD_TYPER          (GICD_BASE + 0x0004u)
+#define GICD_TYPER_LPIS     (1u << 17)
 
 /* GICv3 Redistributor */
 #define GICR_BASE           0x080A0000u
 #define GICR_CTLR           (GICR_BASE + 0x0000u)
+#define GICR_CTLR_ENABLE_LPIS  (1u << 0)
+#define GICR_TYPER          (GICR_BASE + 0x0008u)
+#define GICR_PROPBASER      (GICR_BASE + 0x0070u)
+#define GICR_PENDBASER      (GICR_BASE + 0x0078u)
+#define GICR_PENDBASER_PTZ  (1ULL << 62)
+
+/* GICv3 ITS: translates MSI writes (device ID, event ID) into LPIs */
+#define GITS_BASE           0x08080000u
+#define GITS_CTLR           (GITS_BASE + 0x0000u)
+#define GITS_TYPER          (GITS_BASE + 0x0008u)
+#define GITS_CBASER         (GITS_BASE + 0x0080u)
+#define GITS_CWRITER        (GITS_BASE + 0x0088u)
+#define GITS_CREADR         (GITS_BASE + 0x0090u)
+#define GITS_BASER(n)       (GITS_BASE + 0x0100u + ((n) * 8u))
+#define GITS_TRANSLATER     (GITS_BASE + 0x10040u)
+#define GITS_CTLR_ENABLED   (1u << 0)
+#define GITS_TYPER_PTA      (1ULL << 19)
+#define GITS_BASER_VALID    (1ULL << 63)
+#define GITS_BASER_TYPE_DEVICE      1u
+#define GITS_BASER_TYPE_COLLECTION  4u
+#define GITS_CBASER_VALID   (1ULL << 63)
+#define GITS_CREADR_STALLED (1ULL << 0)
+
+#define GITS_CMD_SYNC       0x05u
+#define GITS_CMD_MAPD       0x08u
+#define GITS_CMD_MAPC       0x09u
+#define GITS_CMD_MAPTI      0x0Au
+#define GITS_CMD_INVALL     0x0Du
+
+#define GIC_LPI_ID_BITS     14u                     /* INTIDs below 16384: LPIs 8192.. */
+#define GIC_LPI_PRIORITY    0x80u                   /* same as the SPIs */
+#define GIC_LPI_ENABLE      0x01u
+#define GIC_ITS_PAGE        4096u
+#define GIC_ITS_CMDQ_SIZE   4096u                   /* 128 commands; each is waited for */
+#define GIC_ITS_DEVICES     256u                    /* device IDs of PCI bus 0 */
+#define GIC_ITS_POLL_LIMIT  1000000u
 
 /* GICv3 SGI base (redistributor SGI frame) */
 #define GICR_SGI_BASE       0x080B0000u
@@ -190,4 +233,232 @@ void gic_enable_spi_interrupt(uint32_t int_id)
     uint32_t group_val = mmio_read32(group_reg_addr);
     group_val |= (1u << group_bit_offset);
     mmio_write32(group_reg_addr, group_val);
-}
\ No newline at end of file
+}
+
+void gic_enable_ppi_interrupt(uint32_t int_id)
+{
+    if (int_id < 16u || int_id >= 32u) {
+        uart_puts("[GIC] Error: Invalid PPI interrupt ID\n");
+        return;
+    }
+
+    /* Set priority, then enable in the redistributor */
+    uint32_t priority_reg = GICR_IPRIORITYR(int_id / 4u);
+    uint32_t priority = mmio_read32(priority_reg);
+    uint32_t shift = (int_id % 4u) * 8u;
+    priority &= ~(0xFFu << shift);
+    priority |= (0x80u << shift);
+    mmio_write32(priority_reg, priority);
+
+    mmio_write32(GICR_ISENABLER0, (1u << int_id));
+}
+
+/*
+ * LPI state: the configuration and pending tables the redistributor reads,
+ * the ITS tables and command queue, all carved from the DMA arena on first
+ * use. One collection (0) routes every LPI to this CPU.
+ */
+static struct {
+    uint8_t *prop;          /* one configuration byte per LPI */
+    uint64_t *cmdq;
+    uint32_t cwriter;       /* byte offset of the next command */
+    uint64_t rdbase;        /* MAPC/SYNC target: processor number or frame address >> 16 */
+    uint32_t next_lpi;
+    uint8_t ready;
+    uint32_t device_lpi[GIC_ITS_DEVICES];     /* first LPI of a mapped device, 0 if unmapped */
+    uint16_t device_events[GIC_ITS_DEVICES];
+} g_its;
+
+static int gic_its_command(uint64_t dw0, uint64_t dw1, uint64_t dw2)
+{
+    uint64_t *slot = g_its.cmdq + g_its.cwriter / sizeof(uint64_t);
+
+    slot[0] = dw0;
+    slot[1] = dw1;
+    slot[2] = dw2;
+    slot[3] = 0u;
+    cache_clean_range(slot, 4u * sizeof(uint64_t));
+
+    g_its.cwriter = (g_its.cwriter + 4u * sizeof(uint64_t)) % GIC_ITS_CMDQ_SIZE;
+    mmio_write64(GITS_CWRITER, g_its.cwriter);
+
+    for (uint32_t polls = 0u; polls < GIC_ITS_POLL_LIMIT; ++polls) {
+        uint64_t creadr = mmio_read64(GITS_CREADR);
+        if ((creadr & GITS_CREADR_STALLED) != 0u) {
+            uart_puts("[GIC] ITS command stalled\n");
+            return -1;
+        }
+        if ((uint32_t)creadr == g_its.cwriter) {
+            return 0;
+        }
+    }
+    uart_puts("[GIC] ITS command timed out\n");
+    return -1;
+}
+
+static int gic_its_sync(void)
+{
+    return gic_its_command(GITS_CMD_SYNC, 0u, g_its.rdbase << 16);
+}
+
+/* Give an ITS table register zeroed memory for 'entries' of the size the ITS asks for */
+static int gic_its_setup_table(uint32_t n, uint32_t entries)
+{
+    uint64_t baser = mmio_read64(GITS_BASER(n));
+    uint32_t entry_size = (uint32_t)((baser >> 48) & 0x1Fu) + 1u;
+    size_t bytes = (size_t)entries * entry_size;
+    size_t pages = (bytes + GIC_ITS_PAGE - 1u) / GIC_ITS_PAGE;
+    void *table = dma_alloc(pages * GIC_ITS_PAGE, GIC_ITS_PAGE);
+
+    if (table == NULL) {
+        return -1;
+    }
+    util_memset(table, 0, pages * GIC_ITS_PAGE);
+    cache_clean_range(table, pages * GIC_ITS_PAGE);
+
+    /* Keep the type and entry size, 4 KB pages, flat table */
+    baser &= (0x7ULL << 56) | (0x1FULL << 48);
+    baser |= GITS_BASER_VALID | (uint64_t)(uintptr_t)table | (uint64_t)(pages - 1u);
+    mmio_write64(GITS_BASER(n), baser);
+    return 0;
+}
+
+static int gic_its_init(void)
+{
+    if (g_its.ready != 0u) {
+        return 0;
+    }
+    if ((mmio_read32(GICD_TYPER) & GICD_TYPER_LPIS) == 0u) {
+        uart_puts("[GIC] LPIs not supported\n");
+        return -1;
+    }
+
+    /* Redistributor: configuration table for LPIs 8192.., pending table for all INTIDs */
+    size_t prop_size = (1u << GIC_LPI_ID_BITS) - GIC_LPI_BASE;
+    size_t pend_size = (1u << GIC_LPI_ID_BITS) / 8u;
+    uint8_t *pend = dma_alloc(pend_size, 0x10000u);
+    g_its.prop = dma_alloc(prop_size, GIC_ITS_PAGE);
+    g_its.cmdq = dma_alloc(GIC_ITS_CMDQ_SIZE, GIC_ITS_PAGE);
+    if (pend == NULL || g_its.prop == NULL || g_its.cmdq == NULL) {
+        uart_puts("[GIC] No memory for LPI tables\n");
+        return -1;
+    }
+    util_memset(pend, 0, pend_size);
+    util_memset(g_its.prop, 0, prop_size);
+    cache_clean_range(pend, pend_size);
+    cache_clean_range(g_its.prop, prop_size);
+
+    mmio_write64(GICR_PROPBASER, (uint64_t)(uintptr_t)g_its.prop | (GIC_LPI_ID_BITS - 1u));
+    mmio_write64(GICR_PENDBASER, (uint64_t)(uintptr_t)pend | GICR_PENDBASER_PTZ);
+    mmio_write32(GICR_CTLR, mmio_read32(GICR_CTLR) | GICR_CTLR_ENABLE_LPIS);
+
+    /* ITS: device and collection tables, then the command queue */
+    for (uint32_t n = 0u; n < 8u; ++n) {
+        uint32_t type = (uint32_t)(mmio_read64(GITS_BASER(n)) >> 56) & 0x7u;
+        int err = 0;
+        if (type == GITS_BASER_TYPE_DEVICE) {
+            err = gic_its_setup_table(n, GIC_ITS_DEVICES);
+        } else if (type == GITS_BASER_TYPE_COLLECTION) {
+            err = gic_its_setup_table(n, 1u);
+        }
+        if (err != 0) {
+            uart_puts("[GIC] No memory for ITS tables\n");
+            return -1;
+        }
+    }
+
+    util_memset(g_its.cmdq, 0, GIC_ITS_CMDQ_SIZE);
+    cache_clean_range(g_its.cmdq, GIC_ITS_CMDQ_SIZE);
+    mmio_write64(GITS_CBASER, GITS_CBASER_VALID | (uint64_t)(uintptr_t)g_its.cmdq |
+                              (GIC_ITS_CMDQ_SIZE / GIC_ITS_PAGE - 1u));
+    g_its.cwriter = 0u;
+    mmio_write64(GITS_CWRITER, 0u);
+    mmio_write32(GITS_CTLR, mmio_read32(GITS_CTLR) | GITS_CTLR_ENABLED);
+
+    /* Collections name a redistributor by address or by processor number */
+    if ((mmio_read64(GITS_TYPER) & GITS_TYPER_PTA) != 0u) {
+        g_its.rdbase = GICR_BASE >> 16;
+    } else {
+        g_its.rdbase = (mmio_read64(GICR_TYPER) >> 8) & 0xFFFFu;
+    }
+    if (gic_its_command(GITS_CMD_MAPC, 0u, GITS_BASER_VALID | (g_its.rdbase << 16)) != 0 ||
+        gic_its_sync() != 0) {
+        return -1;
+    }
+
+    g_its.next_lpi = GIC_LPI_BASE;
+    g_its.ready = 1u;
+    uart_puts("[GIC] ITS ready\n");
+    return 0;
+}
+
+uint32_t gic_its_map_device(uint32_t device_id, uint32_t count)
+{
+    if (count == 0u || device_id >= GIC_ITS_DEVICES || gic_its_init() != 0) {
+        return 0u;
+    }
+    /* A device set up again keeps its mapping */
+    if (g_its.device_lpi[device_id] != 0u && count <= g_its.device_events[device_id]) {
+        return g_its.device_lpi[device_id];
+    }
+    if (g_its.next_lpi + count > GIC_LPI_BASE + GIC_LPI_COUNT) {
+        uart_puts("[GIC] Out of LPIs\n");
+        return 0u;
+    }
+
+    /* Interrupt translation table: one entry per event, event IDs rounded up to a power of two */
+    uint32_t event_bits = 1u;
+    while ((1u << event_bits) < count) {
+        event_bits++;
+    }
+    uint32_t ite_size = (uint32_t)((mmio_read64(GITS_TYPER) >> 4) & 0xFu) + 1u;
+    size_t itt_size = ((size_t)1u << event_bits) * ite_size;
+    void *itt = dma_alloc(itt_size, 256u);
+    if (itt == NULL) {
+        uart_puts("[GIC] No memory for ITT\n");
+        return 0u;
+    }
+    util_memset(itt, 0, itt_size);
+    cache_clean_range(itt, itt_size);
+
+    uint64_t dev = (uint64_t)device_id << 32;
+    if (gic_its_command(GITS_CMD_MAPD | dev, event_bits - 1u,
+                        GITS_BASER_VALID | ((uint64_t)(uintptr_t)itt & 0x000FFFFFFFFFFF00ULL)) != 0) {
+        return 0u;
+    }
+
+    uint32_t first = g_its.next_lpi;
+    for (uint32_t event = 0u; event < count; ++event) {
+        if (gic_its_command(GITS_CMD_MAPTI | dev, event | ((uint64_t)(first + event) << 32), 0u) != 0) {
+            return 0u;
+        }
+    }
+    if (gic_its_sync() != 0) {
+        return 0u;
+    }
+    g_its.next_lpi += count;
+    g_its.device_lpi[device_id] = first;
+    g_its.device_events[device_id] = (uint16_t)count;
+    return first;
+}
+
+uintptr_t gic_its_doorbell(void)
+{
+    return GITS_TRANSLATER;
+}
+
+void gic_enable_lpi(uint32_t int_id)
+{
+    if (g_its.ready == 0u || int_id < GIC_LPI_BASE || int_id >= g_its.next_lpi) {
+        uart_puts("[GIC] Error: Invalid LPI\n");
+        return;
+    }
+
+    uint8_t *config = &g_its.prop[int_id - GIC_LPI_BASE];
+    *config = GIC_LPI_PRIORITY | GIC_LPI_ENABLE;
+    cache_clean_range(config, 1u);
+
+    /* The redistributor may cache configuration; make it reload collection 0 */
+    (void)gic_its_command(GITS_CMD_INVALL, 0u, 0u);
+    (void)gic_its_sync();
+}
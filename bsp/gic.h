@@ -27,4 +27,37 @@ void gic_end_interrupt(uint32_t int_id);
  */
 void gic_enable_spi_interrupt(uint32_t int_id);
 
+/*
+ * Chinese: 啟用 PPI 中斷 (ID 16-31)，保留其觸發方式。
+ * English: Enables a PPI (Private Peripheral Interrupt, ID 16-31), keeping its trigger mode.
+ */
+void gic_enable_ppi_interrupt(uint32_t int_id);
+
+/*
+ * Chinese: LPI (訊息中斷) 的 INTID 範圍；ITS 將 MSI 寫入轉換為 LPI。
+ * English: INTID range of LPIs (message-based interrupts) the ITS translates MSI writes into.
+ */
+#define GIC_LPI_BASE        8192u
+#define GIC_LPI_COUNT       128u
+
+/*
+ * Chinese: 將 ITS 裝置的 count 個 MSI event 對應到連續的 LPI，回傳第一個 LPI，失敗回傳 0。
+ *          首次呼叫時建立 LPI 與 ITS 表格。
+ * English: Maps 'count' MSI event IDs of an ITS device onto consecutive LPIs and
+ *          returns the first LPI, or 0 on failure. Sets up the LPI and ITS tables on first use.
+ */
+uint32_t gic_its_map_device(uint32_t device_id, uint32_t count);
+
+/*
+ * Chinese: 回傳 MSI 寫入的目的位址 (GITS_TRANSLATER)，寫入的資料為 event ID。
+ * English: Returns the address MSIs are written to (GITS_TRANSLATER); the data written is the event ID.
+ */
+uintptr_t gic_its_doorbell(void);
+
+/*
+ * Chinese: 啟用 LPI 中斷。
+ * English: Enables an LPI.
+ */
+void gic_enable_lpi(uint32_t int_id);
+
 #endif
\ No newline at end of file
@@ -21,6 +21,33 @@ static inline void mmio_write8(uintptr_t addr, uint8_t value)
     *(volatile uint8_t *)addr = value;
 }
 
+/*
+ * Chinese: 向指定的記憶體映射 I/O 位址寫入一個 16 位元的值。
+ * English: Writes a 16-bit value to the specified memory-mapped I/O address.
+ */
+static inline void mmio_write16(uintptr_t addr, uint16_t value)
+{
+    *(volatile uint16_t *)addr = value;
+}
+
+/*
+ * Chinese: 從指定的記憶體映射 I/O 位址讀取一個 8 位元的值。
+ * English: Reads an 8-bit value from the specified memory-mapped I/O address.
+ */
+static inline uint8_t mmio_read8(uintptr_t addr)
+{
+    return *(volatile uint8_t *)addr;
+}
+
+/*
+ * Chinese: 從指定的記憶體映射 I/O 位址讀取一個 16 位元的值。
+ * English: Reads a 16-bit value from the specified memory-mapped I/O address.
+ */
+static inline uint16_t mmio_read16(uintptr_t addr)
+{
+    return *(volatile uint16_t *)addr;
+}
+
 /*
  * Chinese: 從指定的記憶體映射 I/O 位址讀取一個 32 位元的值。
  * English: Reads a 32-bit value from the specified memory-mapped I/O address.
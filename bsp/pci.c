@@ -0,0 +1,205 @@
+#include "pci.h"
+
+#include "mmio.h"
+#include "uart.h"
+
+#define PCI_VENDOR_ID           0x00u
+#define PCI_DEVICE_ID           0x02u
+#define PCI_COMMAND             0x04u
+#define PCI_STATUS              0x06u
+#define PCI_HEADER_TYPE         0x0Eu
+#define PCI_BAR0                0x10u
+#define PCI_SUBSYSTEM_ID        0x2Eu
+#define PCI_CAP_PTR             0x34u
+
+#define PCI_COMMAND_MEMORY      0x0002u
+#define PCI_COMMAND_MASTER      0x0004u
+#define PCI_COMMAND_INTX_OFF    0x0400u
+#define PCI_STATUS_CAP_LIST     0x0010u
+#define PCI_HEADER_MULTI        0x80u
+
+#define PCI_BAR_IO              0x1u
+#define PCI_BAR_MEM_64          0x4u
+#define PCI_BAR_MEM_MASK        0xFFFFFFF0u
+
+#define PCI_MSIX_CTRL           2u
+#define PCI_MSIX_TABLE          4u
+#define PCI_MSIX_CTRL_ENABLE    0x8000u
+#define PCI_MSIX_CTRL_MASKALL   0x4000u
+#define PCI_MSIX_CTRL_SIZE      0x07FFu
+#define PCI_MSIX_ENTRY_SIZE     16u
+#define PCI_MSIX_ENTRY_DATA     8u
+#define PCI_MSIX_ENTRY_CTRL     12u
+#define PCI_MSIX_ENTRY_MASKED   0x1u
+
+#define PCI_FUNCTIONS           256u   /* 32 devices x 8 functions on bus 0 */
+
+static uintptr_t g_pci_mmio_next = PCI_MMIO_BASE;
+
+uint8_t pci_cfg_read8(const struct pci_device *pdev, uint32_t offset)
+{
+    return mmio_read8(pdev->cfg + offset);
+}
+
+uint16_t pci_cfg_read16(const struct pci_device *pdev, uint32_t offset)
+{
+    return mmio_read16(pdev->cfg + offset);
+}
+
+uint32_t pci_cfg_read32(const struct pci_device *pdev, uint32_t offset)
+{
+    return mmio_read32(pdev->cfg + offset);
+}
+
+void pci_cfg_write16(const struct pci_device *pdev, uint32_t offset, uint16_t value)
+{
+    mmio_write16(pdev->cfg + offset, value);
+}
+
+void pci_cfg_write32(const struct pci_device *pdev, uint32_t offset, uint32_t value)
+{
+    mmio_write32(pdev->cfg + offset, value);
+}
+
+int pci_scan(uintptr_t ecam, size_t *cursor, struct pci_device *out)
+{
+    for (size_t devfn = *cursor; devfn < PCI_FUNCTIONS; ++devfn) {
+        uintptr_t cfg = ecam + (devfn << 12);
+        uint16_t vendor = mmio_read16(cfg + PCI_VENDOR_ID);
+
+        if (vendor == 0xFFFFu) {
+            /* No function 0 means no other functions either */
+            if ((devfn & 7u) == 0u) {
+                devfn += 7u;
+            }
+            continue;
+        }
+        if ((devfn & 7u) == 0u && (mmio_read8(cfg + PCI_HEADER_TYPE) & PCI_HEADER_MULTI) == 0u) {
+            *cursor = devfn + 8u;
+        } else {
+            *cursor = devfn + 1u;
+        }
+
+        for (size_t i = 0u; i < 6u; ++i) {
+            out->bar[i] = 0u;
+        }
+        out->cfg = cfg;
+        out->bdf = (uint16_t)devfn;
+        out->vendor_id = vendor;
+        out->device_id = mmio_read16(cfg + PCI_DEVICE_ID);
+        out->subsystem_id = mmio_read16(cfg + PCI_SUBSYSTEM_ID);
+        out->msix_table = 0u;
+        out->msix_size = 0u;
+        return 0;
+    }
+
+    *cursor = PCI_FUNCTIONS;
+    return -1;
+}
+
+int pci_enable(struct pci_device *pdev)
+{
+    uint16_t command = pci_cfg_read16(pdev, PCI_COMMAND);
+
+    /* Decoding stays off while the BARs are probed */
+    pci_cfg_write16(pdev, PCI_COMMAND, (uint16_t)(command & ~(PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER)));
+
+    for (uint32_t i = 0u; i < 6u; ++i) {
+        uint32_t offset = PCI_BAR0 + i * 4u;
+        uint32_t original = pci_cfg_read32(pdev, offset);
+        int is64 = (original & PCI_BAR_IO) == 0u && (original & 0x6u) == PCI_BAR_MEM_64;
+
+        if ((original & PCI_BAR_IO) != 0u) {
+            continue;
+        }
+        if ((original & PCI_BAR_MEM_MASK) != 0u) {
+            pdev->bar[i] = original & PCI_BAR_MEM_MASK;
+        } else {
+            pci_cfg_write32(pdev, offset, 0xFFFFFFFFu);
+            uint32_t mask = pci_cfg_read32(pdev, offset) & PCI_BAR_MEM_MASK;
+            uint32_t size = ~mask + 1u;
+            if (mask == 0u) {
+                pci_cfg_write32(pdev, offset, original);
+                if (is64) {
+                    ++i;
+                }
+                continue;
+            }
+
+            /* BARs are naturally aligned to their size */
+            uintptr_t base = (g_pci_mmio_next + size - 1u) & ~(uintptr_t)(size - 1u);
+            if (base + size > PCI_MMIO_BASE + PCI_MMIO_SIZE) {
+                uart_puts("[PCI] MMIO window exhausted\n");
+                return -1;
+            }
+            g_pci_mmio_next = base + size;
+            pci_cfg_write32(pdev, offset, (uint32_t)base);
+            pdev->bar[i] = base;
+        }
+        if (is64) {
+            /* The window is below 4 GB */
+            pci_cfg_write32(pdev, offset + 4u, 0u);
+            ++i;
+        }
+    }
+
+    command = (uint16_t)(command | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER | PCI_COMMAND_INTX_OFF);
+    pci_cfg_write16(pdev, PCI_COMMAND, command);
+    return 0;
+}
+
+uint8_t pci_find_cap(const struct pci_device *pdev, uint8_t cap_id, uint8_t after)
+{
+    if ((pci_cfg_read16(pdev, PCI_STATUS) & PCI_STATUS_CAP_LIST) == 0u) {
+        return 0u;
+    }
+
+    uint8_t offset = (after != 0u) ? pci_cfg_read8(pdev, after + 1u) : pci_cfg_read8(pdev, PCI_CAP_PTR);
+    /* 48 capabilities fill the 192 bytes after the header: anything longer is a loop */
+    for (uint32_t guard = 0u; offset >= 0x40u && guard < 48u; ++guard) {
+        offset &= 0xFCu;
+        if (pci_cfg_read8(pdev, offset) == cap_id) {
+            return offset;
+        }
+        offset = pci_cfg_read8(pdev, offset + 1u);
+    }
+    return 0u;
+}
+
+uint16_t pci_msix_enable(struct pci_device *pdev)
+{
+    uint8_t cap = pci_find_cap(pdev, PCI_CAP_ID_MSIX, 0u);
+    if (cap == 0u) {
+        return 0u;
+    }
+
+    uint16_t ctrl = pci_cfg_read16(pdev, cap + PCI_MSIX_CTRL);
+    uint32_t table = pci_cfg_read32(pdev, cap + PCI_MSIX_TABLE);
+    uintptr_t bar = pdev->bar[table & 0x7u];
+    if (bar == 0u) {
+        return 0u;
+    }
+
+    pdev->msix_table = bar + (table & ~0x7u);
+    pdev->msix_size = (uint16_t)((ctrl & PCI_MSIX_CTRL_SIZE) + 1u);
+    for (uint16_t v = 0u; v < pdev->msix_size; ++v) {
+        mmio_write32(pdev->msix_table + v * PCI_MSIX_ENTRY_SIZE + PCI_MSIX_ENTRY_CTRL, PCI_MSIX_ENTRY_MASKED);
+    }
+
+    ctrl = (uint16_t)((ctrl | PCI_MSIX_CTRL_ENABLE) & ~PCI_MSIX_CTRL_MASKALL);
+    pci_cfg_write16(pdev, cap + PCI_MSIX_CTRL, ctrl);
+    return pdev->msix_size;
+}
+
+void pci_msix_set(const struct pci_device *pdev, uint16_t vector, uint64_t address, uint32_t data)
+{
+    if (vector >= pdev->msix_size) {
+        return;
+    }
+
+    uintptr_t entry = pdev->msix_table + vector * PCI_MSIX_ENTRY_SIZE;
+    mmio_write32(entry, (uint32_t)address);
+    mmio_write32(entry + 4u, (uint32_t)(address >> 32));
+    mmio_write32(entry + PCI_MSIX_ENTRY_DATA, data);
+    mmio_write32(entry + PCI_MSIX_ENTRY_CTRL, 0u);
+}
@@ -0,0 +1,59 @@
+#ifndef BSP_PCI_H
+#define BSP_PCI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * PCIe host bridge of QEMU virt. The ECAM window sits below 4 GB only when
+ * the machine runs with highmem=off; otherwise it moves above the 4 GB the
+ * MMU maps, and the low window faults. Memory BARs are given addresses from
+ * the 32-bit MMIO window, since no firmware assigns them before us.
+ */
+#define PCI_ECAM_BASE           0x3F000000u
+#define PCI_MMIO_BASE           0x10000000u
+#define PCI_MMIO_SIZE           0x2EFF0000u
+
+#define PCI_CAP_ID_VNDR         0x09u
+#define PCI_CAP_ID_MSIX         0x11u
+
+/* One function on bus 0 */
+struct pci_device {
+    uintptr_t cfg;              /* its 4 KB of ECAM configuration space */
+    uint16_t bdf;               /* bus/device/function: also its ITS device ID */
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint16_t subsystem_id;
+    uintptr_t bar[6];           /* assigned by pci_enable(); 0 for an absent BAR */
+    uintptr_t msix_table;       /* set by pci_msix_enable() */
+    uint16_t msix_size;
+};
+
+/*
+ * Find the next function on bus 0 of the ECAM window at or after *cursor
+ * (start at 0) and step the cursor past it. Returns -1 once the bus is done.
+ */
+int pci_scan(uintptr_t ecam, size_t *cursor, struct pci_device *out);
+
+uint8_t pci_cfg_read8(const struct pci_device *pdev, uint32_t offset);
+uint16_t pci_cfg_read16(const struct pci_device *pdev, uint32_t offset);
+uint32_t pci_cfg_read32(const struct pci_device *pdev, uint32_t offset);
+void pci_cfg_write16(const struct pci_device *pdev, uint32_t offset, uint16_t value);
+void pci_cfg_write32(const struct pci_device *pdev, uint32_t offset, uint32_t value);
+
+/*
+ * Assign every memory BAR an address (keeping one a previous call gave it),
+ * then enable memory decoding and bus mastering with legacy INTx off.
+ */
+int pci_enable(struct pci_device *pdev);
+
+/* Offset of the first capability with 'cap_id' after offset 'after' (0: from the start), 0 if none */
+uint8_t pci_find_cap(const struct pci_device *pdev, uint8_t cap_id, uint8_t after);
+
+/* Locate the MSI-X table, mask every vector and enable MSI-X; returns the vector count, 0 without MSI-X */
+uint16_t pci_msix_enable(struct pci_device *pdev);
+
+/* Point MSI-X 'vector' at an address/data pair and unmask it */
+void pci_msix_set(const struct pci_device *pdev, uint16_t vector, uint64_t address, uint32_t data);
+
+#endif /* BSP_PCI_H */
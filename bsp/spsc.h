@@ -0,0 +1,80 @@
+#ifndef BSP_SPSC_H
+#define BSP_SPSC_H
+
+#include <stdint.h>
+
+/*
+ * Lock-free single-producer/single-consumer ring, for handing entries from an
+ * interrupt handler to one task (or between any two contexts that each keep
+ * to their side). The ring only tracks positions: its owner keeps an array of
+ * 'size' entries (a power of two) and indexes it with spsc_ring_slot(). The
+ * producer writes the entry at spsc_ring_tail() and publishes it with
+ * spsc_ring_push(); the consumer reads entries from spsc_ring_head() and
+ * hands them back with spsc_ring_pop().
+ *
+ * Each index is written by one side only and has a cache line to itself.
+ * Publishing an index is a store-release and reading the other side's is a
+ * load-acquire, so entry accesses never cross the index update that covers
+ * them and neither side masks interrupts.
+ */
+#define SPSC_CACHE_LINE     64u
+
+struct spsc_ring {
+    uint32_t mask;                                                  /* size - 1, fixed at init */
+    uint32_t head __attribute__((aligned(SPSC_CACHE_LINE)));        /* consumer: next entry to read */
+    uint32_t tail __attribute__((aligned(SPSC_CACHE_LINE)));        /* producer: next entry to write */
+} __attribute__((aligned(SPSC_CACHE_LINE)));
+
+/* Empty the ring; neither side may be using it */
+static inline void spsc_ring_init(struct spsc_ring *ring, uint32_t size)
+{
+    ring->mask = size - 1u;
+    __atomic_store_n(&ring->head, 0u, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->tail, 0u, __ATOMIC_RELEASE);
+}
+
+/* Entry index of a free-running position */
+static inline uint32_t spsc_ring_slot(const struct spsc_ring *ring, uint32_t pos)
+{
+    return pos & ring->mask;
+}
+
+/* Producer: position of the next entry to fill */
+static inline uint32_t spsc_ring_tail(const struct spsc_ring *ring)
+{
+    return __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+}
+
+/* Producer: entries that can be filled; the consumer is done with everything before them */
+static inline uint32_t spsc_ring_space(const struct spsc_ring *ring)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    return ring->mask + 1u - (spsc_ring_tail(ring) - head);
+}
+
+/* Producer: publish 'count' entries filled from spsc_ring_tail() on */
+static inline void spsc_ring_push(struct spsc_ring *ring, uint32_t count)
+{
+    __atomic_store_n(&ring->tail, spsc_ring_tail(ring) + count, __ATOMIC_RELEASE);
+}
+
+/* Consumer: position of the oldest entry */
+static inline uint32_t spsc_ring_head(const struct spsc_ring *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+}
+
+/* Consumer: entries published and not yet popped; their contents are visible */
+static inline uint32_t spsc_ring_count(const struct spsc_ring *ring)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return tail - spsc_ring_head(ring);
+}
+
+/* Consumer: hand the 'count' oldest entries back to the producer */
+static inline void spsc_ring_pop(struct spsc_ring *ring, uint32_t count)
+{
+    __atomic_store_n(&ring->head, spsc_ring_head(ring) + count, __ATOMIC_RELEASE);
+}
+
+#endif /* BSP_SPSC_H */
@@ -42,6 +42,24 @@ static inline void cntv_ctl_write(uint64_t value)
     __asm__ volatile("msr cntv_ctl_el0, %0" :: "r"(value));
 }
 
+/*
+ * Chinese: 寫入實體計時器比較值（cntp_cval_el0）。
+ * English: Writes the physical timer compare value (cntp_cval_el0).
+ */
+static inline void cntp_cval_write(uint64_t value)
+{
+    __asm__ volatile("msr cntp_cval_el0, %0" :: "r"(value));
+}
+
+/*
+ * Chinese: 寫入實體計時器控制暫存器（cntp_ctl_el0）。
+ * English: Writes the physical timer control register (cntp_ctl_el0).
+ */
+static inline void cntp_ctl_write(uint64_t value)
+{
+    __asm__ volatile("msr cntp_ctl_el0, %0" :: "r"(value));
+}
+
 /*
  * Chinese: 初始化系統計時器，設定指定的滴答頻率（Hz）。
  * English: Initializes the system timer with the specified tick frequency in Hz.
@@ -88,4 +106,35 @@ void timer_delay_ms(uint32_t ms)
 uint64_t timer_cntfrq(void)
 {
     return cntfrq_read();
-}
\ No newline at end of file
+}
+
+/*
+ * Chinese: 讀取系統計數器（CNTPCT_EL0）。
+ * English: Reads the system counter (CNTPCT_EL0).
+ */
+uint64_t timer_count(void)
+{
+    __asm__ volatile("isb");
+    return cntpct_read();
+}
+
+/*
+ * Chinese: 設定單次計時器在計數器達到 deadline 時觸發。
+ * English: Arms the one-shot timer to fire when the counter reaches 'deadline'.
+ */
+void timer_oneshot_arm(uint64_t deadline)
+{
+    cntp_cval_write(deadline);
+    cntp_ctl_write(1u);
+    __asm__ volatile("isb");
+}
+
+/*
+ * Chinese: 停止單次計時器並清除其中斷。
+ * English: Stops the one-shot timer and clears its interrupt.
+ */
+void timer_oneshot_cancel(void)
+{
+    cntp_ctl_write(0u);
+    __asm__ volatile("isb");
+}
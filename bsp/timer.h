@@ -27,4 +27,29 @@ void timer_delay_ms(uint32_t ms);
  */
 uint64_t timer_cntfrq(void);
 
+/*
+ * Chinese: 讀取系統計數器（CNTPCT_EL0）。
+ * English: Reads the system counter (CNTPCT_EL0).
+ */
+uint64_t timer_count(void);
+
+/*
+ * Chinese: 單次計時器使用 EL1 實體計時器，中斷 ID 為 PPI 30（OS 滴答使用虛擬計時器）。
+ * English: The one-shot timer is the EL1 physical timer on PPI 30 (the OS tick uses the virtual timer).
+ */
+#define TIMER_ONESHOT_IRQ   30u
+
+/*
+ * Chinese: 設定單次計時器在計數器達到 deadline 時觸發；已過去的 deadline 立即觸發。
+ * English: Arms the one-shot timer to fire when the counter reaches 'deadline';
+ *          a deadline already passed fires at once.
+ */
+void timer_oneshot_arm(uint64_t deadline);
+
+/*
+ * Chinese: 停止單次計時器並清除其中斷（位準觸發，須在 EOI 前呼叫）。
+ * English: Stops the one-shot timer and clears its (level) interrupt; call before EOI.
+ */
+void timer_oneshot_cancel(void);
+
 #endif
\ No newline at end of file
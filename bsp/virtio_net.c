@@ -5,7 +5,10 @@
 #include "timer.h"
 #include "lib.h"
 #include "bsp_int.h"
-#include "cache.h"
+#include "dma.h"
+#include "spsc.h"
+#include "gic.h"
+#include "pci.h"
 
 #include <ucos_ii.h>
 
@@ -34,6 +37,36 @@
 #define VIRTIO_MMIO_QUEUE_USED_HIGH     0x0A4u
 #define VIRTIO_MMIO_CONFIG              0x100u
 
+/* virtio-pci modern: vendor capabilities locate these structures in the BARs */
+#define VIRTIO_PCI_VENDOR_ID            0x1AF4u
+#define VIRTIO_PCI_DEVICE_NET           0x1041u   /* 0x1040 + device type */
+#define VIRTIO_PCI_DEVICE_NET_LEGACY    0x1000u   /* transitional; subsystem ID gives the type */
+#define VIRTIO_PCI_CAP_COMMON_CFG       1u
+#define VIRTIO_PCI_CAP_NOTIFY_CFG       2u
+#define VIRTIO_PCI_CAP_ISR_CFG          3u
+#define VIRTIO_PCI_CAP_DEVICE_CFG       4u
+#define VIRTIO_PCI_CAP_TYPE             3u        /* offsets within struct virtio_pci_cap */
+#define VIRTIO_PCI_CAP_BAR              4u
+#define VIRTIO_PCI_CAP_OFFSET           8u
+#define VIRTIO_PCI_CAP_NOTIFY_MULT      16u
+#define VIRTIO_PCI_NO_VECTOR            0xFFFFu
+
+/* struct virtio_pci_common_cfg */
+#define VIRTIO_PCI_DEVICE_FEATURE_SEL   0x00u
+#define VIRTIO_PCI_DEVICE_FEATURE       0x04u
+#define VIRTIO_PCI_DRIVER_FEATURE_SEL   0x08u
+#define VIRTIO_PCI_DRIVER_FEATURE       0x0Cu
+#define VIRTIO_PCI_CONFIG_MSIX_VECTOR   0x10u
+#define VIRTIO_PCI_DEVICE_STATUS        0x14u
+#define VIRTIO_PCI_QUEUE_SELECT         0x16u
+#define VIRTIO_PCI_QUEUE_SIZE           0x18u
+#define VIRTIO_PCI_QUEUE_MSIX_VECTOR    0x1Au
+#define VIRTIO_PCI_QUEUE_ENABLE         0x1Cu
+#define VIRTIO_PCI_QUEUE_NOTIFY_OFF     0x1Eu
+#define VIRTIO_PCI_QUEUE_DESC           0x20u
+#define VIRTIO_PCI_QUEUE_DRIVER         0x28u
+#define VIRTIO_PCI_QUEUE_DEVICE         0x30u
+
 #define VIRTIO_STATUS_ACKNOWLEDGE       0x01u
 #define VIRTIO_STATUS_DRIVER            0x02u
 #define VIRTIO_STATUS_DRIVER_OK         0x04u
@@ -42,18 +75,91 @@
 
 #define VIRTIO_ID_NET                   0x01u
 
+#define VIRTIO_NET_F_CSUM               0u
+#define VIRTIO_NET_F_GUEST_CSUM         1u
+#define VIRTIO_NET_F_MTU                3u
 #define VIRTIO_NET_F_MAC                5u
+#define VIRTIO_NET_F_GUEST_TSO4         7u
+#define VIRTIO_NET_F_HOST_TSO4          11u
+#define VIRTIO_NET_F_MRG_RXBUF          15u
+#define VIRTIO_NET_F_CTRL_VQ            17u
+#define VIRTIO_NET_F_CTRL_RX            18u
+#define VIRTIO_NET_F_CTRL_VLAN          19u
+#define VIRTIO_NET_F_CTRL_RX_EXTRA      20u
+#define VIRTIO_NET_F_MQ                 22u
+#define VIRTIO_RING_F_INDIRECT_DESC     28u
+#define VIRTIO_RING_F_EVENT_IDX         29u
 #define VIRTIO_F_VERSION_1              32u
+#define VIRTIO_F_ACCESS_PLATFORM        33u
+#define VIRTIO_F_RING_PACKED            34u
+#define VIRTIO_F_IN_ORDER               35u
 
 #define VRING_DESC_F_NEXT               0x01u
 #define VRING_DESC_F_WRITE              0x02u
-
+#define VRING_DESC_F_INDIRECT           0x04u
+
+#define VRING_AVAIL_F_NO_INTERRUPT      0x01u
+#define VRING_USED_F_NO_NOTIFY          0x01u
+
+#define VRING_PACKED_DESC_F_AVAIL       0x0080u
+#define VRING_PACKED_DESC_F_USED        0x8000u
+#define VRING_PACKED_EVENT_F_ENABLE     0x0u
+#define VRING_PACKED_EVENT_F_DISABLE    0x1u
+#define VRING_PACKED_EVENT_F_DESC       0x2u
+#define VRING_PACKED_EVENT_WRAP_SHIFT   15u
+
+/* Granule of the cache maintenance counted in ring_lines */
+#define VIRTIO_NET_CACHE_LINE           64u
+
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM     0x01u
+#define VIRTIO_NET_HDR_F_DATA_VALID     0x02u
+
+#define VIRTIO_NET_HDR_GSO_NONE         0x00u
+#define VIRTIO_NET_HDR_GSO_TCPV4        0x01u
+#define VIRTIO_NET_HDR_GSO_ECN          0x80u
+
+#define VIRTIO_NET_ETH_HLEN             14u
+#define VIRTIO_NET_TCP_FIN              0x01u
+#define VIRTIO_NET_TCP_PSH              0x08u
+#define VIRTIO_NET_TCP_CWR              0x80u
+
+#define VIRTIO_NET_CTRL_RX              0u
+#define VIRTIO_NET_CTRL_RX_PROMISC      0u
+#define VIRTIO_NET_CTRL_RX_ALLMULTI     1u
+#define VIRTIO_NET_CTRL_RX_ALLUNI       2u
+#define VIRTIO_NET_CTRL_RX_NOMULTI      3u
+#define VIRTIO_NET_CTRL_RX_NOUNI        4u
+#define VIRTIO_NET_CTRL_RX_NOBCAST      5u
+#define VIRTIO_NET_CTRL_MAC             1u
+#define VIRTIO_NET_CTRL_MAC_TABLE_SET   0u
+#define VIRTIO_NET_CTRL_VLAN            2u
+#define VIRTIO_NET_CTRL_VLAN_ADD        0u
+#define VIRTIO_NET_CTRL_VLAN_DEL        1u
+#define VIRTIO_NET_CTRL_MQ              4u
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET 0u
+#define VIRTIO_NET_OK                   0u
+
+/* Queue pair n uses virtqueues 2n (RX) and 2n + 1 (TX); the control queue follows the last pair */
 #define VIRTIO_NET_RX_QUEUE             0u
 #define VIRTIO_NET_TX_QUEUE             1u
 
-#define VIRTIO_NET_QUEUE_SIZE           256u
-#define VIRTIO_NET_BUFFER_SIZE          2048u
-#define VIRTIO_NET_TX_BATCH_SIZE        16u   /* notify host every N queued TX frames */
+#define VIRTIO_NET_BUFFER_SIZE          2048u  /* TX slot buffer */
+#define VIRTIO_NET_RX_BUFFER_SIZE       1536u  /* header + one standard frame; larger frames merge buffers */
+#define VIRTIO_NET_RX_SMALL_SIZE        128u   /* copy-break slot and split header buffer: two cache lines */
+#define VIRTIO_NET_JUMBO_BUFFER_SIZE    9088u  /* header + VIRTIO_NET_MAX_JUMBO_FRAME_SIZE, line rounded */
+#define VIRTIO_NET_GSO_BUFFER_SIZE      65600u /* header + VIRTIO_NET_MAX_GSO_FRAME_SIZE, line rounded */
+#define VIRTIO_NET_TX_JUMBO_BUFFERS     8u     /* per-device TX buffers for frames above one slot */
+#define VIRTIO_NET_TX_GSO_BUFFERS       2u     /* per-device TX buffers for TSO super-frames */
+#define VIRTIO_NET_NAPI_BUDGET          64u   /* default RX completions harvested per poll wake-up */
+#define VIRTIO_NET_TX_BACKLOG_DEPTH     16u   /* frames queued in software behind a full TX ring */
+#define VIRTIO_NET_TX_BACKLOG_FRAME     VIRTIO_NET_MAX_FRAME_SIZE
+#define VIRTIO_NET_TX_BLOCK_MS          100u  /* default wait of VIRTIO_NET_TX_POLICY_BLOCK */
+#define VIRTIO_NET_TX_SG_TABLE_OFFSET   64u   /* indirect table of a scatter-gather frame, in its slot buffer */
+#define VIRTIO_NET_CTRL_QUEUE_SIZE      8u
+#define VIRTIO_NET_CTRL_BUFFER_SIZE     256u
+#define VIRTIO_NET_CTRL_DATA_MAX        190u   /* command data between the class/cmd header and the ack */
+#define VIRTIO_NET_CTRL_ACK_OFFSET      192u   /* own cache line: written by the device */
+#define VIRTIO_NET_CTRL_POLL_LIMIT      1000000u
 
 struct virtio_net_hdr {
     uint8_t flags;
@@ -75,8 +181,7 @@ struct vring_desc {
 struct vring_avail {
     uint16_t flags;
     uint16_t idx;
-    uint16_t ring[VIRTIO_NET_QUEUE_SIZE];
-    uint16_t used_event;
+    uint16_t ring[];            /* queue size entries, then used_event */
 } __attribute__((packed));
 
 struct vring_used_elem {
@@ -87,51 +192,268 @@ struct vring_used_elem {
 struct vring_used {
     uint16_t flags;
     uint16_t idx;
-    struct vring_used_elem ring[VIRTIO_NET_QUEUE_SIZE];
-    uint16_t avail_event;
+    struct vring_used_elem ring[];   /* queue size entries, then avail_event */
+} __attribute__((packed));
+
+/* Packed ring (VIRTIO_F_RING_PACKED): one descriptor array carries both directions */
+struct vring_packed_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t id;
+    uint16_t flags;
+} __attribute__((packed));
+
+struct vring_packed_event {
+    uint16_t off_wrap;
+    uint16_t flags;
 } __attribute__((packed));
 
+/*
+ * One virtqueue in either layout. The packed ring reuses the split ring's
+ * storage: the descriptor array becomes the ring and the avail/used areas
+ * hold the driver and device event structures. Both layouts keep free-running
+ * posted/used_count in descriptors so callers never look at the ring format.
+ */
 struct virtio_queue {
     struct vring_desc *desc;
     struct vring_avail *avail;
     struct vring_used *used;
+    uint8_t packed;             /* VIRTIO_F_RING_PACKED layout */
+    uint8_t in_order;           /* split: VIRTIO_F_IN_ORDER, only a batch's last used element is written */
+    uint8_t avail_wrap;         /* packed: wrap counter of next_avail */
+    uint8_t used_wrap;          /* packed: wrap counter of next_used */
+    struct vring_packed_desc *ring;              /* packed: aliases desc */
+    struct vring_packed_event *driver_event;     /* packed: aliases avail */
+    struct vring_packed_event *device_event;     /* packed: aliases used */
+    uint16_t next_avail;        /* packed: slot the next buffer is written to */
+    uint16_t next_used;         /* packed: slot the next completion is read from */
+    uint16_t head_flags;        /* packed: flags of the batch head, written last */
+    uintptr_t used_line;        /* packed: ring line refreshed in the current completion pass */
+    uint16_t posted;            /* descriptors made available */
+    uint16_t used_count;        /* descriptors the device has returned */
+    uint16_t used_heads;        /* split: used elements consumed */
+    uint16_t used_idx;          /* split: used->idx as of the last sync */
+    uint16_t staged;            /* descriptors written since the last publish */
+    uint16_t staged_heads;      /* split: avail entries written since the last publish */
+    uint16_t dirty_first;       /* split: first rewritten descriptor not yet cleaned */
+    uint16_t dirty_count;       /* split: consecutive descriptors from dirty_first */
+    uint16_t chain_head;        /* id of the chain being staged */
+    uint8_t chain_open;         /* the last staged descriptor carries NEXT */
+    uint16_t kick_idx;          /* avail position at the last notify decision */
+    uint32_t kicks;             /* QUEUE_NOTIFY writes issued */
+    uint32_t kicks_suppressed;  /* notifies skipped because the device did not ask */
+    uint32_t ring_lines;        /* cache lines cleaned or invalidated on ring memory */
+    uint32_t used_reads;        /* split: used->idx reads */
+    uint8_t dma;                /* DMA_COHERENT or DMA_NONCOHERENT: the device's coherency */
+    uintptr_t notify;           /* virtio-pci doorbell of this queue, 0 on virtio-mmio */
+    uint8_t *chain;             /* descriptors behind each chain head, one per slot */
+};
+
+/* FIFO pool of large TX buffers; completions are in order, so the oldest returns first */
+struct virtio_net_tx_pool {
+    uint8_t *buffers[VIRTIO_NET_TX_JUMBO_BUFFERS];
+    uint16_t posted[VIRTIO_NET_TX_JUMBO_BUFFERS];   /* queue posted count just after each buffer went out */
+    uint8_t count;
+    uint8_t next;           /* next buffer to hand out */
+    uint8_t inflight;
+    size_t capacity;        /* frame bytes per buffer */
 };
 
 struct virtio_net_config {
     uint8_t mac[6];
     uint16_t status;
     uint16_t max_virtqueue_pairs;
+    uint16_t mtu;
 } __attribute__((packed));
 
+struct virtio_net_ctrl_hdr {
+    uint8_t class;
+    uint8_t cmd;
+} __attribute__((packed));
+
+struct rx_completion_entry {
+    uint16_t desc_id;
+    uint8_t copied;         /* frame is in the entry's small slot; the descriptor went back at harvest */
+    uint32_t total_len;
+};
+
+/*
+ * Receive half of a queue pair. Harvest (the ISR, or the RX task while NAPI
+ * polls) produces completions and the RX task consumes them through a
+ * lock-free SPSC ring; buffers harvest frees early travel back the same way
+ * on the recycle ring, so only the RX task ever stages RX descriptors. The
+ * ring indices lead, each on its own cache line, and the virtqueue follows on
+ * lines of its own, never shared with another queue. The per-slot arrays live
+ * in the DMA arena, sized to the ring.
+ */
+struct virtio_net_rxq {
+    struct spsc_ring ring;     /* completions: entry i is completions[i] and small slot i */
+    struct spsc_ring recycle;  /* descriptors to stage again (copy-break, overflow): recycled[] */
+    volatile uint8_t polling;  /* NAPI: interrupts masked, the task harvests the used ring */
+    uint16_t budget_left;      /* NAPI: completions left in the current poll */
+    uint16_t copybreak;        /* frames up to this many bytes are copied at harvest, 0 for none */
+    uint8_t last_full;         /* previous completion filled its buffer: the next may continue a merged frame */
+    uint16_t size;
+    uint32_t index;            /* virtqueue number */
+    uint32_t completed;        /* RX used elements consumed */
+    OS_EVENT *sem;
+    uint8_t *merge_buffer;     /* reassembly area for frames spanning several RX buffers; NULL if none can */
+    size_t merge_size;         /* bytes of frame merge_buffer holds */
+    uint8_t *small;            /* copy-break slots, one per completion ring entry */
+    uint8_t *split;            /* header split: header buffers, one per descriptor pair; NULL when off */
+    uint32_t polls;            /* NAPI: interrupts that switched the queue to polling */
+    uint32_t budget_exhausted; /* NAPI: polls that ran out of budget with work left */
+    uint32_t copybreaks;       /* frames copied out at harvest */
+    struct rx_completion_entry *completions;   /* one per slot */
+    uint16_t *recycled;        /* recycle ring entries, one per slot */
+    uint8_t **buffers;
+    struct virtio_queue vq __attribute__((aligned(VIRTIO_NET_CACHE_LINE)));
+} __attribute__((aligned(VIRTIO_NET_CACHE_LINE)));
+
+/* A frame waiting in the software TX queue */
+struct virtio_net_tx_backlog_entry {
+    struct virtio_net_tx_offload offload;
+    uint8_t has_offload;
+    uint16_t len;
+    uint8_t data[VIRTIO_NET_TX_BACKLOG_FRAME];
+};
+
+/*
+ * Transmit half of a queue pair. Tasks touch the ring only with the scheduler
+ * locked and 'busy' set; the ISR, which drains the backlog on TX completions,
+ * leaves a busy ring alone and flags the interrupt for the holder to replay.
+ * Per-frame state leads; the large-frame pools and counters trail the ring.
+ */
+struct virtio_net_txq {
+    uint32_t index;            /* virtqueue number */
+    uint16_t size;
+    uint16_t batch_count;      /* frames queued but host not yet notified */
+    volatile uint8_t busy;     /* a task holds the ring */
+    volatile uint8_t irq_missed;   /* an interrupt arrived while busy */
+    uint8_t irq_armed;         /* TX used-buffer interrupt requested */
+    uint8_t leased;            /* next TX slot is reserved by a caller */
+    uint16_t backlog_head;
+    volatile uint16_t backlog_count;
+    uint32_t completed;        /* TX used elements reclaimed */
+    uint8_t *lease_buffer;     /* buffer handed to the lease holder */
+    size_t lease_capacity;     /* frame bytes available in lease_buffer */
+    struct virtio_net_tx_pool *lease_pool;   /* pool lease_buffer came from, NULL for a slot buffer */
+    struct virtio_net_tx_backlog_entry *backlog;   /* software queue behind a full ring */
+    uint8_t **buffers;
+    uint16_t batch_limit;      /* notify once this many frames are queued, adapted to the send rate */
+    uint16_t batch_max;        /* ceiling for batch_limit */
+    uint32_t post_gap;         /* counter ticks between frames, moving average */
+    uint64_t last_post;        /* counter at the previous frame */
+    uint64_t batch_deadline;   /* counter by which the open batch must be notified */
+    volatile uint8_t flush_due;    /* the deadline passed while busy; notify on unclaim */
+    uint16_t loans_out;        /* forwarded RX buffers in flight on this ring */
+    uint8_t **loans;           /* per slot: forwarded RX buffer to return to the pool, or NULL */
+    struct virtio_queue vq __attribute__((aligned(VIRTIO_NET_CACHE_LINE)));
+    struct virtio_net_tx_pool jumbo;         /* frames above one slot buffer */
+    struct virtio_net_tx_pool gso;           /* TSO super-frames */
+    uint32_t sg_frames;        /* scatter-gather frames sent from caller memory */
+    uint32_t sg_copied;        /* scatter-gather frames linearised into a TX buffer */
+    uint16_t backlog_max;      /* deepest the backlog has been */
+    uint32_t drops;            /* frames dropped: backlog full (tail-drop) or block timed out */
+    uint32_t eagain;           /* sends refused with VIRTIO_NET_EAGAIN */
+    uint32_t blocked;          /* times a sender slept waiting for room */
+    uint32_t fwd_frames;       /* frames sent from another device's RX buffer */
+    uint32_t fwd_copied;       /* forwarded frames that had to be copied */
+    uint32_t bursts;           /* virtio_net_send_burst_queue() batches staged together */
+    uint32_t burst_frames;     /* frames those batches carried */
+    uint32_t flushes[VIRTIO_NET_TX_FLUSH_REASONS];     /* batches notified, by reason */
+    uint32_t batch_hist[VIRTIO_NET_TX_BATCH_BUCKETS];  /* batches notified, by size */
+} __attribute__((aligned(VIRTIO_NET_CACHE_LINE)));
+
+/*
+ * One device, laid out by who touches what. The first cache line is the
+ * read-mostly state every RX and TX path consults (plus the ISR counter),
+ * each queue half starts on its own line, and everything only init, MTU
+ * changes or the control queue use comes last.
+ */
 struct virtio_net_device {
     uintptr_t base;
     uint32_t irq;
-    uint16_t rx_queue_size;
-    uint16_t tx_queue_size;
-    uint16_t rx_last_used;
-    uint16_t tx_last_used;
-    uint8_t mac[6];
+    uint8_t index;             /* slot in g_devices, so a handle maps back in O(1) */
     uint8_t driver_ok;
-    struct virtio_queue *rx_queue;
-    struct virtio_queue *tx_queue;
-    uint8_t *rx_buffers[VIRTIO_NET_QUEUE_SIZE];
-    uint8_t *tx_buffers[VIRTIO_NET_QUEUE_SIZE];
-    OS_EVENT *rx_sem;
-    uint16_t tx_batch_count;   /* frames queued but host not yet notified */
-};
+    uint8_t event_idx;         /* VIRTIO_RING_F_EVENT_IDX negotiated */
+    uint8_t mrg_rxbuf;         /* VIRTIO_NET_F_MRG_RXBUF negotiated */
+    uint8_t packed;            /* VIRTIO_F_RING_PACKED negotiated */
+    uint8_t indirect;          /* VIRTIO_RING_F_INDIRECT_DESC negotiated */
+    uint8_t in_order;          /* VIRTIO_F_IN_ORDER negotiated: buffers are used in the order posted */
+    uint8_t napi;              /* RX interrupts only wake the task, which polls */
+    uint8_t tx_policy;         /* VIRTIO_NET_TX_POLICY_*: ring and backlog both full */
+    uint16_t napi_budget;      /* completions harvested per poll */
+    uint16_t tx_block_ms;      /* POLICY_BLOCK: longest wait for room */
+    uint32_t offloads;         /* VIRTIO_NET_OFFLOAD_* negotiated */
+    uint16_t mtu;              /* current MTU */
+    uint16_t queue_pairs;      /* pairs the device is steering across */
+    uint16_t max_queue_pairs;  /* pairs set up at init: device offer capped by VIRTIO_NET_MAX_QUEUE_PAIRS */
+    volatile uint8_t tx_waiters;
+    OS_EVENT *tx_sem;          /* POLICY_BLOCK: senders waiting for room */
+    uint8_t mac[6];
+    uint32_t irq_count;        /* used-buffer interrupts taken */
+    uint32_t tx_deadline;      /* longest wait of an unnotified TX frame, counter ticks */
+    struct virtio_net_rxq rxq[VIRTIO_NET_MAX_QUEUE_PAIRS];
+    struct virtio_net_txq txq[VIRTIO_NET_MAX_QUEUE_PAIRS];
+    uint8_t mq;                /* VIRTIO_NET_F_MQ negotiated */
+    uint8_t ctrl_rx;           /* VIRTIO_NET_RX_MODE_* the device can filter on */
+    uint8_t rx_mode;           /* VIRTIO_NET_RX_MODE_* last accepted by the device */
+    uint8_t ctrl_vlan;         /* VIRTIO_NET_F_CTRL_VLAN negotiated */
+    uint8_t pci;               /* virtio-pci transport: base is the common configuration */
+    uint16_t msix_vectors;     /* virtio-pci: MSI-X vectors, virtqueue n uses vector n */
+    uint32_t msix_lpi;         /* virtio-pci: LPI behind vector 0 */
+    uint32_t pci_notify_mult;  /* virtio-pci: doorbell stride per queue_notify_off */
+    uintptr_t pci_notify;      /* virtio-pci: doorbell region */
+    uintptr_t pci_isr;         /* virtio-pci: ISR status byte (unused with MSI-X) */
+    uintptr_t config;          /* device-specific configuration (struct virtio_net_config) */
+    uint16_t mtu_max;          /* largest MTU the device and RX buffering can carry */
+    uint8_t dma_coherency;     /* DMA_COHERENT or DMA_NONCOHERENT, copied into each queue */
+    uint8_t rx_split;          /* RX header split: buffers posted behind a header buffer */
+    struct virtio_queue ctrl;  /* control virtqueue, polled synchronously */
+    uint32_t ctrl_index;
+    uint16_t ctrl_size;        /* 0 without VIRTIO_NET_F_CTRL_VQ */
+    uint8_t *ctrl_buffer;
+    size_t dma_bytes;          /* arena memory behind the rings and buffers */
+} __attribute__((aligned(VIRTIO_NET_CACHE_LINE)));
 
 /* Multiple device support */
 static struct virtio_net_device g_devices[VIRTIO_NET_MAX_DEVICES];
-static struct virtio_queue g_rx_queues[VIRTIO_NET_MAX_DEVICES];
-static struct virtio_queue g_tx_queues[VIRTIO_NET_MAX_DEVICES];
 static size_t g_device_count = 0u;
 
-static struct vring_desc g_rx_desc[VIRTIO_NET_MAX_DEVICES][VIRTIO_NET_QUEUE_SIZE] __attribute__((aligned(16)));
-static struct vring_desc g_tx_desc[VIRTIO_NET_MAX_DEVICES][VIRTIO_NET_QUEUE_SIZE] __attribute__((aligned(16)));
-static struct vring_avail g_rx_avail[VIRTIO_NET_MAX_DEVICES] __attribute__((aligned(4096)));
-static struct vring_avail g_tx_avail[VIRTIO_NET_MAX_DEVICES] __attribute__((aligned(4096)));
-static struct vring_used g_rx_used[VIRTIO_NET_MAX_DEVICES] __attribute__((aligned(4096)));
-static struct vring_used g_tx_used[VIRTIO_NET_MAX_DEVICES] __attribute__((aligned(4096)));
+/* Ring depths requested per device, 0 for the default; applied at the next init */
+struct virtio_net_queue_config {
+    uint16_t rx_size;
+    uint16_t tx_size;
+    uint8_t dma;            /* VIRTIO_NET_DMA_* */
+    uint8_t rx_split;       /* post RX buffers behind a header buffer */
+};
+
+static struct virtio_net_queue_config g_queue_config[VIRTIO_NET_MAX_DEVICES];
+
+/*
+ * Spare RX buffers for zero-copy forwarding. A forwarded frame's RX buffer
+ * goes out on the egress TX ring and a spare takes its RX slot; the buffer
+ * becomes a spare itself once the TX completes. Shared by all devices, LIFO.
+ */
+struct virtio_net_fwd_pool {
+    uint8_t **free;
+    uint16_t count;         /* spares available now */
+    uint16_t total;         /* 0 until virtio_net_fwd_pool_init() */
+};
+
+static struct virtio_net_fwd_pool g_fwd_pool;
+
+/*
+ * Arena block behind each device. It outlives g_devices[] being cleared so a
+ * re-init reuses it when the new layout fits rather than leaking the old one.
+ */
+struct virtio_net_dma_block {
+    uint8_t *base;
+    size_t size;
+};
+
+static struct virtio_net_dma_block g_dma_blocks[VIRTIO_NET_MAX_DEVICES];
 
 static OS_EVENT *g_rx_global_sem = NULL;
 
@@ -148,18 +470,26 @@ static INT32U virtio_ms_to_ticks(INT16U timeout_ms)
     return ticks;
 }
 
-static uint8_t g_rx_buffer_storage[VIRTIO_NET_MAX_DEVICES][VIRTIO_NET_QUEUE_SIZE][VIRTIO_NET_BUFFER_SIZE] __attribute__((aligned(64)));
-static uint8_t g_tx_buffer_storage[VIRTIO_NET_MAX_DEVICES][VIRTIO_NET_QUEUE_SIZE][VIRTIO_NET_BUFFER_SIZE] __attribute__((aligned(64)));
+/* Microseconds in system counter ticks, at least one */
+static uint32_t virtio_net_us_to_counts(uint32_t us)
+{
+    uint64_t counts = (timer_cntfrq() * (uint64_t)us) / 1000000u;
+    return (counts != 0u) ? (uint32_t)counts : 1u;
+}
+
+/* Device behind each virtio-mmio IRQ, for virtio_net_interrupt_handler() */
+static struct virtio_net_device *g_irq_devices[VIRTIO_NET_MMIO_TRANSPORTS];
 
-struct rx_completion_entry {
-    uint16_t desc_id;
-    uint32_t total_len;
-};
+static void virtio_net_isr(uint32_t int_id, void *p_arg);
+static void virtio_net_msix_isr(uint32_t int_id, void *p_arg);
+static void virtio_net_tx_timer_init(void);
 
-static struct rx_completion_entry g_rx_completions[VIRTIO_NET_MAX_DEVICES][VIRTIO_NET_QUEUE_SIZE];
-static volatile uint16_t g_rx_completion_head[VIRTIO_NET_MAX_DEVICES] = {0u};
-static volatile uint16_t g_rx_completion_tail[VIRTIO_NET_MAX_DEVICES] = {0u};
-static volatile uint16_t g_rx_completion_count[VIRTIO_NET_MAX_DEVICES] = {0u};
+/* Earliest TX batch deadline the one-shot timer is armed for, 0 when idle */
+static volatile uint64_t g_tx_timer_at = 0u;
+static uint8_t g_tx_timer_ready = 0u;
+
+/* PCIe ECAM window to look for virtio-pci functions in, 0 for virtio-mmio only */
+static uintptr_t g_pci_ecam = 0u;
 
 /* Legacy single device pointer (points to device 0) */
 static struct virtio_net_device *g_dev = NULL;
@@ -178,768 +508,3947 @@ static inline void virtio_mmio_write32(uintptr_t base, uint32_t offset, uint32_t
     __asm__ volatile("dsb ish" ::: "memory");
 }
 
+/*
+ * virtio-pci modern carries the same registers in its common configuration,
+ * so the driver keeps speaking virtio-mmio offsets and a PCI device has them
+ * translated. Identification reads answer for the probe that already matched.
+ */
+static uint32_t virtio_pci_reg_read(const struct virtio_net_device *dev, uint32_t offset)
+{
+    uint32_t value;
+
+    switch (offset) {
+    case VIRTIO_MMIO_MAGIC_VALUE:
+        return 0x74726976u;
+    case VIRTIO_MMIO_VERSION:
+        return 2u;
+    case VIRTIO_MMIO_DEVICE_ID:
+        return VIRTIO_ID_NET;
+    case VIRTIO_MMIO_VENDOR_ID:
+        return VIRTIO_PCI_VENDOR_ID;
+    case VIRTIO_MMIO_DEVICE_FEATURES:
+        value = mmio_read32(dev->base + VIRTIO_PCI_DEVICE_FEATURE);
+        break;
+    case VIRTIO_MMIO_QUEUE_NUM_MAX:
+        /* queue_size reads the maximum until the driver writes its choice */
+        value = mmio_read16(dev->base + VIRTIO_PCI_QUEUE_SIZE);
+        break;
+    case VIRTIO_MMIO_STATUS:
+        value = mmio_read8(dev->base + VIRTIO_PCI_DEVICE_STATUS);
+        break;
+    case VIRTIO_MMIO_INTERRUPT_STATUS:
+        value = mmio_read8(dev->pci_isr);
+        break;
+    default:
+        return 0u;
+    }
+    __asm__ volatile("dsb ish" ::: "memory");
+    return value;
+}
+
+static void virtio_pci_reg_write(const struct virtio_net_device *dev, uint32_t offset, uint32_t value)
+{
+    uintptr_t common = dev->base;
+
+    __asm__ volatile("dsb ishst" ::: "memory");
+    switch (offset) {
+    case VIRTIO_MMIO_DEVICE_FEATURES_SEL:
+        mmio_write32(common + VIRTIO_PCI_DEVICE_FEATURE_SEL, value);
+        break;
+    case VIRTIO_MMIO_DRIVER_FEATURES_SEL:
+        mmio_write32(common + VIRTIO_PCI_DRIVER_FEATURE_SEL, value);
+        break;
+    case VIRTIO_MMIO_DRIVER_FEATURES:
+        mmio_write32(common + VIRTIO_PCI_DRIVER_FEATURE, value);
+        break;
+    case VIRTIO_MMIO_QUEUE_SEL:
+        mmio_write16(common + VIRTIO_PCI_QUEUE_SELECT, (uint16_t)value);
+        break;
+    case VIRTIO_MMIO_QUEUE_NUM:
+        mmio_write16(common + VIRTIO_PCI_QUEUE_SIZE, (uint16_t)value);
+        break;
+    case VIRTIO_MMIO_QUEUE_READY:
+        mmio_write16(common + VIRTIO_PCI_QUEUE_ENABLE, (uint16_t)value);
+        break;
+    case VIRTIO_MMIO_STATUS:
+        mmio_write8(common + VIRTIO_PCI_DEVICE_STATUS, (uint8_t)value);
+        break;
+    case VIRTIO_MMIO_QUEUE_DESC_LOW:
+    case VIRTIO_MMIO_QUEUE_DESC_HIGH:
+        mmio_write32(common + VIRTIO_PCI_QUEUE_DESC + (offset - VIRTIO_MMIO_QUEUE_DESC_LOW), value);
+        break;
+    case VIRTIO_MMIO_QUEUE_AVAIL_LOW:
+    case VIRTIO_MMIO_QUEUE_AVAIL_HIGH:
+        mmio_write32(common + VIRTIO_PCI_QUEUE_DRIVER + (offset - VIRTIO_MMIO_QUEUE_AVAIL_LOW), value);
+        break;
+    case VIRTIO_MMIO_QUEUE_USED_LOW:
+    case VIRTIO_MMIO_QUEUE_USED_HIGH:
+        mmio_write32(common + VIRTIO_PCI_QUEUE_DEVICE + (offset - VIRTIO_MMIO_QUEUE_USED_LOW), value);
+        break;
+    default:
+        /* GUEST_PAGE_SIZE is legacy-only; MSI-X needs no INTERRUPT_ACK */
+        break;
+    }
+    __asm__ volatile("dsb ish" ::: "memory");
+}
+
 static inline uint32_t virtio_reg_read(const struct virtio_net_device *dev, uint32_t offset)
 {
+    if (dev->pci != 0u) {
+        return virtio_pci_reg_read(dev, offset);
+    }
     return virtio_mmio_read32(dev->base, offset);
 }
 
 static inline void virtio_reg_write(const struct virtio_net_device *dev, uint32_t offset, uint32_t value)
 {
+    if (dev->pci != 0u) {
+        virtio_pci_reg_write(dev, offset, value);
+        return;
+    }
     virtio_mmio_write32(dev->base, offset, value);
 }
 
-static void log_hex32(const char *prefix, uint32_t value)
+/* Doorbell: virtio-mmio takes the queue number in one register, virtio-pci has an address per queue */
+static inline void virtio_net_notify(const struct virtio_net_device *dev, const struct virtio_queue *queue,
+                                     uint32_t queue_index)
 {
-    uart_puts(prefix);
-    uart_write_hex((unsigned long)value);
-    uart_putc('\n');
+    if (queue->notify != 0u) {
+        __asm__ volatile("dsb ishst" ::: "memory");
+        mmio_write16(queue->notify, (uint16_t)queue_index);
+        return;
+    }
+    virtio_mmio_write32(dev->base, VIRTIO_MMIO_QUEUE_NOTIFY, queue_index);
 }
 
-static void log_hex8(uint8_t value)
+/* used_event/avail_event trail the ring, so they are located by queue_size */
+static inline volatile uint16_t *vring_used_event(struct vring_avail *avail, uint16_t queue_size)
 {
-    static const char digits[] = "0123456789ABCDEF";
-    uart_putc(digits[(value >> 4u) & 0xFu]);
-    uart_putc(digits[value & 0xFu]);
+    return (volatile uint16_t *)((uint8_t *)avail + 4u + (size_t)queue_size * sizeof(uint16_t));
 }
 
-static void log_status(const char *label, uint32_t status)
+static inline volatile uint16_t *vring_avail_event(struct vring_used *used, uint16_t queue_size)
 {
-    uart_puts(label);
-    uart_puts(" status=0x");
-    uart_write_hex((unsigned long)status);
-    uart_putc('\n');
+    return (volatile uint16_t *)((uint8_t *)used + 4u + (size_t)queue_size * sizeof(struct vring_used_elem));
 }
 
-static int virtio_net_scan(uintptr_t *base_out, uint32_t *irq_out, size_t start_index)
+/* Bytes of each split-ring area, event fields included; the packed layout needs less */
+static inline size_t vring_avail_size(uint16_t queue_size)
 {
-    static const uintptr_t candidates[] = {
-        0x0A000000u, 0x0A000200u, 0x0A000400u, 0x0A000600u,
-        0x0A000800u, 0x0A000A00u, 0x0A000C00u, 0x0A000E00u,
-        0x0A001000u, 0x0A001200u, 0x0A001400u, 0x0A001600u,
-        0x0A001800u, 0x0A001A00u, 0x0A001C00u, 0x0A001E00u
-    };
-    static const uint32_t irqs[] = {
-        48u, 49u, 50u, 51u,
-        52u, 53u, 54u, 55u,
-        56u, 57u, 58u, 59u,
-        60u, 61u, 62u, 63u
-    };
+    return 4u + (size_t)queue_size * sizeof(uint16_t) + sizeof(uint16_t);
+}
 
-    size_t found_count = 0u;
-    for (size_t i = 0u; i < (sizeof(candidates) / sizeof(candidates[0])); ++i) {
-        uint32_t magic = virtio_mmio_read32(candidates[i], VIRTIO_MMIO_MAGIC_VALUE);
-        if (magic == 0x74726976u) {
-            uint32_t device_id = virtio_mmio_read32(candidates[i], VIRTIO_MMIO_DEVICE_ID);
-            if (device_id == VIRTIO_ID_NET || device_id == 0u) {
-                if (found_count == start_index) {
-                    *base_out = candidates[i];
-                    *irq_out = irqs[i];
-                    uart_puts("[virtio-net] Detected device at base 0x");
-                    uart_write_hex((unsigned long)candidates[i]);
-                    uart_puts(", IRQ ");
-                    uart_write_dec(irqs[i]);
-                    uart_putc('\n');
-                    return 0;
-                }
-                found_count++;
-            }
-        }
-    }
+static inline size_t vring_used_size(uint16_t queue_size)
+{
+    return 4u + (size_t)queue_size * sizeof(struct vring_used_elem) + sizeof(uint16_t);
+}
 
-    return -1;
+/* Virtio spec 2.7.10: true if event_idx lies in the window (old_idx, new_idx] */
+static inline int vring_need_event(uint16_t event_idx, uint16_t new_idx, uint16_t old_idx)
+{
+    return (uint16_t)(new_idx - event_idx - 1u) < (uint16_t)(new_idx - old_idx);
 }
 
-static void virtio_net_prepare_rx(struct virtio_net_device *dev, size_t dev_idx)
+/* Ring memory hand-over; maintenance is counted in cache lines for virtio_net_get_stats_dev() */
+static inline uint32_t vq_lines(const void *addr, size_t size)
 {
-    struct virtio_queue *queue = dev->rx_queue;
-    struct vring_desc *desc = queue->desc;
-    struct vring_avail *avail = queue->avail;
-    for (uint16_t i = 0u; i < dev->rx_queue_size; ++i) {
-        dev->rx_buffers[i] = &g_rx_buffer_storage[dev_idx][i][0];
-        util_memset(dev->rx_buffers[i], 0, VIRTIO_NET_BUFFER_SIZE);
-        cache_clean_range(dev->rx_buffers[i], VIRTIO_NET_BUFFER_SIZE);
-        desc[i].addr = (uint64_t)(uintptr_t)dev->rx_buffers[i];
-        desc[i].len = VIRTIO_NET_BUFFER_SIZE;
-        desc[i].flags = VRING_DESC_F_WRITE;
-        desc[i].next = 0u;
-        avail->ring[i] = i;
-    }
-    avail->idx = dev->rx_queue_size;
-    dev->rx_last_used = 0u;
-    g_rx_completion_head[dev_idx] = 0u;
-    g_rx_completion_tail[dev_idx] = 0u;
-    g_rx_completion_count[dev_idx] = 0u;
+    uintptr_t start = (uintptr_t)addr & ~(uintptr_t)(VIRTIO_NET_CACHE_LINE - 1u);
+    uintptr_t end = (uintptr_t)addr + size;
+    return (uint32_t)((end - start + VIRTIO_NET_CACHE_LINE - 1u) / VIRTIO_NET_CACHE_LINE);
+}
 
-    cache_clean_range(desc, sizeof(struct vring_desc) * dev->rx_queue_size);
-    cache_clean_range(avail, sizeof(*avail));
-    cache_clean_range(queue->used, sizeof(*queue->used));
+static inline void vq_clean(struct virtio_queue *queue, const void *addr, size_t size)
+{
+    if (queue->dma != DMA_COHERENT) {
+        queue->ring_lines += vq_lines(addr, size);
+    }
+    dma_sync_for_device(queue->dma, addr, size);
 }
 
-static void virtio_net_prepare_tx(struct virtio_net_device *dev, size_t dev_idx)
+static inline void vq_invalidate(struct virtio_queue *queue, void *addr, size_t size)
 {
-    struct virtio_queue *queue = dev->tx_queue;
-    struct vring_desc *desc = queue->desc;
-    struct vring_avail *avail = queue->avail;
-    for (uint16_t i = 0u; i < dev->tx_queue_size; ++i) {
-        dev->tx_buffers[i] = &g_tx_buffer_storage[dev_idx][i][0];
-        util_memset(dev->tx_buffers[i], 0, VIRTIO_NET_BUFFER_SIZE);
-        desc[i].addr = 0u;
-        desc[i].len = 0u;
-        desc[i].flags = 0u;
-        desc[i].next = 0u;
+    if (queue->dma != DMA_COHERENT) {
+        queue->ring_lines += vq_lines(addr, size);
     }
-    avail->idx = 0u;
-    dev->tx_last_used = 0u;
+    dma_sync_for_cpu(queue->dma, addr, size);
+}
 
-    cache_clean_range(desc, sizeof(struct vring_desc) * dev->tx_queue_size);
-    cache_clean_range(avail, sizeof(*avail));
-    cache_clean_range(queue->used, sizeof(*queue->used));
+static inline void vring_set_used_event(struct virtio_queue *queue, uint16_t queue_size, uint16_t value)
+{
+    volatile uint16_t *event = vring_used_event(queue->avail, queue_size);
+    *event = value;
+    vq_clean(queue, (const void *)event, sizeof(*event));
 }
 
-static void virtio_net_handle_rx_used(struct virtio_net_device *dev, size_t dev_idx)
+/* Clean the run of rewritten split descriptors, in two pieces if it wraps */
+static void virtio_queue_clean_descs(struct virtio_queue *queue, uint16_t queue_size)
 {
-    struct virtio_queue *queue = dev->rx_queue;
-    uint16_t queue_size = dev->rx_queue_size;
-    uint8_t notify_device = 0u;
-    uint8_t enqueued = 0u;
-    struct vring_used *used = queue->used;
-    struct vring_avail *avail = queue->avail;
+    uint16_t first = queue->dirty_first;
+    uint16_t count = queue->dirty_count;
 
-    /* Batch invalidate entire used ring before scanning */
-    cache_invalidate_range(used, sizeof(struct vring_used) + queue_size * sizeof(struct vring_used_elem));
+    if (count == 0u) {
+        return;
+    }
+    queue->dirty_count = 0u;
+    if ((uint32_t)first + count <= queue_size) {
+        vq_clean(queue, &queue->desc[first], (size_t)count * sizeof(struct vring_desc));
+    } else {
+        vq_clean(queue, &queue->desc[first], (size_t)(queue_size - first) * sizeof(struct vring_desc));
+        vq_clean(queue, &queue->desc[0], ((size_t)first + count - queue_size) * sizeof(struct vring_desc));
+    }
+}
 
-    while (1) {
-        if (dev->rx_last_used == used->idx) {
-            break;
-        }
-        uint16_t used_index = (uint16_t)(dev->rx_last_used % queue_size);
-        struct vring_used_elem *elem = &used->ring[used_index];
-        uint16_t desc_id = (uint16_t)elem->id;
+/* Add a rewritten descriptor to the run; one that does not extend it cleans the run first */
+static inline void virtio_queue_dirty_desc(struct virtio_queue *queue, uint16_t queue_size, uint16_t id)
+{
+    if (queue->dirty_count != 0u &&
+        (id != (uint16_t)((queue->dirty_first + queue->dirty_count) % queue_size) ||
+         queue->dirty_count >= queue_size)) {
+        virtio_queue_clean_descs(queue, queue_size);
+    }
+    if (queue->dirty_count == 0u) {
+        queue->dirty_first = id;
+    }
+    queue->dirty_count++;
+}
 
-        if (desc_id >= queue_size) {
-            uart_puts("[virtio-net] RX descriptor index out of range\n");
-            dev->rx_last_used++;
-            continue;
-        }
+/*
+ * Append one descriptor to the batch that starts at the next free ring
+ * position; nothing reaches the device until virtio_queue_publish(). A
+ * descriptor flagged NEXT continues into the next one staged, so a chain is
+ * staged head first with consecutive ids (split: descriptor indices; packed:
+ * the whole chain carries the head's id). A split ring only rewrites a
+ * descriptor whose contents changed, which RX descriptors never do, and
+ * cleans consecutive rewritten descriptors as one range at publish. A packed
+ * ring keeps the batch head unavailable until the rest is in memory; the
+ * device consumes strictly in ring order, so it cannot get past the head.
+ */
+static void virtio_queue_stage(struct virtio_queue *queue, uint16_t queue_size,
+                               uint16_t id, uint64_t addr, uint32_t len, uint16_t flags)
+{
+    uint16_t k = queue->staged;
+    uint8_t head = (uint8_t)(queue->chain_open == 0u);
 
-        if (g_rx_completion_count[dev_idx] >= queue_size) {
-            uart_puts("[virtio-net] RX completion queue full\n");
-            uint16_t slot = (uint16_t)(avail->idx % queue_size);
-            avail->ring[slot] = desc_id;
-            cache_clean_range(&avail->ring[slot], sizeof(uint16_t));
-            avail->idx++;
-            cache_clean_range(&avail->idx, sizeof(avail->idx));
-            dev->rx_last_used++;
-            notify_device = 1u;
-            continue;
+    if (head != 0u) {
+        queue->chain_head = id;
+        if (id < queue_size) {
+            queue->chain[id] = 1u;
         }
-
-        g_rx_completions[dev_idx][g_rx_completion_tail[dev_idx]].desc_id = desc_id;
-        g_rx_completions[dev_idx][g_rx_completion_tail[dev_idx]].total_len = elem->len;
-        g_rx_completion_tail[dev_idx] = (uint16_t)((g_rx_completion_tail[dev_idx] + 1u) % queue_size);
-        g_rx_completion_count[dev_idx]++;
-        enqueued = 1u;
-
-        dev->rx_last_used++;
-    }
-
-    if (notify_device != 0u) {
-        virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_NOTIFY, VIRTIO_NET_RX_QUEUE);
+    } else if (queue->chain_head < queue_size) {
+        queue->chain[queue->chain_head]++;
     }
-
-    if (enqueued != 0u) {
-        if (dev->rx_sem != NULL) {
-            OSSemPost(dev->rx_sem);
+    queue->chain_open = (uint8_t)((flags & VRING_DESC_F_NEXT) != 0u);
+    queue->staged++;
+
+    if (queue->packed == 0u) {
+        struct vring_desc *desc = &queue->desc[id];
+        uint16_t next = ((flags & VRING_DESC_F_NEXT) != 0u) ? (uint16_t)((id + 1u) % queue_size) : 0u;
+        if (desc->addr != addr || desc->len != len || desc->flags != flags || desc->next != next) {
+            desc->addr = addr;
+            desc->len = len;
+            desc->flags = flags;
+            desc->next = next;
+            virtio_queue_dirty_desc(queue, queue_size, id);
         }
-        if (g_rx_global_sem != NULL) {
-            OSSemPost(g_rx_global_sem);
+        if (head != 0u) {
+            queue->avail->ring[(uint16_t)(queue->avail->idx + queue->staged_heads) % queue_size] = id;
+            queue->staged_heads++;
         }
+        return;
     }
 
+    uint16_t slot = (uint16_t)(queue->next_avail + k);
+    uint8_t wrap = queue->avail_wrap;
+    if (slot >= queue_size) {
+        slot = (uint16_t)(slot - queue_size);
+        wrap ^= 1u;
+    }
+    /* Available: AVAIL matches the wrap counter and USED does not */
+    uint16_t avail_flags = (wrap != 0u) ? VRING_PACKED_DESC_F_AVAIL : VRING_PACKED_DESC_F_USED;
+    struct vring_packed_desc *entry = &queue->ring[slot];
+
+    entry->addr = addr;
+    entry->len = len;
+    entry->id = queue->chain_head;
+    if (k == 0u) {
+        queue->head_flags = (uint16_t)(flags | avail_flags);
+        avail_flags ^= (uint16_t)(VRING_PACKED_DESC_F_AVAIL | VRING_PACKED_DESC_F_USED);
+    }
+    entry->flags = (uint16_t)(flags | avail_flags);
 }
 
-static int virtio_net_configure_queue(struct virtio_net_device *dev,
-                                      uint32_t queue_index,
-                                      struct virtio_queue *queue,
-                                      uint16_t *queue_size_out)
+/* Hand every staged descriptor to the device */
+static void virtio_queue_publish(struct virtio_queue *queue, uint16_t queue_size)
 {
-    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_SEL, queue_index);
-    uint32_t queue_max = virtio_reg_read(dev, VIRTIO_MMIO_QUEUE_NUM_MAX);
-    if (queue_max == 0u) {
-        uart_puts("[virtio-net] Queue not available\n");
-        return -1;
+    uint16_t count = queue->staged;
+
+    if (count == 0u) {
+        return;
+    }
+    queue->staged = 0u;
+
+    if (queue->packed == 0u) {
+        struct vring_avail *avail = queue->avail;
+        uint16_t heads = queue->staged_heads;
+        uint16_t first = (uint16_t)(avail->idx % queue_size);
+        virtio_queue_clean_descs(queue, queue_size);
+        /*
+         * Slots go out in one clean (two if they wrap), then the index is
+         * published once; it must not reach memory before the slots it covers.
+         */
+        if ((uint32_t)first + heads <= queue_size) {
+            vq_clean(queue, &avail->ring[first], (size_t)heads * sizeof(uint16_t));
+        } else {
+            vq_clean(queue, &avail->ring[first], (size_t)(queue_size - first) * sizeof(uint16_t));
+            vq_clean(queue, &avail->ring[0], ((size_t)first + heads - queue_size) * sizeof(uint16_t));
+        }
+        queue->staged_heads = 0u;
+        queue->posted = (uint16_t)(queue->posted + count);
+        avail->idx = (uint16_t)(avail->idx + heads);
+        vq_clean(queue, &avail->idx, sizeof(avail->idx));
+        return;
     }
 
-    uint16_t queue_size = (uint16_t)queue_max;
-    if (queue_size > VIRTIO_NET_QUEUE_SIZE) {
-        queue_size = VIRTIO_NET_QUEUE_SIZE;
+    /* Descriptors are written in place: one clean covers body and availability */
+    uint16_t first = queue->next_avail;
+    if ((uint32_t)first + count <= queue_size) {
+        vq_clean(queue, &queue->ring[first], (size_t)count * sizeof(struct vring_packed_desc));
+    } else {
+        vq_clean(queue, &queue->ring[first], (size_t)(queue_size - first) * sizeof(struct vring_packed_desc));
+        vq_clean(queue, &queue->ring[0], ((size_t)first + count - queue_size) * sizeof(struct vring_packed_desc));
     }
+    queue->ring[first].flags = queue->head_flags;
+    vq_clean(queue, &queue->ring[first].flags, sizeof(uint16_t));
 
-    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_NUM, queue_size);
+    queue->next_avail = (uint16_t)(first + count);
+    if (queue->next_avail >= queue_size) {
+        queue->next_avail = (uint16_t)(queue->next_avail - queue_size);
+        queue->avail_wrap ^= 1u;
+    }
+    queue->posted = (uint16_t)(queue->posted + count);
+}
 
-    util_memset(queue->desc, 0, sizeof(struct vring_desc) * queue_size);
-    util_memset(queue->avail, 0, sizeof(struct vring_avail));
-    util_memset(queue->used, 0, sizeof(struct vring_used));
+/* Position the device's notification suppression is expressed in: avail entries or packed slots */
+static inline uint16_t virtio_queue_avail_pos(const struct virtio_queue *queue)
+{
+    return (queue->packed != 0u) ? queue->posted : queue->avail->idx;
+}
 
-    cache_clean_range(queue->desc, sizeof(struct vring_desc) * queue_size);
-    cache_clean_range(queue->avail, sizeof(struct vring_avail));
-    cache_clean_range(queue->used, sizeof(struct vring_used));
+/* Return a completed chain's descriptors to the free count */
+static inline void virtio_queue_retire_chain(struct virtio_queue *queue, uint16_t queue_size, uint16_t id)
+{
+    uint16_t length = (id < queue_size && queue->chain[id] != 0u) ? queue->chain[id] : 1u;
+    queue->used_count = (uint16_t)(queue->used_count + length);
+}
 
-    uintptr_t desc_addr = (uintptr_t)queue->desc;
-    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_DESC_LOW, (uint32_t)desc_addr);
-    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_DESC_HIGH, (uint32_t)(desc_addr >> 32));
+/*
+ * Start a pass over completions: make what the device wrote since the last
+ * pass visible. The split ring refreshes used->idx and the new elements; the
+ * packed ring refreshes each line of descriptors as the scan reaches it. A
+ * packed line is shared with descriptors the driver writes, so it is cleaned
+ * as well as invalidated and never loses a staged entry.
+ */
+static void virtio_queue_sync_used(struct virtio_queue *queue, uint16_t queue_size)
+{
+    if (queue->packed != 0u) {
+        queue->used_line = 0u;
+        return;
+    }
 
-    uintptr_t avail_addr = (uintptr_t)queue->avail;
-    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_AVAIL_LOW, (uint32_t)avail_addr);
-    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_AVAIL_HIGH, (uint32_t)(avail_addr >> 32));
+    struct vring_used *used = queue->used;
+    /*
+     * In order, a batch is consumed whole before the index moves on: its last
+     * element is the only one known to be written, and a later index would
+     * turn it into a mid-batch slot.
+     */
+    if (queue->in_order != 0u && queue->used_heads != queue->used_idx) {
+        return;
+    }
+    vq_invalidate(queue, &used->idx, sizeof(used->idx));
+    queue->used_idx = used->idx;
+    queue->used_reads++;
+    uint16_t pending = (uint16_t)(queue->used_idx - queue->used_heads);
+    if (pending == 0u) {
+        return;
+    }
+    if (pending > queue_size) {
+        pending = queue_size;
+    }
+    if (queue->in_order != 0u) {
+        /* Earlier elements of the batch may never be written; only the last one is read */
+        vq_invalidate(queue, &used->ring[(uint16_t)(queue->used_idx - 1u) % queue_size],
+                      sizeof(struct vring_used_elem));
+        return;
+    }
+    uint16_t first = (uint16_t)(queue->used_heads % queue_size);
+    if ((uint32_t)first + pending <= queue_size) {
+        vq_invalidate(queue, &used->ring[first], (size_t)pending * sizeof(struct vring_used_elem));
+    } else {
+        vq_invalidate(queue, &used->ring[first], (size_t)(queue_size - first) * sizeof(struct vring_used_elem));
+        vq_invalidate(queue, &used->ring[0],
+                      ((size_t)first + pending - queue_size) * sizeof(struct vring_used_elem));
+    }
+}
 
-    uintptr_t used_addr = (uintptr_t)queue->used;
-    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_USED_LOW, (uint32_t)used_addr);
-    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_USED_HIGH, (uint32_t)(used_addr >> 32));
+/* The packed descriptor at next_used, refreshed once per line and pass; NULL if not yet used */
+static struct vring_packed_desc *virtio_queue_packed_used(struct virtio_queue *queue)
+{
+    struct vring_packed_desc *entry = &queue->ring[queue->next_used];
+    uintptr_t line = (uintptr_t)entry & ~(uintptr_t)(VIRTIO_NET_CACHE_LINE - 1u);
 
-    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_READY, 1u);
+    if (line != queue->used_line) {
+        if (queue->dma != DMA_COHERENT) {
+            queue->ring_lines++;
+        }
+        dma_sync_bidirectional(queue->dma, entry, sizeof(*entry));
+        queue->used_line = line;
+    }
 
-    *queue_size_out = queue_size;
-    return 0;
+    /* Used: AVAIL and USED both match the wrap counter */
+    uint16_t flags = entry->flags;
+    uint8_t avail = (uint8_t)((flags & VRING_PACKED_DESC_F_AVAIL) != 0u);
+    uint8_t used = (uint8_t)((flags & VRING_PACKED_DESC_F_USED) != 0u);
+    if (avail != used || used != queue->used_wrap) {
+        return NULL;
+    }
+    __asm__ volatile("dmb ishld" ::: "memory");
+    return entry;
 }
 
-static int virtio_net_init_device(size_t dev_idx, uintptr_t base_addr, uint32_t irq)
+/* Bytes the driver posted behind a chain head: its descriptors have consecutive ids */
+static uint32_t virtio_queue_posted_len(const struct virtio_queue *queue, uint16_t queue_size, uint16_t head)
 {
-    struct virtio_net_device *dev = &g_devices[dev_idx];
-
-    util_memset(dev, 0, sizeof(*dev));
-
-    dev->base = base_addr;
-    dev->irq = irq;
+    uint16_t count = (head < queue_size && queue->chain[head] != 0u) ? queue->chain[head] : 1u;
+    uint32_t len = 0u;
 
-    struct virtio_queue *rx_queue = &g_rx_queues[dev_idx];
-    struct virtio_queue *tx_queue = &g_tx_queues[dev_idx];
+    for (uint16_t i = 0u; i < count; ++i) {
+        len += queue->desc[(uint16_t)(head + i) % queue_size].len;
+    }
+    return len;
+}
 
-    rx_queue->desc = g_rx_desc[dev_idx];
-    rx_queue->avail = &g_rx_avail[dev_idx];
-    rx_queue->used = &g_rx_used[dev_idx];
+/*
+ * Consume the next completion; returns 0 if the device has not produced one.
+ * An in-order split ring takes each head from its own avail ring, like
+ * virtio_queue_reap(): only the batch's last used element is read, and the
+ * buffers before it were used in full.
+ */
+static int virtio_queue_get_used(struct virtio_queue *queue, uint16_t queue_size,
+                                 uint16_t *id_out, uint32_t *len_out)
+{
+    if (queue->packed == 0u) {
+        struct vring_used *used = queue->used;
+        /* Only elements the last sync covered: a newer index could point at stale lines */
+        if (queue->used_heads == queue->used_idx) {
+            return 0;
+        }
+        if (queue->in_order != 0u) {
+            uint16_t head = queue->avail->ring[queue->used_heads % queue_size];
+            queue->used_heads++;
+            *id_out = head;
+            *len_out = (queue->used_heads == queue->used_idx)
+                           ? used->ring[(uint16_t)(queue->used_idx - 1u) % queue_size].len
+                           : virtio_queue_posted_len(queue, queue_size, head);
+            virtio_queue_retire_chain(queue, queue_size, head);
+            return 1;
+        }
+        const struct vring_used_elem *elem = &used->ring[queue->used_heads % queue_size];
+        *id_out = (uint16_t)elem->id;
+        *len_out = elem->len;
+        queue->used_heads++;
+        virtio_queue_retire_chain(queue, queue_size, (uint16_t)elem->id);
+        return 1;
+    }
 
-    tx_queue->desc = g_tx_desc[dev_idx];
-    tx_queue->avail = &g_tx_avail[dev_idx];
-    tx_queue->used = &g_tx_used[dev_idx];
+    const struct vring_packed_desc *entry = virtio_queue_packed_used(queue);
+    if (entry == NULL) {
+        return 0;
+    }
+    uint16_t id = entry->id;
+    *id_out = id;
+    *len_out = entry->len;
+
+    /* A chain comes back as one used descriptor; skip the slots it occupied */
+    uint16_t skip = (id < queue_size) ? queue->chain[id] : 1u;
+    queue->next_used = (uint16_t)(queue->next_used + skip);
+    if (queue->next_used >= queue_size) {
+        queue->next_used = (uint16_t)(queue->next_used - queue_size);
+        queue->used_wrap ^= 1u;
+    }
+    queue->used_count = (uint16_t)(queue->used_count + skip);
+    return 1;
+}
 
-    dev->rx_queue = rx_queue;
-    dev->tx_queue = tx_queue;
-    dev->rx_sem = OSSemCreate(0u);
-    if (dev->rx_sem == NULL) {
-        uart_puts("[virtio-net] Warning: failed to create RX semaphore\n");
+/* Re-check for completions after a fresh sync */
+static int virtio_queue_has_used(struct virtio_queue *queue, uint16_t queue_size)
+{
+    virtio_queue_sync_used(queue, queue_size);
+    if (queue->packed == 0u) {
+        return queue->used_heads != queue->used_idx;
     }
+    return virtio_queue_packed_used(queue) != NULL;
+}
 
-    uart_puts("[virtio-net] Initialising device ");
-    uart_write_dec(dev_idx);
-    uart_putc('\n');
-    uart_puts("[virtio-net] Base 0x");
-    uart_write_hex((unsigned long)base_addr);
-    uart_puts(", IRQ ");
-    uart_write_dec(irq);
-    uart_putc('\n');
+/*
+ * Retire every completion without looking at it and return how many buffers
+ * came back. TX buffers complete in order (guaranteed by VIRTIO_F_IN_ORDER,
+ * which also lets the device write only the last element of a batch), so a
+ * split ring reads used->idx once and finds each chain head in its own avail
+ * ring instead of invalidating the used elements.
+ */
+static uint16_t virtio_queue_reap(struct virtio_queue *queue, uint16_t queue_size)
+{
+    uint16_t reaped = 0u;
+
+    if (queue->packed == 0u) {
+        vq_invalidate(queue, &queue->used->idx, sizeof(queue->used->idx));
+        uint16_t used_idx = queue->used->idx;
+        queue->used_idx = used_idx;
+        queue->used_reads++;
+        while (queue->used_heads != used_idx) {
+            uint16_t head = queue->avail->ring[queue->used_heads % queue_size];
+            queue->used_heads++;
+            virtio_queue_retire_chain(queue, queue_size, head);
+            reaped++;
+        }
+    } else {
+        uint16_t id;
+        uint32_t len;
+        virtio_queue_sync_used(queue, queue_size);
+        while (virtio_queue_get_used(queue, queue_size, &id, &len)) {
+            reaped++;
+        }
+    }
+    return reaped;
+}
 
-    uint32_t magic = virtio_reg_read(dev, VIRTIO_MMIO_MAGIC_VALUE);
-    if (magic != 0x74726976u) {
-        uart_puts("[virtio-net] Invalid magic\n");
-        return -1;
+/* EVENT_IDX: interrupt only once the device completes past what was consumed */
+static void virtio_queue_arm_event(struct virtio_queue *queue, uint16_t queue_size)
+{
+    if (queue->packed == 0u) {
+        vring_set_used_event(queue, queue_size, queue->used_heads);
+        return;
     }
+    struct vring_packed_event *event = queue->driver_event;
+    event->off_wrap = (uint16_t)(queue->next_used | ((uint16_t)queue->used_wrap << VRING_PACKED_EVENT_WRAP_SHIFT));
+    event->flags = VRING_PACKED_EVENT_F_DESC;
+    vq_clean(queue, event, sizeof(*event));
+}
 
-    uint32_t version = virtio_reg_read(dev, VIRTIO_MMIO_VERSION);
-    uart_puts("[virtio-net] Version ");
-    uart_write_dec(version);
-    uart_putc('\n');
+/*
+ * Mask used-buffer interrupts for a polled queue. With EVENT_IDX the used
+ * event is parked just behind what was consumed, a position the device has
+ * already passed, so it stays quiet until the event is re-armed.
+ */
+static void virtio_queue_disable_irq(struct virtio_queue *queue, uint16_t queue_size, uint8_t event_idx)
+{
+    if (queue->packed != 0u) {
+        queue->driver_event->flags = VRING_PACKED_EVENT_F_DISABLE;
+        vq_clean(queue, queue->driver_event, sizeof(*queue->driver_event));
+    } else if (event_idx != 0u) {
+        vring_set_used_event(queue, queue_size, (uint16_t)(queue->used_heads - 1u));
+    } else {
+        queue->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+        vq_clean(queue, &queue->avail->flags, sizeof(queue->avail->flags));
+    }
+}
 
-    if (version <= 1u) {
-        uart_puts("[virtio-net] Configuring guest page size for legacy virtio\n");
-        virtio_reg_write(dev, VIRTIO_MMIO_GUEST_PAGE_SIZE, 4096u);
+/* Unmask them again; the caller re-checks the ring for completions that raced the write */
+static void virtio_queue_enable_irq(struct virtio_queue *queue, uint16_t queue_size, uint8_t event_idx)
+{
+    if (event_idx != 0u) {
+        virtio_queue_arm_event(queue, queue_size);
+    } else if (queue->packed != 0u) {
+        queue->driver_event->flags = VRING_PACKED_EVENT_F_ENABLE;
+        vq_clean(queue, queue->driver_event, sizeof(*queue->driver_event));
+    } else {
+        queue->avail->flags = 0u;
+        vq_clean(queue, &queue->avail->flags, sizeof(queue->avail->flags));
     }
+}
 
-    uint32_t device_id = virtio_reg_read(dev, VIRTIO_MMIO_DEVICE_ID);
-    uint32_t vendor_id = virtio_reg_read(dev, VIRTIO_MMIO_VENDOR_ID);
-    log_hex32("[virtio-net] Device ID ", device_id);
-    log_hex32("[virtio-net] Vendor ID ", vendor_id);
+/*
+ * Decide whether the device wants a QUEUE_NOTIFY for the entries published
+ * since the last decision. With EVENT_IDX the device names the avail position
+ * it is waiting for; otherwise it can only switch notifications off.
+ */
+static int virtio_net_queue_needs_kick(const struct virtio_net_device *dev,
+                                       struct virtio_queue *queue,
+                                       uint16_t queue_size)
+{
+    uint16_t new_idx = virtio_queue_avail_pos(queue);
+    uint16_t old_idx = queue->kick_idx;
 
-    if (device_id != VIRTIO_ID_NET && device_id != 0u) {
-        uart_puts("[virtio-net] Device is not virtio-net\n");
-        return -1;
+    if (new_idx == old_idx) {
+        return 0;
+    }
+    queue->kick_idx = new_idx;
+
+    /* The entries were published with a clean (DSB) before we sample the device's view */
+    if (queue->packed != 0u) {
+        struct vring_packed_event *event = queue->device_event;
+        vq_invalidate(queue, event, sizeof(*event));
+        if (event->flags == VRING_PACKED_EVENT_F_DISABLE) {
+            return 0;
+        }
+        if (event->flags != VRING_PACKED_EVENT_F_DESC || dev->event_idx == 0u) {
+            return 1;
+        }
+        /* off_wrap names a ring slot; compare it in slot space, a lap back if its wrap differs */
+        uint16_t new_slot = queue->next_avail;
+        uint16_t old_slot = (uint16_t)(new_slot - (uint16_t)(new_idx - old_idx));
+        uint16_t off_wrap = event->off_wrap;
+        uint16_t event_slot = (uint16_t)(off_wrap & ~(1u << VRING_PACKED_EVENT_WRAP_SHIFT));
+        if ((off_wrap >> VRING_PACKED_EVENT_WRAP_SHIFT) != queue->avail_wrap) {
+            event_slot = (uint16_t)(event_slot - queue_size);
+        }
+        return vring_need_event(event_slot, new_slot, old_slot);
     }
 
-    /* Reset device status before negotiation */
-    virtio_reg_write(dev, VIRTIO_MMIO_STATUS, 0u);
+    if (dev->event_idx != 0u) {
+        volatile uint16_t *event = vring_avail_event(queue->used, queue_size);
+        vq_invalidate(queue, (void *)event, sizeof(*event));
+        return vring_need_event(*event, new_idx, old_idx);
+    }
 
-    uint32_t status_value = VIRTIO_STATUS_ACKNOWLEDGE;
-    virtio_reg_write(dev, VIRTIO_MMIO_STATUS, status_value);
-    uint32_t status = virtio_reg_read(dev, VIRTIO_MMIO_STATUS);
-    log_status("[virtio-net] ACKNOWLEDGE", status);
+    vq_invalidate(queue, &queue->used->flags, sizeof(queue->used->flags));
+    return (queue->used->flags & VRING_USED_F_NO_NOTIFY) == 0u;
+}
 
-    status_value |= VIRTIO_STATUS_DRIVER;
-    virtio_reg_write(dev, VIRTIO_MMIO_STATUS, status_value);
-    status = virtio_reg_read(dev, VIRTIO_MMIO_STATUS);
-    log_status("[virtio-net] DRIVER", status);
+static void virtio_net_kick(struct virtio_net_device *dev,
+                            struct virtio_queue *queue,
+                            uint16_t queue_size,
+                            uint32_t queue_index)
+{
+    uint16_t pending = (uint16_t)(virtio_queue_avail_pos(queue) - queue->kick_idx);
 
-    uint32_t features_lo;
-    uint32_t features_hi;
-    virtio_reg_write(dev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 0u);
-    features_lo = virtio_reg_read(dev, VIRTIO_MMIO_DEVICE_FEATURES);
-    virtio_reg_write(dev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 1u);
-    features_hi = virtio_reg_read(dev, VIRTIO_MMIO_DEVICE_FEATURES);
-    log_hex32("[virtio-net] Host features[31:0] ", features_lo);
-    log_hex32("[virtio-net] Host features[63:32] ", features_hi);
+    if (virtio_net_queue_needs_kick(dev, queue, queue_size)) {
+        virtio_net_notify(dev, queue, queue_index);
+        queue->kicks++;
+    } else if (pending != 0u) {
+        queue->kicks_suppressed++;
+    }
+}
 
-    uint32_t driver_features_lo = 0u;
-    uint32_t driver_features_hi = 0u;
-    if (features_lo & (1u << VIRTIO_NET_F_MAC)) {
-        driver_features_lo |= (1u << VIRTIO_NET_F_MAC);
+static void log_hex32(const char *prefix, uint32_t value)
+{
+    uart_puts(prefix);
+    uart_write_hex((unsigned long)value);
+    uart_putc('\n');
+}
+
+static void log_hex8(uint8_t value)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    uart_putc(digits[(value >> 4u) & 0xFu]);
+    uart_putc(digits[value & 0xFu]);
+}
+
+static void log_status(const char *label, uint32_t status)
+{
+    uart_puts(label);
+    uart_puts(" status=0x");
+    uart_write_hex((unsigned long)status);
+    uart_putc('\n');
+}
+
+/*
+ * Find the next virtio-net transport at or after *transport and step the
+ * cursor past it. Empty transports report device ID 0 and are skipped.
+ */
+static int virtio_net_scan(uintptr_t *base_out, uint32_t *irq_out, size_t *transport)
+{
+    for (size_t i = *transport; i < VIRTIO_NET_MMIO_TRANSPORTS; ++i) {
+        uintptr_t base = VIRTIO_NET_MMIO_BASE_DEFAULT + i * VIRTIO_NET_MMIO_STRIDE;
+        if (virtio_mmio_read32(base, VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976u ||
+            virtio_mmio_read32(base, VIRTIO_MMIO_DEVICE_ID) != VIRTIO_ID_NET) {
+            continue;
+        }
+
+        *base_out = base;
+        *irq_out = VIRTIO_NET_DEFAULT_IRQ + (uint32_t)i;
+        *transport = i + 1u;
+        uart_puts("[virtio-net] Detected device at base 0x");
+        uart_write_hex((unsigned long)base);
+        uart_puts(", IRQ ");
+        uart_write_dec(*irq_out);
+        uart_putc('\n');
+        return 0;
     }
-    if (features_hi & (1u << (VIRTIO_F_VERSION_1 - 32u))) {
-        driver_features_hi |= (1u << (VIRTIO_F_VERSION_1 - 32u));
+
+    *transport = VIRTIO_NET_MMIO_TRANSPORTS;
+    return -1;
+}
+
+/* Next virtio-net function on the PCI bus at or after *devfn, if a host bridge was configured */
+static int virtio_net_pci_scan(struct pci_device *pdev, size_t *devfn)
+{
+    if (g_pci_ecam == 0u) {
+        return -1;
     }
 
-    virtio_reg_write(dev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 0u);
-    virtio_reg_write(dev, VIRTIO_MMIO_DRIVER_FEATURES, driver_features_lo);
-    virtio_reg_write(dev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 1u);
-    virtio_reg_write(dev, VIRTIO_MMIO_DRIVER_FEATURES, driver_features_hi);
+    while (pci_scan(g_pci_ecam, devfn, pdev) == 0) {
+        if (pdev->vendor_id != VIRTIO_PCI_VENDOR_ID) {
+            continue;
+        }
+        if (pdev->device_id == VIRTIO_PCI_DEVICE_NET ||
+            (pdev->device_id == VIRTIO_PCI_DEVICE_NET_LEGACY && pdev->subsystem_id == VIRTIO_ID_NET)) {
+            uart_puts("[virtio-net] Detected virtio-pci device at 00:");
+            log_hex8((uint8_t)(pdev->bdf >> 3));
+            uart_putc('.');
+            uart_putc((char)('0' + (pdev->bdf & 7u)));
+            uart_putc('\n');
+            return 0;
+        }
+    }
+    return -1;
+}
 
-    status_value |= VIRTIO_STATUS_FEATURES_OK;
-    virtio_reg_write(dev, VIRTIO_MMIO_STATUS, status_value);
+void virtio_net_set_pci_ecam(uintptr_t ecam)
+{
+    g_pci_ecam = ecam;
+}
 
-    status = virtio_reg_read(dev, VIRTIO_MMIO_STATUS);
-    if ((status & VIRTIO_STATUS_FEATURES_OK) == 0u) {
-        uart_puts("[virtio-net] Warning: FEATURES_OK not acknowledged\n");
+/* Header buffer of the descriptor pair headed by desc_id (split mode) */
+static inline uint8_t *virtio_net_rx_split_buffer(const struct virtio_net_rxq *rxq, uint16_t desc_id)
+{
+    return rxq->split + (size_t)(desc_id / 2u) * VIRTIO_NET_RX_SMALL_SIZE;
+}
+
+/* Where the device writes the start of a buffer, virtio header included */
+static inline uint8_t *virtio_net_rx_head(const struct virtio_net_rxq *rxq, uint16_t desc_id)
+{
+    return (rxq->split != NULL) ? virtio_net_rx_split_buffer(rxq, desc_id) : rxq->buffers[desc_id];
+}
+
+/*
+ * Stage the RX buffer behind desc_id. In split mode it is a two-descriptor
+ * chain: the header buffer, then the rest of the payload buffer, so a frame
+ * read back joined lies at the same offsets as an unsplit one.
+ */
+static void virtio_net_rx_post(struct virtio_net_rxq *rxq, uint16_t desc_id)
+{
+    struct virtio_queue *queue = &rxq->vq;
+
+    if (rxq->split != NULL) {
+        virtio_queue_stage(queue, rxq->size, desc_id, (uint64_t)(uintptr_t)virtio_net_rx_split_buffer(rxq, desc_id),
+                           VIRTIO_NET_RX_SMALL_SIZE, VRING_DESC_F_WRITE | VRING_DESC_F_NEXT);
+        virtio_queue_stage(queue, rxq->size, (uint16_t)(desc_id + 1u),
+                           (uint64_t)(uintptr_t)(rxq->buffers[desc_id] + VIRTIO_NET_RX_SMALL_SIZE),
+                           VIRTIO_NET_RX_BUFFER_SIZE - VIRTIO_NET_RX_SMALL_SIZE, VRING_DESC_F_WRITE);
+        return;
     }
-    log_status("[virtio-net] FEATURES_OK", status);
+    virtio_queue_stage(queue, rxq->size, desc_id, (uint64_t)(uintptr_t)rxq->buffers[desc_id],
+                       VIRTIO_NET_RX_BUFFER_SIZE, VRING_DESC_F_WRITE);
+}
 
-    struct virtio_net_config *config = (struct virtio_net_config *)(dev->base + VIRTIO_MMIO_CONFIG);
-    for (size_t i = 0u; i < sizeof(dev->mac); ++i) {
-        dev->mac[i] = config->mac[i];
+static void virtio_net_prepare_rx(struct virtio_net_rxq *rxq)
+{
+    struct virtio_queue *queue = &rxq->vq;
+    uint16_t step = (rxq->split != NULL) ? 2u : 1u;
+
+    if (rxq->split != NULL) {
+        size_t split_bytes = (size_t)(rxq->size / 2u) * VIRTIO_NET_RX_SMALL_SIZE;
+        util_memset(rxq->split, 0, split_bytes);
+        dma_sync_for_device(queue->dma, rxq->split, split_bytes);
+    }
+    for (uint16_t i = 0u; i < rxq->size; i = (uint16_t)(i + step)) {
+        util_memset(rxq->buffers[i], 0, VIRTIO_NET_RX_BUFFER_SIZE);
+        dma_sync_for_device(queue->dma, rxq->buffers[i], VIRTIO_NET_RX_BUFFER_SIZE);
+        virtio_net_rx_post(rxq, i);
     }
+    virtio_queue_publish(queue, rxq->size);
+    rxq->last_full = 0u;
+    queue->kick_idx = virtio_queue_avail_pos(queue);   /* init kicks the full ring unconditionally */
+    spsc_ring_init(&rxq->ring, rxq->size);
+    spsc_ring_init(&rxq->recycle, rxq->size);
+}
 
-    uart_puts("[virtio-net] MAC ");
-    for (size_t i = 0u; i < sizeof(dev->mac); ++i) {
-        log_hex8(dev->mac[i]);
-        if (i + 1u < sizeof(dev->mac)) {
-            uart_putc(':');
+static void virtio_net_tx_pool_init(struct virtio_net_tx_pool *pool, uint8_t *storage,
+                                    size_t buffer_size, uint8_t count)
+{
+    for (uint8_t i = 0u; i < count; ++i) {
+        pool->buffers[i] = storage + (size_t)i * buffer_size;
+    }
+    pool->count = count;
+    pool->next = 0u;
+    pool->inflight = 0u;
+    /* A pool the device cannot use is not carved and takes no frames */
+    pool->capacity = (count != 0u) ? buffer_size - sizeof(struct virtio_net_hdr) : 0u;
+}
+
+/* Return buffers whose frames the device has consumed (used count reached their posting) */
+static void virtio_net_tx_pool_reclaim(struct virtio_net_tx_pool *pool, uint16_t used_count, uint16_t queue_size)
+{
+    while (pool->inflight > 0u) {
+        uint8_t oldest = (uint8_t)((pool->next + pool->count - pool->inflight) % pool->count);
+        if ((uint16_t)(used_count - pool->posted[oldest]) > queue_size) {
+            break;
         }
+        pool->inflight--;
     }
-    uart_putc('\n');
+}
 
-    if (virtio_net_configure_queue(dev, VIRTIO_NET_RX_QUEUE, dev->rx_queue, &dev->rx_queue_size) != 0) {
-        return -1;
+static void virtio_net_tx_pool_post(struct virtio_net_tx_pool *pool, uint16_t posted)
+{
+    pool->posted[pool->next] = posted;
+    pool->next = (uint8_t)((pool->next + 1u) % pool->count);
+    pool->inflight++;
+}
+
+static void virtio_net_prepare_tx(const struct virtio_net_device *dev, struct virtio_net_txq *txq)
+{
+    struct virtio_queue *queue = &txq->vq;
+    for (uint16_t i = 0u; i < txq->size; ++i) {
+        util_memset(txq->buffers[i], 0, VIRTIO_NET_BUFFER_SIZE);
     }
-    virtio_net_prepare_rx(dev, dev_idx);
-    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_NOTIFY, VIRTIO_NET_RX_QUEUE);
+    txq->backlog_head = 0u;
+    txq->backlog_count = 0u;
+    txq->irq_armed = 0u;
+    txq->batch_count = 0u;
+    txq->flush_due = 0u;
+    txq->loans_out = 0u;
+    util_memset(txq->loans, 0, sizeof(uint8_t *) * txq->size);
+    txq->batch_max = (uint16_t)((VIRTIO_NET_TX_BATCH_MAX < txq->size / 2u) ? VIRTIO_NET_TX_BATCH_MAX
+                                                                           : txq->size / 2u);
+    txq->batch_limit = 1u;
+    txq->post_gap = 4u * dev->tx_deadline;
+
+    /*
+     * TX completions are reaped synchronously by the sender, so the TX
+     * interrupt stays masked; it is armed only while frames wait in the
+     * backlog or a sender is blocked for room.
+     */
+    virtio_queue_disable_irq(queue, txq->size, dev->event_idx);
+}
 
-    if (virtio_net_configure_queue(dev, VIRTIO_NET_TX_QUEUE, dev->tx_queue, &dev->tx_queue_size) != 0) {
-        return -1;
+static void virtio_net_rx_signal(struct virtio_net_rxq *rxq)
+{
+    if (rxq->sem != NULL) {
+        OSSemPost(rxq->sem);
     }
-    virtio_net_prepare_tx(dev, dev_idx);
+    if (g_rx_global_sem != NULL) {
+        OSSemPost(g_rx_global_sem);
+    }
+}
 
-    status_value |= VIRTIO_STATUS_DRIVER_OK;
-    virtio_reg_write(dev, VIRTIO_MMIO_STATUS, status_value);
+/*
+ * Harvest gives a buffer back before its frame is released; the RX task
+ * stages it again. A descriptor sits in one place at a time (device,
+ * completion entry or here), so the ring, one entry per slot, never fills.
+ */
+static inline void virtio_net_rx_recycle(struct virtio_net_rxq *rxq, uint16_t desc_id)
+{
+    rxq->recycled[spsc_ring_slot(&rxq->recycle, spsc_ring_tail(&rxq->recycle))] = desc_id;
+    spsc_ring_push(&rxq->recycle, 1u);
+}
 
-    status = virtio_reg_read(dev, VIRTIO_MMIO_STATUS);
-    log_status("[virtio-net] DRIVER_OK", status);
+/*
+ * Stage the buffers harvest gave back again. RX task only, like every other
+ * write to the RX avail ring; the caller publishes. Returns how many.
+ */
+static uint32_t virtio_net_rx_refill(struct virtio_net_rxq *rxq)
+{
+    uint32_t count = spsc_ring_count(&rxq->recycle);
+    uint32_t pos = spsc_ring_head(&rxq->recycle);
 
-    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_SEL, VIRTIO_NET_RX_QUEUE);
-    uint32_t rx_queue_max = virtio_reg_read(dev, VIRTIO_MMIO_QUEUE_NUM_MAX);
-    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_SEL, VIRTIO_NET_TX_QUEUE);
-    uint32_t tx_queue_max = virtio_reg_read(dev, VIRTIO_MMIO_QUEUE_NUM_MAX);
-    uart_puts("[virtio-net] Queue sizes: RX=");
-    uart_write_dec(rx_queue_max);
-    uart_puts(" TX=");
-    uart_write_dec(tx_queue_max);
-    uart_putc('\n');
+    for (uint32_t i = 0u; i < count; ++i) {
+        virtio_net_rx_post(rxq, rxq->recycled[spsc_ring_slot(&rxq->recycle, pos + i)]);
+    }
+    spsc_ring_pop(&rxq->recycle, count);
+    return count;
+}
 
-    dev->driver_ok = 1u;
+/* Refill and hand the buffers straight to the device: the next release may be a while off */
+static void virtio_net_rx_replenish(struct virtio_net_device *dev, struct virtio_net_rxq *rxq)
+{
+    if (virtio_net_rx_refill(rxq) != 0u) {
+        virtio_queue_publish(&rxq->vq, rxq->size);
+        virtio_net_kick(dev, &rxq->vq, rxq->size, rxq->index);
+    }
+}
 
-    /* Register and enable VirtIO network interrupt */
-    uart_puts("[virtio-net] Registering interrupt handler for IRQ ");
-    uart_write_dec(irq);
-    uart_putc('\n');
+/*
+ * Copy-break at harvest: a frame of at most 'copybreak' bytes moves into the
+ * small slot of its completion entry and its buffer goes on the recycle ring,
+ * so short frames (ACKs, ARP) never hold a full RX buffer while queued. The
+ * buffer after a full one may continue a merged frame and is left alone.
+ */
+static uint8_t virtio_net_rx_copybreak(struct virtio_net_device *dev, struct virtio_net_rxq *rxq,
+                                       uint16_t desc_id, uint32_t total_len, uint8_t *slot)
+{
+    uint8_t continued = rxq->last_full;
 
-    BSP_IntVectSet(irq, 0u, 0u, virtio_net_interrupt_handler);
-    BSP_IntSrcEn(irq);
+    rxq->last_full = (uint8_t)(dev->mrg_rxbuf != 0u && total_len >= VIRTIO_NET_RX_BUFFER_SIZE);
+    /* An early repost would break the ring order VIRTIO_F_IN_ORDER binds the driver to */
+    if (continued != 0u || dev->in_order != 0u || total_len > sizeof(struct virtio_net_hdr) + rxq->copybreak || rxq->copybreak == 0u) {
+        return 0u;
+    }
 
-    /* Enable interrupts on the device */
-    uart_puts("[virtio-net] Interrupts enabled on device ");
-    uart_write_dec(dev_idx);
-    uart_putc('\n');
+    uint8_t *head = virtio_net_rx_head(rxq, desc_id);
+    dma_sync_for_cpu(rxq->vq.dma, head, total_len);
+    util_memcpy(slot, head, total_len);
+    virtio_net_rx_recycle(rxq, desc_id);
+    rxq->copybreaks++;
+    return 1u;
+}
 
-    return 0;
+/*
+ * Move up to 'limit' used RX buffers into the completion ring (the caller has
+ * synced the used ring) and return how many were queued; they are published
+ * to the RX task together. In interrupt mode a full completion ring drops the
+ * frame and recycles its buffer; a polled queue stops instead and leaves the
+ * rest in the used ring.
+ */
+static uint16_t virtio_net_rx_harvest(struct virtio_net_device *dev, struct virtio_net_rxq *rxq, uint16_t limit)
+{
+    struct virtio_queue *queue = &rxq->vq;
+    uint16_t queue_size = rxq->size;
+    uint32_t space = spsc_ring_space(&rxq->ring);
+    uint32_t tail = spsc_ring_tail(&rxq->ring);
+    uint16_t enqueued = 0u;
+    uint16_t desc_id;
+    uint32_t total_len;
+
+    while (enqueued < limit) {
+        if (rxq->polling != 0u && enqueued >= space) {
+            break;
+        }
+        if (!virtio_queue_get_used(queue, queue_size, &desc_id, &total_len)) {
+            break;
+        }
+        rxq->completed++;
+
+        if (desc_id >= queue_size) {
+            uart_puts("[virtio-net] RX descriptor index out of range\n");
+            continue;
+        }
+
+        if (enqueued >= space) {
+            uart_puts("[virtio-net] RX completion queue full\n");
+            rxq->last_full = 0u;
+            virtio_net_rx_recycle(rxq, desc_id);
+            continue;
+        }
+
+        uint32_t pos = spsc_ring_slot(&rxq->ring, tail + enqueued);
+        struct rx_completion_entry *entry = &rxq->completions[pos];
+        entry->copied = virtio_net_rx_copybreak(dev, rxq, desc_id, total_len,
+                                                rxq->small + (size_t)pos * VIRTIO_NET_RX_SMALL_SIZE);
+        entry->desc_id = desc_id;
+        entry->total_len = total_len;
+        enqueued++;
+    }
+
+    spsc_ring_push(&rxq->ring, enqueued);
+    return enqueued;
 }
 
-int virtio_net_init_all(void)
+static void virtio_net_handle_rx_used(struct virtio_net_device *dev, struct virtio_net_rxq *rxq)
 {
-    uart_puts("[virtio-net] Scanning for devices...\n");
+    struct virtio_queue *queue = &rxq->vq;
+    uint16_t queue_size = rxq->size;
+    uint16_t enqueued = 0u;
+
+    if (dev->napi != 0u) {
+        /* NAPI: mask the queue and hand the ring to its task; it re-enables when drained */
+        if (rxq->polling == 0u && virtio_queue_has_used(queue, queue_size)) {
+            virtio_queue_disable_irq(queue, queue_size, dev->event_idx);
+            rxq->polling = 1u;
+            rxq->budget_left = dev->napi_budget;
+            rxq->polls++;
+            virtio_net_rx_signal(rxq);
+        }
+        return;
+    }
 
-    if (g_rx_global_sem == NULL) {
-        g_rx_global_sem = OSSemCreate(0u);
-        if (g_rx_global_sem == NULL) {
-            uart_puts("[virtio-net] Warning: failed to create global RX semaphore\n");
+    virtio_queue_sync_used(queue, queue_size);
+    do {
+        enqueued = (uint16_t)(enqueued + virtio_net_rx_harvest(dev, rxq, UINT16_MAX));
+
+        if (dev->event_idx == 0u) {
+            break;
         }
+
+        /*
+         * Ask for the next interrupt only once the device moves past what we
+         * have consumed, then re-check: a completion written before the new
+         * used_event became visible would otherwise never interrupt.
+         */
+        virtio_queue_arm_event(queue, queue_size);
+    } while (virtio_queue_has_used(queue, queue_size));
+
+    if (enqueued != 0u) {
+        virtio_net_rx_signal(rxq);
     }
+}
 
-    g_device_count = 0u;
+/*
+ * NAPI poll step, run by the consuming task before it reads the completion
+ * ring. Harvests what the budget allows; once the used ring is empty the
+ * interrupt is re-enabled and the ring checked once more, so a completion
+ * landing in between is polled rather than lost. A poll that runs out of
+ * budget with work left re-posts the semaphore; when the task has consumed
+ * what it harvested, the call returns 1 once so the task passes through its
+ * refill/flush/wait step before a fresh budget starts.
+ */
+static int virtio_net_rx_service(struct virtio_net_device *dev, struct virtio_net_rxq *rxq)
+{
+    if (rxq->polling == 0u) {
+        return 0;
+    }
 
-    for (size_t i = 0u; i < VIRTIO_NET_MAX_DEVICES; ++i) {
-        uintptr_t base = 0u;
-        uint32_t irq = 0u;
+    struct virtio_queue *queue = &rxq->vq;
+    uint16_t queue_size = rxq->size;
+    uint8_t wake = 0u;
+    int yield = 0;
+    OS_CPU_SR cpu_sr;
 
-        if (virtio_net_scan(&base, &irq, i) == 0) {
-            if (virtio_net_init_device(i, base, irq) == 0) {
-                g_device_count++;
-                uart_puts("[virtio-net] Device ");
-                uart_write_dec(i);
-                uart_puts(" initialized successfully\n");
+    OS_ENTER_CRITICAL();
+    if (rxq->polling != 0u && rxq->budget_left == 0u) {
+        if (spsc_ring_count(&rxq->ring) == 0u) {
+            rxq->budget_left = dev->napi_budget;
+            yield = 1;
+        }
+    } else if (rxq->polling != 0u) {
+        virtio_queue_sync_used(queue, queue_size);
+        rxq->budget_left = (uint16_t)(rxq->budget_left - virtio_net_rx_harvest(dev, rxq, rxq->budget_left));
+
+        if (!virtio_queue_has_used(queue, queue_size)) {
+            virtio_queue_enable_irq(queue, queue_size, dev->event_idx);
+            if (virtio_queue_has_used(queue, queue_size)) {
+                /* Lost the race: stay in polling and make sure the task comes back */
+                virtio_queue_disable_irq(queue, queue_size, dev->event_idx);
+                wake = 1u;
             } else {
-                uart_puts("[virtio-net] Failed to initialize device ");
-                uart_write_dec(i);
-                uart_putc('\n');
-                break;
+                rxq->polling = 0u;
             }
-        } else {
-            break;
+        } else if (rxq->budget_left == 0u) {
+            rxq->budget_exhausted++;
+            wake = 1u;
         }
     }
+    OS_EXIT_CRITICAL();
 
-    if (g_device_count > 0u) {
-        /* Set legacy pointer to device 0 for backward compatibility */
-        g_dev = &g_devices[0];
-        uart_puts("[virtio-net] Total devices initialized: ");
-        uart_write_dec(g_device_count);
-        uart_putc('\n');
-        return 0;
+    if (wake != 0u) {
+        virtio_net_rx_signal(rxq);
+    }
+    return yield;
+}
+
+/* The control queue is polled by the issuing task, so it never needs an interrupt */
+static void virtio_net_prepare_ctrl(struct virtio_net_device *dev)
+{
+    struct virtio_queue *queue = &dev->ctrl;
+
+    if (queue->packed != 0u) {
+        queue->driver_event->flags = VRING_PACKED_EVENT_F_DISABLE;
+        dma_sync_for_device(queue->dma, queue->driver_event, sizeof(*queue->driver_event));
     } else {
-        uart_puts("[virtio-net] No devices found\n");
-        return -1;
+        queue->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+        dma_sync_for_device(queue->dma, &queue->avail->flags, sizeof(queue->avail->flags));
     }
 }
 
-int virtio_net_init(uintptr_t base_addr, uint32_t irq)
+/* Ring depth for a queue: the request capped by the device, as a power of two; 0 if absent */
+static uint16_t virtio_net_queue_depth(struct virtio_net_device *dev, uint32_t queue_index, uint16_t want)
 {
-    uintptr_t detected_base = base_addr;
-    uint32_t detected_irq = irq;
+    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_SEL, queue_index);
+    uint32_t queue_max = virtio_reg_read(dev, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    if (queue_max == 0u) {
+        uart_puts("[virtio-net] Queue not available\n");
+        return 0u;
+    }
 
-    if (g_rx_global_sem == NULL) {
-        g_rx_global_sem = OSSemCreate(0u);
-        if (g_rx_global_sem == NULL) {
-            uart_puts("[virtio-net] Warning: failed to create global RX semaphore\n");
+    uint32_t depth = (queue_max < want) ? queue_max : want;
+    if (depth > VIRTIO_NET_QUEUE_SIZE_MAX) {
+        depth = VIRTIO_NET_QUEUE_SIZE_MAX;
+    }
+
+    /* The free-running 16-bit ring counters wrap cleanly only over a power of two */
+    uint16_t size = 1u;
+    while ((uint32_t)size * 2u <= depth) {
+        size = (uint16_t)(size * 2u);
+    }
+    return size;
+}
+
+static void virtio_net_configure_queue(struct virtio_net_device *dev,
+                                       uint32_t queue_index,
+                                       struct virtio_queue *queue,
+                                       uint16_t queue_size)
+{
+    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_SEL, queue_index);
+    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_NUM, queue_size);
+
+    /* The packed ring lives in the descriptor array; the event areas in avail/used */
+    queue->packed = dev->packed;
+    queue->in_order = (uint8_t)(dev->in_order != 0u && dev->packed == 0u);
+    queue->ring = (struct vring_packed_desc *)queue->desc;
+    queue->driver_event = (struct vring_packed_event *)queue->avail;
+    queue->device_event = (struct vring_packed_event *)queue->used;
+    queue->next_avail = 0u;
+    queue->avail_wrap = 1u;
+    queue->next_used = 0u;
+    queue->used_wrap = 1u;
+    queue->used_line = 0u;
+    queue->posted = 0u;
+    queue->used_count = 0u;
+    queue->used_heads = 0u;
+    queue->used_idx = 0u;
+    queue->staged = 0u;
+    queue->staged_heads = 0u;
+    queue->dirty_count = 0u;
+    queue->chain_head = 0u;
+    queue->chain_open = 0u;
+    queue->kick_idx = 0u;
+    queue->kicks = 0u;
+    queue->kicks_suppressed = 0u;
+    queue->ring_lines = 0u;
+    queue->used_reads = 0u;
+    queue->dma = dev->dma_coherency;
+    queue->notify = 0u;
+    util_memset(queue->chain, 0, queue_size);
+
+    if (dev->pci != 0u) {
+        /* Data queues raise their own MSI-X vector; the control queue is polled */
+        uint16_t vector = (queue_index < 2u * dev->max_queue_pairs) ? (uint16_t)queue_index : VIRTIO_PCI_NO_VECTOR;
+        mmio_write16(dev->base + VIRTIO_PCI_QUEUE_MSIX_VECTOR, vector);
+        if (mmio_read16(dev->base + VIRTIO_PCI_QUEUE_MSIX_VECTOR) != vector) {
+            uart_puts("[virtio-net] Device refused the queue's MSI-X vector\n");
         }
+        queue->notify = dev->pci_notify +
+                        (uintptr_t)mmio_read16(dev->base + VIRTIO_PCI_QUEUE_NOTIFY_OFF) * dev->pci_notify_mult;
     }
 
-    if (virtio_net_scan(&detected_base, &detected_irq, 0u) == 0) {
-        base_addr = detected_base;
-        irq = detected_irq;
-    } else {
-        if (base_addr == 0u) {
-            base_addr = VIRTIO_NET_MMIO_BASE_DEFAULT;
+    util_memset(queue->desc, 0, sizeof(struct vring_desc) * queue_size);
+    util_memset(queue->avail, 0, vring_avail_size(queue_size));
+    util_memset(queue->used, 0, vring_used_size(queue_size));
+
+    dma_sync_for_device(queue->dma, queue->desc, sizeof(struct vring_desc) * queue_size);
+    dma_sync_for_device(queue->dma, queue->avail, vring_avail_size(queue_size));
+    dma_sync_for_device(queue->dma, queue->used, vring_used_size(queue_size));
+
+    uintptr_t desc_addr = (uintptr_t)queue->desc;
+    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_DESC_LOW, (uint32_t)desc_addr);
+    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_DESC_HIGH, (uint32_t)(desc_addr >> 32));
+
+    uintptr_t avail_addr = (uintptr_t)queue->avail;
+    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_AVAIL_LOW, (uint32_t)avail_addr);
+    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_AVAIL_HIGH, (uint32_t)(avail_addr >> 32));
+
+    uintptr_t used_addr = (uintptr_t)queue->used;
+    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_USED_LOW, (uint32_t)used_addr);
+    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_USED_HIGH, (uint32_t)(used_addr >> 32));
+
+    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_READY, 1u);
+}
+
+struct virtio_net_carve {
+    uint8_t *base;          /* NULL while only measuring */
+    size_t used;
+};
+
+static void *virtio_net_carve(struct virtio_net_carve *carve, size_t size, size_t align)
+{
+    size_t offset = (carve->used + align - 1u) & ~(align - 1u);
+    carve->used = offset + size;
+    return (carve->base != NULL) ? carve->base + offset : NULL;
+}
+
+static void virtio_net_carve_ring(struct virtio_net_carve *carve, struct virtio_queue *queue, uint16_t queue_size)
+{
+    queue->desc = virtio_net_carve(carve, sizeof(struct vring_desc) * queue_size, VIRTIO_NET_CACHE_LINE);
+    queue->avail = virtio_net_carve(carve, vring_avail_size(queue_size), VIRTIO_NET_CACHE_LINE);
+    queue->used = virtio_net_carve(carve, vring_used_size(queue_size), VIRTIO_NET_CACHE_LINE);
+    queue->chain = virtio_net_carve(carve, queue_size, sizeof(uint8_t));
+}
+
+/*
+ * Place every ring and buffer of the device, queue sizes already chosen. Run
+ * once with a NULL base to measure, then over the arena block to assign.
+ */
+static void virtio_net_layout(struct virtio_net_device *dev, struct virtio_net_carve *carve)
+{
+    for (uint16_t pair = 0u; pair < dev->max_queue_pairs; ++pair) {
+        struct virtio_net_rxq *rxq = &dev->rxq[pair];
+        struct virtio_net_txq *txq = &dev->txq[pair];
+
+        virtio_net_carve_ring(carve, &rxq->vq, rxq->size);
+        rxq->completions = virtio_net_carve(carve, sizeof(struct rx_completion_entry) * rxq->size,
+                                            VIRTIO_NET_CACHE_LINE);
+        rxq->recycled = virtio_net_carve(carve, sizeof(uint16_t) * rxq->size, sizeof(uint16_t));
+        rxq->buffers = virtio_net_carve(carve, sizeof(uint8_t *) * rxq->size, sizeof(uint8_t *));
+        rxq->small = virtio_net_carve(carve, (size_t)VIRTIO_NET_RX_SMALL_SIZE * rxq->size, VIRTIO_NET_CACHE_LINE);
+        /* Header split pairs the descriptors: half as many payload buffers, each behind a header buffer */
+        uint16_t rx_step = (dev->rx_split != 0u) ? 2u : 1u;
+        uint8_t *rx_split = (dev->rx_split != 0u) ?
+                            virtio_net_carve(carve, (size_t)VIRTIO_NET_RX_SMALL_SIZE * (rxq->size / 2u),
+                                             VIRTIO_NET_CACHE_LINE) : NULL;
+        uint8_t *rx_storage = virtio_net_carve(carve, (size_t)VIRTIO_NET_RX_BUFFER_SIZE * (rxq->size / rx_step),
+                                               VIRTIO_NET_CACHE_LINE);
+        /*
+         * Only mergeable buffers spread a frame over several RX buffers, and
+         * only as far as GUEST_TSO4 or an MTU beyond one buffer lets them.
+         */
+        size_t merge_size = 0u;
+        if (dev->mrg_rxbuf != 0u) {
+            if ((dev->offloads & VIRTIO_NET_OFFLOAD_RX_TSO4) != 0u) {
+                merge_size = VIRTIO_NET_MAX_GSO_FRAME_SIZE;
+            } else if ((size_t)dev->mtu_max + VIRTIO_NET_FRAME_OVERHEAD >
+                       VIRTIO_NET_RX_BUFFER_SIZE - sizeof(struct virtio_net_hdr)) {
+                merge_size = (size_t)dev->mtu_max + VIRTIO_NET_FRAME_OVERHEAD;
+            }
         }
-        if (irq == 0u) {
-            irq = VIRTIO_NET_DEFAULT_IRQ;
+        rxq->merge_size = merge_size;
+        rxq->merge_buffer = (merge_size != 0u) ?
+                            virtio_net_carve(carve, merge_size, VIRTIO_NET_CACHE_LINE) : NULL;
+
+        virtio_net_carve_ring(carve, &txq->vq, txq->size);
+        txq->buffers = virtio_net_carve(carve, sizeof(uint8_t *) * txq->size, sizeof(uint8_t *));
+        txq->loans = virtio_net_carve(carve, sizeof(uint8_t *) * txq->size, sizeof(uint8_t *));
+        uint8_t *tx_storage = virtio_net_carve(carve, (size_t)VIRTIO_NET_BUFFER_SIZE * txq->size,
+                                               VIRTIO_NET_CACHE_LINE);
+        /* Jumbo buffers only when the MTU can outgrow a slot, TSO buffers only with HOST_TSO4 */
+        uint8_t jumbo_count = ((size_t)dev->mtu_max + VIRTIO_NET_FRAME_OVERHEAD >
+                               VIRTIO_NET_BUFFER_SIZE - sizeof(struct virtio_net_hdr)) ?
+                              VIRTIO_NET_TX_JUMBO_BUFFERS : 0u;
+        uint8_t gso_count = ((dev->offloads & VIRTIO_NET_OFFLOAD_TX_TSO4) != 0u) ? VIRTIO_NET_TX_GSO_BUFFERS : 0u;
+        uint8_t *jumbo = (jumbo_count != 0u) ?
+                         virtio_net_carve(carve, (size_t)VIRTIO_NET_JUMBO_BUFFER_SIZE * jumbo_count,
+                                          VIRTIO_NET_CACHE_LINE) : NULL;
+        uint8_t *gso = (gso_count != 0u) ?
+                       virtio_net_carve(carve, (size_t)VIRTIO_NET_GSO_BUFFER_SIZE * gso_count,
+                                        VIRTIO_NET_CACHE_LINE) : NULL;
+        txq->backlog = virtio_net_carve(carve, sizeof(struct virtio_net_tx_backlog_entry) * VIRTIO_NET_TX_BACKLOG_DEPTH,
+                                        sizeof(uint64_t));
+
+        if (carve->base != NULL) {
+            rxq->split = rx_split;
+            for (uint16_t i = 0u; i < rxq->size; ++i) {
+                rxq->buffers[i] = ((i % rx_step) == 0u) ?
+                                  rx_storage + (size_t)(i / rx_step) * VIRTIO_NET_RX_BUFFER_SIZE : NULL;
+            }
+            for (uint16_t i = 0u; i < txq->size; ++i) {
+                txq->buffers[i] = tx_storage + (size_t)i * VIRTIO_NET_BUFFER_SIZE;
+            }
+            virtio_net_tx_pool_init(&txq->jumbo, jumbo, VIRTIO_NET_JUMBO_BUFFER_SIZE, jumbo_count);
+            virtio_net_tx_pool_init(&txq->gso, gso, VIRTIO_NET_GSO_BUFFER_SIZE, gso_count);
         }
-        uart_puts("[virtio-net] Using default base/IRQ\n");
     }
 
-    if (virtio_net_init_device(0u, base_addr, irq) != 0) {
-        return -1;
+    if (dev->ctrl_size != 0u) {
+        virtio_net_carve_ring(carve, &dev->ctrl, dev->ctrl_size);
+        dev->ctrl_buffer = virtio_net_carve(carve, VIRTIO_NET_CTRL_BUFFER_SIZE, VIRTIO_NET_CACHE_LINE);
+    }
+}
+
+/* Back the layout with arena memory, reusing the device's block from an earlier init when it fits */
+static int virtio_net_alloc_dma(struct virtio_net_device *dev)
+{
+    struct virtio_net_carve carve = { NULL, 0u };
+    struct virtio_net_dma_block *block = &g_dma_blocks[dev->index];
+
+    virtio_net_layout(dev, &carve);
+    if (carve.used > block->size) {
+        if (block->base != NULL) {
+            uart_puts("[virtio-net] Rings grew since the last init; their old memory is lost\n");
+        }
+        block->base = dma_alloc(carve.used, 4096u);
+        block->size = (block->base != NULL) ? carve.used : 0u;
+        if (block->base == NULL) {
+            uart_puts("[virtio-net] DMA arena exhausted\n");
+            return -1;
+        }
+    }
+
+    carve.base = block->base;
+    carve.used = 0u;
+    virtio_net_layout(dev, &carve);
+    dev->dma_bytes = carve.used;
+    return 0;
+}
+
+/*
+ * virtio-pci: find the common, notify, ISR and device configuration structures
+ * the vendor capabilities point at, then give each data virtqueue an MSI-X
+ * vector that the ITS turns into an LPI of its own.
+ */
+static int virtio_net_pci_probe(struct virtio_net_device *dev, struct pci_device *pdev)
+{
+    uintptr_t common = 0u;
+    uintptr_t notify = 0u;
+    uintptr_t isr = 0u;
+    uintptr_t config = 0u;
+    uint32_t notify_mult = 0u;
+
+    if (pci_enable(pdev) != 0) {
+        return -1;
+    }
+    for (uint8_t cap = pci_find_cap(pdev, PCI_CAP_ID_VNDR, 0u); cap != 0u;
+         cap = pci_find_cap(pdev, PCI_CAP_ID_VNDR, cap)) {
+        uint8_t bar = pci_cfg_read8(pdev, cap + VIRTIO_PCI_CAP_BAR);
+        if (bar >= 6u || pdev->bar[bar] == 0u) {
+            continue;
+        }
+        uintptr_t addr = pdev->bar[bar] + pci_cfg_read32(pdev, cap + VIRTIO_PCI_CAP_OFFSET);
+
+        /* The first capability of each type is the preferred one */
+        switch (pci_cfg_read8(pdev, cap + VIRTIO_PCI_CAP_TYPE)) {
+        case VIRTIO_PCI_CAP_COMMON_CFG:
+            common = (common != 0u) ? common : addr;
+            break;
+        case VIRTIO_PCI_CAP_NOTIFY_CFG:
+            if (notify == 0u) {
+                notify = addr;
+                notify_mult = pci_cfg_read32(pdev, cap + VIRTIO_PCI_CAP_NOTIFY_MULT);
+            }
+            break;
+        case VIRTIO_PCI_CAP_ISR_CFG:
+            isr = (isr != 0u) ? isr : addr;
+            break;
+        case VIRTIO_PCI_CAP_DEVICE_CFG:
+            config = (config != 0u) ? config : addr;
+            break;
+        default:
+            break;
+        }
+    }
+    if (common == 0u || notify == 0u || isr == 0u || config == 0u) {
+        uart_puts("[virtio-net] Missing virtio-pci capabilities (legacy-only device?)\n");
+        return -1;
+    }
+
+    /* One vector per data virtqueue, in whole pairs */
+    uint16_t vectors = pci_msix_enable(pdev);
+    if (vectors > 2u * VIRTIO_NET_MAX_QUEUE_PAIRS) {
+        vectors = 2u * VIRTIO_NET_MAX_QUEUE_PAIRS;
+    }
+    vectors = (uint16_t)(vectors & ~1u);
+    if (vectors == 0u) {
+        uart_puts("[virtio-net] Device has no MSI-X vectors for its queues\n");
+        return -1;
+    }
+    uint32_t lpi = gic_its_map_device(pdev->bdf, vectors);
+    if (lpi == 0u) {
+        uart_puts("[virtio-net] No LPIs for the device\n");
+        return -1;
+    }
+    for (uint16_t v = 0u; v < vectors; ++v) {
+        pci_msix_set(pdev, v, (uint64_t)gic_its_doorbell(), v);
+    }
+
+    dev->pci = 1u;
+    dev->base = common;
+    dev->irq = lpi;
+    dev->pci_notify = notify;
+    dev->pci_notify_mult = notify_mult;
+    dev->pci_isr = isr;
+    dev->config = config;
+    dev->msix_vectors = vectors;
+    dev->msix_lpi = lpi;
+    return 0;
+}
+
+static int virtio_net_init_device(size_t dev_idx, uintptr_t base_addr, uint32_t irq, struct pci_device *pdev)
+{
+    struct virtio_net_device *dev = &g_devices[dev_idx];
+
+    util_memset(dev, 0, sizeof(*dev));
+
+    dev->base = base_addr;
+    dev->irq = irq;
+    dev->config = base_addr + VIRTIO_MMIO_CONFIG;
+    if (pdev != NULL && virtio_net_pci_probe(dev, pdev) != 0) {
+        return -1;
+    }
+    dev->index = (uint8_t)dev_idx;
+    dev->napi_budget = VIRTIO_NET_NAPI_BUDGET;
+    dev->tx_policy = VIRTIO_NET_TX_POLICY_DROP;
+    dev->tx_block_ms = VIRTIO_NET_TX_BLOCK_MS;
+    dev->tx_deadline = virtio_net_us_to_counts(VIRTIO_NET_TX_DEADLINE_US);
+
+    for (uint16_t pair = 0u; pair < VIRTIO_NET_MAX_QUEUE_PAIRS; ++pair) {
+        dev->rxq[pair].index = VIRTIO_NET_RX_QUEUE + 2u * pair;
+        dev->rxq[pair].copybreak = VIRTIO_NET_RX_COPYBREAK;
+        dev->txq[pair].index = VIRTIO_NET_TX_QUEUE + 2u * pair;
+    }
+
+    uart_puts("[virtio-net] Initialising device ");
+    uart_write_dec(dev_idx);
+    uart_putc('\n');
+    uart_puts(dev->pci != 0u ? "[virtio-net] virtio-pci, common config 0x" : "[virtio-net] Base 0x");
+    uart_write_hex((unsigned long)dev->base);
+    uart_puts(dev->pci != 0u ? ", first LPI " : ", IRQ ");
+    uart_write_dec(dev->irq);
+    uart_putc('\n');
+
+    uint32_t magic = virtio_reg_read(dev, VIRTIO_MMIO_MAGIC_VALUE);
+    if (magic != 0x74726976u) {
+        uart_puts("[virtio-net] Invalid magic\n");
+        return -1;
+    }
+
+    uint32_t version = virtio_reg_read(dev, VIRTIO_MMIO_VERSION);
+    uart_puts("[virtio-net] Version ");
+    uart_write_dec(version);
+    uart_putc('\n');
+
+    if (version <= 1u) {
+        uart_puts("[virtio-net] Configuring guest page size for legacy virtio\n");
+        virtio_reg_write(dev, VIRTIO_MMIO_GUEST_PAGE_SIZE, 4096u);
+    }
+
+    uint32_t device_id = virtio_reg_read(dev, VIRTIO_MMIO_DEVICE_ID);
+    uint32_t vendor_id = virtio_reg_read(dev, VIRTIO_MMIO_VENDOR_ID);
+    log_hex32("[virtio-net] Device ID ", device_id);
+    log_hex32("[virtio-net] Vendor ID ", vendor_id);
+
+    if (device_id != VIRTIO_ID_NET && device_id != 0u) {
+        uart_puts("[virtio-net] Device is not virtio-net\n");
+        return -1;
+    }
+
+    /* Reset device status before negotiation */
+    virtio_reg_write(dev, VIRTIO_MMIO_STATUS, 0u);
+
+    uint32_t status_value = VIRTIO_STATUS_ACKNOWLEDGE;
+    virtio_reg_write(dev, VIRTIO_MMIO_STATUS, status_value);
+    uint32_t status = virtio_reg_read(dev, VIRTIO_MMIO_STATUS);
+    log_status("[virtio-net] ACKNOWLEDGE", status);
+
+    status_value |= VIRTIO_STATUS_DRIVER;
+    virtio_reg_write(dev, VIRTIO_MMIO_STATUS, status_value);
+    status = virtio_reg_read(dev, VIRTIO_MMIO_STATUS);
+    log_status("[virtio-net] DRIVER", status);
+
+    uint32_t features_lo;
+    uint32_t features_hi;
+    virtio_reg_write(dev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 0u);
+    features_lo = virtio_reg_read(dev, VIRTIO_MMIO_DEVICE_FEATURES);
+    virtio_reg_write(dev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 1u);
+    features_hi = virtio_reg_read(dev, VIRTIO_MMIO_DEVICE_FEATURES);
+    log_hex32("[virtio-net] Host features[31:0] ", features_lo);
+    log_hex32("[virtio-net] Host features[63:32] ", features_hi);
+
+    uint32_t driver_features_lo = 0u;
+    uint32_t driver_features_hi = 0u;
+    if (features_lo & (1u << VIRTIO_NET_F_MAC)) {
+        driver_features_lo |= (1u << VIRTIO_NET_F_MAC);
+    }
+    if (features_lo & (1u << VIRTIO_NET_F_CSUM)) {
+        driver_features_lo |= (1u << VIRTIO_NET_F_CSUM);
+        dev->offloads |= VIRTIO_NET_OFFLOAD_TX_CSUM;
+    }
+    if (features_lo & (1u << VIRTIO_NET_F_GUEST_CSUM)) {
+        driver_features_lo |= (1u << VIRTIO_NET_F_GUEST_CSUM);
+        dev->offloads |= VIRTIO_NET_OFFLOAD_RX_CSUM;
+    }
+    /* TSO needs the matching checksum offload; guest TSO also needs mergeable buffers to land 64 KB */
+    if ((features_lo & (1u << VIRTIO_NET_F_HOST_TSO4)) != 0u &&
+        (driver_features_lo & (1u << VIRTIO_NET_F_CSUM)) != 0u) {
+        driver_features_lo |= (1u << VIRTIO_NET_F_HOST_TSO4);
+        dev->offloads |= VIRTIO_NET_OFFLOAD_TX_TSO4;
+    }
+    if ((features_lo & (1u << VIRTIO_NET_F_GUEST_TSO4)) != 0u &&
+        (features_lo & (1u << VIRTIO_NET_F_MRG_RXBUF)) != 0u &&
+        (driver_features_lo & (1u << VIRTIO_NET_F_GUEST_CSUM)) != 0u) {
+        driver_features_lo |= (1u << VIRTIO_NET_F_GUEST_TSO4);
+        dev->offloads |= VIRTIO_NET_OFFLOAD_RX_TSO4;
+    }
+    if (features_lo & (1u << VIRTIO_NET_F_MTU)) {
+        driver_features_lo |= (1u << VIRTIO_NET_F_MTU);
+    }
+    if (features_lo & (1u << VIRTIO_NET_F_MRG_RXBUF)) {
+        driver_features_lo |= (1u << VIRTIO_NET_F_MRG_RXBUF);
+        dev->mrg_rxbuf = 1u;
+    }
+    /* Queue pairs are switched on through the control queue, so MQ depends on it */
+    if (features_lo & (1u << VIRTIO_NET_F_CTRL_VQ)) {
+        driver_features_lo |= (1u << VIRTIO_NET_F_CTRL_VQ);
+        if (features_lo & (1u << VIRTIO_NET_F_MQ)) {
+            driver_features_lo |= (1u << VIRTIO_NET_F_MQ);
+            dev->mq = 1u;
+        }
+        /* Host-side RX filtering; the device starts promiscuous until told otherwise */
+        if (features_lo & (1u << VIRTIO_NET_F_CTRL_RX)) {
+            driver_features_lo |= (1u << VIRTIO_NET_F_CTRL_RX);
+            dev->ctrl_rx = VIRTIO_NET_RX_MODE_PROMISC | VIRTIO_NET_RX_MODE_ALLMULTI;
+            dev->rx_mode = VIRTIO_NET_RX_MODE_PROMISC;
+            if (features_lo & (1u << VIRTIO_NET_F_CTRL_RX_EXTRA)) {
+                driver_features_lo |= (1u << VIRTIO_NET_F_CTRL_RX_EXTRA);
+                dev->ctrl_rx |= VIRTIO_NET_RX_MODE_ALLUNI | VIRTIO_NET_RX_MODE_NOMULTI |
+                                VIRTIO_NET_RX_MODE_NOUNI | VIRTIO_NET_RX_MODE_NOBCAST;
+            }
+        }
+        if (features_lo & (1u << VIRTIO_NET_F_CTRL_VLAN)) {
+            driver_features_lo |= (1u << VIRTIO_NET_F_CTRL_VLAN);
+            dev->ctrl_vlan = 1u;
+        }
+    }
+    if (features_lo & (1u << VIRTIO_RING_F_INDIRECT_DESC)) {
+        driver_features_lo |= (1u << VIRTIO_RING_F_INDIRECT_DESC);
+        dev->indirect = 1u;
+    }
+    if (features_lo & (1u << VIRTIO_RING_F_EVENT_IDX)) {
+        driver_features_lo |= (1u << VIRTIO_RING_F_EVENT_IDX);
+        dev->event_idx = 1u;
+    }
+    if (features_hi & (1u << (VIRTIO_F_VERSION_1 - 32u))) {
+        driver_features_hi |= (1u << (VIRTIO_F_VERSION_1 - 32u));
+        /* The packed layout exists only for modern devices */
+        if (features_hi & (1u << (VIRTIO_F_RING_PACKED - 32u))) {
+            driver_features_hi |= (1u << (VIRTIO_F_RING_PACKED - 32u));
+            dev->packed = 1u;
+        } else if (features_hi & (1u << (VIRTIO_F_IN_ORDER - 32u))) {
+            /* The packed ring already completes in one pass over its descriptors */
+            driver_features_hi |= (1u << (VIRTIO_F_IN_ORDER - 32u));
+            dev->in_order = 1u;
+        }
+    }
+
+    /*
+     * A device behind the platform's DMA path (ACCESS_PLATFORM; identity
+     * mapped here, there is no IOMMU) gets no coherency guarantee from
+     * virtio, so the default policy maintains caches for it.
+     */
+    uint8_t dma_policy = g_queue_config[dev_idx].dma;
+    uint8_t access_platform = (uint8_t)((features_hi & (1u << (VIRTIO_F_ACCESS_PLATFORM - 32u))) != 0u);
+    if (access_platform != 0u) {
+        driver_features_hi |= (1u << (VIRTIO_F_ACCESS_PLATFORM - 32u));
+    }
+    if (dma_policy == VIRTIO_NET_DMA_COHERENT) {
+        dev->dma_coherency = DMA_COHERENT;
+    } else if (dma_policy == VIRTIO_NET_DMA_NONCOHERENT || access_platform != 0u) {
+        dev->dma_coherency = DMA_NONCOHERENT;
+    } else {
+        dev->dma_coherency = DMA_PLATFORM_COHERENCY;
+    }
+
+    virtio_reg_write(dev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 0u);
+    virtio_reg_write(dev, VIRTIO_MMIO_DRIVER_FEATURES, driver_features_lo);
+    virtio_reg_write(dev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 1u);
+    virtio_reg_write(dev, VIRTIO_MMIO_DRIVER_FEATURES, driver_features_hi);
+
+    status_value |= VIRTIO_STATUS_FEATURES_OK;
+    virtio_reg_write(dev, VIRTIO_MMIO_STATUS, status_value);
+
+    status = virtio_reg_read(dev, VIRTIO_MMIO_STATUS);
+    if ((status & VIRTIO_STATUS_FEATURES_OK) == 0u) {
+        uart_puts("[virtio-net] Warning: FEATURES_OK not acknowledged\n");
+    }
+    log_status("[virtio-net] FEATURES_OK", status);
+    if (dev->event_idx != 0u) {
+        uart_puts("[virtio-net] EVENT_IDX notification suppression enabled\n");
+    }
+    if (dev->packed != 0u) {
+        uart_puts("[virtio-net] Packed virtqueues enabled\n");
+    }
+    if (dev->indirect != 0u) {
+        uart_puts("[virtio-net] Indirect descriptors enabled\n");
+    }
+    uart_puts(dev->dma_coherency == DMA_COHERENT ? "[virtio-net] DMA coherent, no cache maintenance\n"
+                                                 : "[virtio-net] DMA non-coherent, caches maintained\n");
+    if (dev->offloads != 0u) {
+        uart_puts("[virtio-net] Offloads:");
+        uart_puts((dev->offloads & VIRTIO_NET_OFFLOAD_TX_CSUM) != 0u ? " TX" : "");
+        uart_puts((dev->offloads & VIRTIO_NET_OFFLOAD_RX_CSUM) != 0u ? " RX" : "");
+        uart_puts((dev->offloads & VIRTIO_NET_OFFLOAD_TX_TSO4) != 0u ? " TX-TSO4" : "");
+        uart_puts((dev->offloads & VIRTIO_NET_OFFLOAD_RX_TSO4) != 0u ? " RX-TSO4" : "");
+        uart_putc('\n');
+    }
+
+    struct virtio_net_config *config = (struct virtio_net_config *)dev->config;
+    for (size_t i = 0u; i < sizeof(dev->mac); ++i) {
+        dev->mac[i] = config->mac[i];
+    }
+
+    uart_puts("[virtio-net] MAC ");
+    for (size_t i = 0u; i < sizeof(dev->mac); ++i) {
+        log_hex8(dev->mac[i]);
+        if (i + 1u < sizeof(dev->mac)) {
+            uart_putc(':');
+        }
+    }
+    uart_putc('\n');
+
+    /*
+     * Without mergeable buffers a frame must fit one RX buffer, so jumbo MTUs
+     * are only offered when the device can spread frames over several.
+     */
+    dev->mtu_max = (dev->mrg_rxbuf != 0u) ? VIRTIO_NET_MAX_MTU : VIRTIO_NET_DEFAULT_MTU;
+    if ((driver_features_lo & (1u << VIRTIO_NET_F_MTU)) != 0u) {
+        uint16_t device_mtu = config->mtu;
+        if (device_mtu >= VIRTIO_NET_MIN_MTU && device_mtu < dev->mtu_max) {
+            dev->mtu_max = device_mtu;
+        }
+    }
+    dev->mtu = (dev->mtu_max < VIRTIO_NET_DEFAULT_MTU) ? dev->mtu_max : VIRTIO_NET_DEFAULT_MTU;
+    uart_puts("[virtio-net] MTU ");
+    uart_write_dec(dev->mtu);
+    uart_puts(" (max ");
+    uart_write_dec(dev->mtu_max);
+    uart_puts(dev->mrg_rxbuf != 0u ? ", mergeable RX buffers)\n" : ")\n");
+
+    /*
+     * Every pair we may steer to is set up now; the device uses only the first
+     * until virtio_net_set_queue_pairs_dev() asks for more. The control queue
+     * sits after the last pair the device offers, not the last one we use.
+     */
+    uint16_t device_pairs = 1u;
+    if (dev->mq != 0u) {
+        device_pairs = config->max_virtqueue_pairs;
+        if (device_pairs == 0u) {
+            device_pairs = 1u;
+        }
+    }
+    dev->max_queue_pairs = (device_pairs < VIRTIO_NET_MAX_QUEUE_PAIRS) ? device_pairs : VIRTIO_NET_MAX_QUEUE_PAIRS;
+    if (dev->pci != 0u && dev->max_queue_pairs > dev->msix_vectors / 2u) {
+        /* A pair without vectors of its own could not interrupt */
+        dev->max_queue_pairs = dev->msix_vectors / 2u;
+    }
+    dev->queue_pairs = 1u;
+    if (dev->mq != 0u) {
+        uart_puts("[virtio-net] Queue pairs: device offers ");
+        uart_write_dec(device_pairs);
+        uart_puts(", using up to ");
+        uart_write_dec(dev->max_queue_pairs);
+        uart_putc('\n');
+    }
+
+    /* Ring depths first, so the whole device can be laid out in one arena block */
+    const struct virtio_net_queue_config *queue_config = &g_queue_config[dev_idx];
+    uint16_t rx_want = (queue_config->rx_size != 0u) ? queue_config->rx_size : VIRTIO_NET_QUEUE_SIZE_DEFAULT;
+    uint16_t tx_want = (queue_config->tx_size != 0u) ? queue_config->tx_size : VIRTIO_NET_QUEUE_SIZE_DEFAULT;
+    dev->rx_split = queue_config->rx_split;
+    for (uint16_t pair = 0u; pair < dev->max_queue_pairs; ++pair) {
+        dev->rxq[pair].size = virtio_net_queue_depth(dev, dev->rxq[pair].index, rx_want);
+        dev->txq[pair].size = virtio_net_queue_depth(dev, dev->txq[pair].index, tx_want);
+        if (dev->rxq[pair].size == 0u || dev->txq[pair].size == 0u) {
+            return -1;
+        }
+    }
+    if ((driver_features_lo & (1u << VIRTIO_NET_F_CTRL_VQ)) != 0u) {
+        dev->ctrl_index = 2u * device_pairs;
+        /* One command (three descriptors) is in flight at a time */
+        dev->ctrl_size = virtio_net_queue_depth(dev, dev->ctrl_index, VIRTIO_NET_CTRL_QUEUE_SIZE);
+        if (dev->ctrl_size == 0u) {
+            return -1;
+        }
+    }
+    if (virtio_net_alloc_dma(dev) != 0) {
+        return -1;
+    }
+
+    for (uint16_t pair = 0u; pair < dev->max_queue_pairs; ++pair) {
+        struct virtio_net_rxq *rxq = &dev->rxq[pair];
+        struct virtio_net_txq *txq = &dev->txq[pair];
+
+        rxq->sem = OSSemCreate(0u);
+        if (rxq->sem == NULL) {
+            uart_puts("[virtio-net] Warning: failed to create RX semaphore\n");
+        }
+
+        virtio_net_configure_queue(dev, rxq->index, &rxq->vq, rxq->size);
+        virtio_net_prepare_rx(rxq);
+        virtio_net_notify(dev, &rxq->vq, rxq->index);
+
+        virtio_net_configure_queue(dev, txq->index, &txq->vq, txq->size);
+        virtio_net_prepare_tx(dev, txq);
+    }
+
+    if (dev->ctrl_size != 0u) {
+        virtio_net_configure_queue(dev, dev->ctrl_index, &dev->ctrl, dev->ctrl_size);
+        virtio_net_prepare_ctrl(dev);
+    }
+
+    status_value |= VIRTIO_STATUS_DRIVER_OK;
+    virtio_reg_write(dev, VIRTIO_MMIO_STATUS, status_value);
+
+    status = virtio_reg_read(dev, VIRTIO_MMIO_STATUS);
+    log_status("[virtio-net] DRIVER_OK", status);
+
+    uart_puts("[virtio-net] Queue sizes: RX=");
+    uart_write_dec(dev->rxq[0].size);
+    uart_puts(" TX=");
+    uart_write_dec(dev->txq[0].size);
+    uart_puts(", ");
+    uart_write_dec((uint32_t)(dev->dma_bytes / 1024u));
+    uart_puts(" KB of DMA memory (");
+    uart_write_dec((uint32_t)(dma_arena_free() / 1024u));
+    uart_puts(" KB left)\n");
+
+    dev->driver_ok = 1u;
+
+    if (dev->pci != 0u) {
+        /* One LPI per data virtqueue; the handler tells them apart by number */
+        for (uint32_t v = 0u; v < 2u * dev->max_queue_pairs; ++v) {
+            BSP_IntVectSetArg(dev->msix_lpi + v, 0u, 0u, virtio_net_msix_isr, dev);
+            BSP_IntSrcEn(dev->msix_lpi + v);
+        }
+        uart_puts("[virtio-net] MSI-X vectors enabled on device ");
+        uart_write_dec(dev_idx);
+        uart_putc('\n');
+        return 0;
+    }
+
+    /* Register and enable VirtIO network interrupt */
+    uart_puts("[virtio-net] Registering interrupt handler for IRQ ");
+    uart_write_dec(irq);
+    uart_putc('\n');
+
+    if (irq >= VIRTIO_NET_DEFAULT_IRQ && irq - VIRTIO_NET_DEFAULT_IRQ < VIRTIO_NET_MMIO_TRANSPORTS) {
+        g_irq_devices[irq - VIRTIO_NET_DEFAULT_IRQ] = dev;
+    }
+    BSP_IntVectSetArg(irq, 0u, 0u, virtio_net_isr, dev);
+    BSP_IntSrcEn(irq);
+
+    /* Enable interrupts on the device */
+    uart_puts("[virtio-net] Interrupts enabled on device ");
+    uart_write_dec(dev_idx);
+    uart_putc('\n');
+
+    return 0;
+}
+
+int virtio_net_init_all(void)
+{
+    uart_puts("[virtio-net] Scanning for devices...\n");
+
+    if (g_rx_global_sem == NULL) {
+        g_rx_global_sem = OSSemCreate(0u);
+        if (g_rx_global_sem == NULL) {
+            uart_puts("[virtio-net] Warning: failed to create global RX semaphore\n");
+        }
+    }
+
+    g_device_count = 0u;
+    virtio_net_tx_timer_init();
+
+    /*
+     * One pass over the virtio-mmio transports, then the PCI bus; a device
+     * that fails leaves its slot to the next one
+     */
+    size_t transport = 0u;
+    size_t devfn = 0u;
+    while (g_device_count < VIRTIO_NET_MAX_DEVICES) {
+        uintptr_t base = 0u;
+        uint32_t irq = 0u;
+        struct pci_device pdev;
+        struct pci_device *found = NULL;
+        size_t i = g_device_count;
+
+        if (virtio_net_scan(&base, &irq, &transport) != 0) {
+            if (virtio_net_pci_scan(&pdev, &devfn) != 0) {
+                break;
+            }
+            found = &pdev;
+        }
+        if (virtio_net_init_device(i, base, irq, found) == 0) {
+            g_device_count++;
+            uart_puts("[virtio-net] Device ");
+            uart_write_dec(i);
+            uart_puts(" initialized successfully\n");
+        } else {
+            uart_puts("[virtio-net] Failed to initialize device ");
+            uart_write_dec(i);
+            uart_putc('\n');
+        }
+    }
+
+    if (g_device_count > 0u) {
+        /* Set legacy pointer to device 0 for backward compatibility */
+        g_dev = &g_devices[0];
+        uart_puts("[virtio-net] Total devices initialized: ");
+        uart_write_dec(g_device_count);
+        uart_putc('\n');
+        return 0;
+    } else {
+        uart_puts("[virtio-net] No devices found\n");
+        return -1;
+    }
+}
+
+int virtio_net_init(uintptr_t base_addr, uint32_t irq)
+{
+    uintptr_t detected_base = base_addr;
+    uint32_t detected_irq = irq;
+
+    if (g_rx_global_sem == NULL) {
+        g_rx_global_sem = OSSemCreate(0u);
+        if (g_rx_global_sem == NULL) {
+            uart_puts("[virtio-net] Warning: failed to create global RX semaphore\n");
+        }
+    }
+
+    size_t transport = 0u;
+    if (virtio_net_scan(&detected_base, &detected_irq, &transport) == 0) {
+        base_addr = detected_base;
+        irq = detected_irq;
+    } else {
+        if (base_addr == 0u) {
+            base_addr = VIRTIO_NET_MMIO_BASE_DEFAULT;
+        }
+        if (irq == 0u) {
+            irq = VIRTIO_NET_DEFAULT_IRQ;
+        }
+        uart_puts("[virtio-net] Using default base/IRQ\n");
+    }
+
+    virtio_net_tx_timer_init();
+    if (virtio_net_init_device(0u, base_addr, irq, NULL) != 0) {
+        return -1;
+    }
+
+    g_device_count = 1u;
+    g_dev = &g_devices[0];
+
+    return 0;
+}
+
+virtio_net_dev_t virtio_net_get_device(size_t index)
+{
+    if (index >= g_device_count) {
+        return NULL;
+    }
+    return &g_devices[index];
+}
+
+size_t virtio_net_get_device_count(void)
+{
+    return g_device_count;
+}
+
+int virtio_net_set_queue_size(size_t index, uint16_t rx_size, uint16_t tx_size)
+{
+    if (index >= VIRTIO_NET_MAX_DEVICES ||
+        (rx_size != 0u && (rx_size < VIRTIO_NET_QUEUE_SIZE_MIN || rx_size > VIRTIO_NET_QUEUE_SIZE_MAX)) ||
+        (tx_size != 0u && (tx_size < VIRTIO_NET_QUEUE_SIZE_MIN || tx_size > VIRTIO_NET_QUEUE_SIZE_MAX))) {
+        return -1;
+    }
+    g_queue_config[index].rx_size = rx_size;
+    g_queue_config[index].tx_size = tx_size;
+    return 0;
+}
+
+int virtio_net_set_dma_policy(size_t index, uint8_t policy)
+{
+    if (index >= VIRTIO_NET_MAX_DEVICES || policy > VIRTIO_NET_DMA_NONCOHERENT) {
+        return -1;
+    }
+    g_queue_config[index].dma = policy;
+    return 0;
+}
+
+int virtio_net_set_rx_split(size_t index, uint8_t enable)
+{
+    if (index >= VIRTIO_NET_MAX_DEVICES) {
+        return -1;
+    }
+    g_queue_config[index].rx_split = (uint8_t)(enable != 0u);
+    return 0;
+}
+
+size_t virtio_net_get_index_dev(virtio_net_dev_t dev)
+{
+    return (dev != NULL) ? dev->index : 0u;
+}
+
+static void virtio_net_fwd_pool_put(uint8_t *buffer)
+{
+    OS_CPU_SR cpu_sr;
+
+    OS_ENTER_CRITICAL();
+    g_fwd_pool.free[g_fwd_pool.count++] = buffer;
+    OS_EXIT_CRITICAL();
+}
+
+static uint8_t *virtio_net_fwd_pool_get(void)
+{
+    OS_CPU_SR cpu_sr;
+    uint8_t *buffer = NULL;
+
+    OS_ENTER_CRITICAL();
+    if (g_fwd_pool.count > 0u) {
+        buffer = g_fwd_pool.free[--g_fwd_pool.count];
+    }
+    OS_EXIT_CRITICAL();
+    return buffer;
+}
+
+/*
+ * Return forwarded buffers whose descriptors the device has consumed. Like
+ * the TX pools this relies on in-order completion: descriptor position p
+ * lives in slot p % size.
+ */
+static void virtio_net_tx_return_loans(struct virtio_net_txq *txq, uint16_t from, uint16_t to)
+{
+    for (uint16_t pos = from; pos != to && txq->loans_out > 0u; ++pos) {
+        uint16_t slot = (uint16_t)(pos % txq->size);
+        if (txq->loans[slot] != NULL) {
+            virtio_net_fwd_pool_put(txq->loans[slot]);
+            txq->loans[slot] = NULL;
+            txq->loans_out--;
+        }
+    }
+}
+
+/* Reap TX completions and return the number of free TX slots */
+static uint16_t virtio_net_tx_reclaim(struct virtio_net_txq *txq)
+{
+    struct virtio_queue *queue = &txq->vq;
+    uint16_t used_before = queue->used_count;
+
+    txq->completed += virtio_queue_reap(queue, txq->size);
+    if (txq->loans_out > 0u) {
+        virtio_net_tx_return_loans(txq, used_before, queue->used_count);
+    }
+
+    virtio_net_tx_pool_reclaim(&txq->jumbo, queue->used_count, txq->size);
+    virtio_net_tx_pool_reclaim(&txq->gso, queue->used_count, txq->size);
+
+    /* Calculate in-flight packets (handle wrap-around) */
+    uint16_t in_flight = (uint16_t)(queue->posted - queue->used_count);
+    return (uint16_t)(txq->size - in_flight);
+}
+
+/*
+ * Free TX slots for a sender wanting 'want' of them. In order, everything
+ * below used->idx is done whenever it is read, so the read waits until the
+ * slots already known free drop under a quarter of the ring (or 'want'), and
+ * one read then retires the whole batch. Otherwise reclaim as completions come.
+ */
+static uint16_t virtio_net_tx_room(const struct virtio_net_device *dev, struct virtio_net_txq *txq, uint16_t want)
+{
+    if (dev->in_order != 0u) {
+        uint16_t room = (uint16_t)(txq->size - (uint16_t)(txq->vq.posted - txq->vq.used_count));
+        if (room >= want && room >= txq->size / 4u) {
+            return room;
+        }
+    }
+    return virtio_net_tx_reclaim(txq);
+}
+
+static uint32_t virtio_net_csum_add(uint32_t sum, const uint8_t *bytes, size_t length)
+{
+    while (length > 1u) {
+        sum += ((uint32_t)bytes[0] << 8) | (uint32_t)bytes[1];
+        bytes += 2u;
+        length -= 2u;
+    }
+    if (length == 1u) {
+        sum += ((uint32_t)bytes[0] << 8);
+    }
+    return sum;
+}
+
+static uint16_t virtio_net_csum_fold(uint32_t sum)
+{
+    while ((sum >> 16u) != 0u) {
+        sum = (sum & 0xFFFFu) + (sum >> 16u);
+    }
+    return (uint16_t)sum;
+}
+
+static uint16_t virtio_net_load_be16(const uint8_t *bytes)
+{
+    return (uint16_t)(((uint16_t)bytes[0] << 8) | bytes[1]);
+}
+
+static void virtio_net_store_be16(uint8_t *bytes, uint16_t value)
+{
+    bytes[0] = (uint8_t)(value >> 8);
+    bytes[1] = (uint8_t)(value & 0xFFu);
+}
+
+/* Software fallback for VIRTIO_NET_HDR_F_NEEDS_CSUM: fold [start, length) into the field */
+static void virtio_net_csum_complete(uint8_t *frame, size_t length, uint16_t start, uint16_t offset)
+{
+    uint32_t sum = virtio_net_csum_add(0u, frame + start, length - start);
+
+    /* 0 would mean "no checksum" to UDP; 0xFFFF is the same value in one's complement */
+    uint16_t csum = (uint16_t)~virtio_net_csum_fold(sum);
+    if (csum == 0u) {
+        csum = 0xFFFFu;
+    }
+    virtio_net_store_be16(frame + start + offset, csum);
+}
+
+/* Ethernet + IPv4 + TCP header length of a TSO frame, or 0 if it is not plain IPv4/TCP */
+static size_t virtio_net_tso_hdr_len(const uint8_t *frame, size_t length)
+{
+    const size_t l3 = VIRTIO_NET_ETH_HLEN;
+
+    if (length < l3 + 20u || virtio_net_load_be16(frame + 12u) != 0x0800u ||
+        (frame[l3] >> 4u) != 4u || frame[l3 + 9u] != 6u) {
+        return 0u;
+    }
+    size_t l4 = l3 + (size_t)(frame[l3] & 0x0Fu) * 4u;
+    if (l4 < l3 + 20u || length < l4 + 20u) {
+        return 0u;
+    }
+    size_t hdr_len = l4 + (size_t)(frame[l4 + 12u] >> 4u) * 4u;
+    if (hdr_len < l4 + 20u || hdr_len > length) {
+        return 0u;
+    }
+    return hdr_len;
+}
+
+static int virtio_net_tx_offload_valid(struct virtio_net_device *dev, const uint8_t *frame,
+                                       size_t length, const struct virtio_net_tx_offload *offload)
+{
+    size_t max_frame = virtio_net_get_max_frame_dev(dev);
+
+    if (offload == NULL) {
+        return length <= max_frame;
+    }
+    if ((offload->flags & VIRTIO_NET_TX_CSUM) != 0u &&
+        (size_t)offload->csum_start + offload->csum_offset + sizeof(uint16_t) > length) {
+        return 0;
+    }
+    if ((offload->flags & VIRTIO_NET_TX_TSO4) == 0u) {
+        return length <= max_frame;
+    }
+
+    /* Super-frame: it needs a partial TCP checksum, and every segment must fit the MTU */
+    size_t hdr_len = virtio_net_tso_hdr_len(frame, length);
+    return (offload->flags & VIRTIO_NET_TX_CSUM) != 0u && hdr_len != 0u && offload->gso_size != 0u &&
+           hdr_len + offload->gso_size <= max_frame && length <= VIRTIO_NET_MAX_GSO_FRAME_SIZE;
+}
+
+/*
+ * Fill the virtio header for a frame whose L2-L4 headers start at 'frame'
+ * ('head_len' bytes of it are contiguous). Offloads the device lacks have
+ * already been done in software or rejected by the caller.
+ */
+static void virtio_net_tx_fill_hdr(const struct virtio_net_device *dev, struct virtio_net_hdr *hdr,
+                                   const uint8_t *frame, size_t head_len,
+                                   const struct virtio_net_tx_offload *offload)
+{
+    util_memset(hdr, 0, sizeof(*hdr));
+    if (offload != NULL && (offload->flags & VIRTIO_NET_TX_CSUM) != 0u &&
+        (dev->offloads & VIRTIO_NET_OFFLOAD_TX_CSUM) != 0u) {
+        hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr->csum_start = offload->csum_start;
+        hdr->csum_offset = offload->csum_offset;
+    }
+    if (offload != NULL && (offload->flags & VIRTIO_NET_TX_TSO4) != 0u) {
+        /* Only reached with HOST_TSO4; without it the frame was segmented in software */
+        hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+        hdr->gso_size = offload->gso_size;
+        hdr->hdr_len = (uint16_t)virtio_net_tso_hdr_len(frame, head_len);
+    }
+}
+
+/* Arm the one-shot timer for 'when' unless it already fires earlier */
+static void virtio_net_tx_timer_arm(uint64_t when)
+{
+    OS_CPU_SR cpu_sr;
+
+    OS_ENTER_CRITICAL();
+    if (g_tx_timer_at == 0u || (int64_t)(when - g_tx_timer_at) < 0) {
+        g_tx_timer_at = when;
+        timer_oneshot_arm(when);
+    }
+    OS_EXIT_CRITICAL();
+}
+
+/* Notify the device of the open batch, recording why and how large it was */
+static void virtio_net_tx_flush_batch(struct virtio_net_device *dev, struct virtio_net_txq *txq,
+                                      uint8_t reason)
+{
+    uint16_t count = txq->batch_count;
+    uint32_t bucket = 0u;
+
+    txq->flush_due = 0u;
+    if (count == 0u) {
+        return;
+    }
+    virtio_net_kick(dev, &txq->vq, txq->size, txq->index);
+    txq->batch_count = 0u;
+
+    while (bucket + 1u < VIRTIO_NET_TX_BATCH_BUCKETS && (2u << bucket) <= count) {
+        bucket++;
+    }
+    txq->flushes[reason]++;
+    txq->batch_hist[bucket]++;
+}
+
+/*
+ * Fold the gap since the previous post, spread over the 'frames' it carried,
+ * into the average (1/4 weight) and set the batch limit to the frames
+ * expected within the deadline. An idle
+ * spell counts as four deadlines, so the first frames after it go out alone
+ * and the limit climbs within a few frames of a burst starting.
+ */
+static void virtio_net_tx_adapt(const struct virtio_net_device *dev, struct virtio_net_txq *txq,
+                                uint64_t now, uint16_t frames)
+{
+    uint64_t gap = now - txq->last_post;
+    uint32_t limit;
+
+    txq->last_post = now;
+    if (gap > 4u * (uint64_t)dev->tx_deadline) {
+        gap = 4u * (uint64_t)dev->tx_deadline;
+    }
+    gap /= frames;
+    txq->post_gap = (uint32_t)((int64_t)txq->post_gap + ((int64_t)gap - (int64_t)txq->post_gap) / 4);
+
+    limit = (txq->post_gap != 0u) ? dev->tx_deadline / txq->post_gap : txq->batch_max;
+    if (limit < 1u) {
+        limit = 1u;
+    } else if (limit > txq->batch_max) {
+        limit = txq->batch_max;
+    }
+    txq->batch_limit = (uint16_t)limit;
+}
+
+/*
+ * Publish the 'frames' staged frames and notify the device once the adaptive
+ * batch limit is reached; the first post of a batch arms its deadline.
+ */
+static void virtio_net_tx_post(struct virtio_net_device *dev, struct virtio_net_txq *txq, uint16_t frames)
+{
+    struct virtio_queue *queue = &txq->vq;
+    uint64_t now = timer_count();
+
+    virtio_queue_publish(queue, txq->size);
+    if (txq->lease_pool != NULL) {
+        /* Pool buffer: free again once the used count passes this entry */
+        virtio_net_tx_pool_post(txq->lease_pool, queue->posted);
+    }
+
+    virtio_net_tx_adapt(dev, txq, now, frames);
+    txq->batch_count = (uint16_t)(txq->batch_count + frames);
+    if (txq->batch_count >= txq->batch_limit) {
+        virtio_net_tx_flush_batch(dev, txq, VIRTIO_NET_TX_FLUSH_BATCH);
+    } else if (txq->batch_count == frames) {
+        txq->batch_deadline = now + dev->tx_deadline;
+        virtio_net_tx_timer_arm(txq->batch_deadline);
+    }
+}
+
+/* Hand a reserved slot holding a frame of 'length' bytes to the device */
+static void virtio_net_tx_publish(struct virtio_net_device *dev, struct virtio_net_txq *txq,
+                                  uint16_t idx, size_t length,
+                                  const struct virtio_net_tx_offload *offload)
+{
+    uint8_t *buffer = txq->lease_buffer;
+    struct virtio_net_hdr *hdr = (struct virtio_net_hdr *)buffer;
+
+    virtio_net_tx_fill_hdr(dev, hdr, buffer + sizeof(*hdr), length, offload);
+    if (offload != NULL && (offload->flags & VIRTIO_NET_TX_CSUM) != 0u &&
+        (dev->offloads & VIRTIO_NET_OFFLOAD_TX_CSUM) == 0u) {
+        virtio_net_csum_complete(buffer + sizeof(*hdr), length, offload->csum_start, offload->csum_offset);
+    }
+    dma_sync_for_device(txq->vq.dma, buffer, length + sizeof(*hdr));
+
+    virtio_queue_stage(&txq->vq, txq->size, idx, (uint64_t)(uintptr_t)buffer,
+                       (uint32_t)(length + sizeof(*hdr)), 0u);
+    virtio_net_tx_post(dev, txq, 1u);
+}
+
+/*
+ * Move backlog frames into free ring slots, oldest first. Backlog frames fit
+ * a slot buffer, so each takes one descriptor. Whatever was moved is kicked
+ * at once: in interrupt context nobody else would flush it.
+ */
+static void virtio_net_tx_drain(struct virtio_net_device *dev, struct virtio_net_txq *txq)
+{
+    uint16_t free_slots = virtio_net_tx_room(dev, txq, txq->backlog_count);
+    uint8_t moved = 0u;
+
+    while (txq->backlog_count > 0u && free_slots > 0u) {
+        const struct virtio_net_tx_backlog_entry *entry = &txq->backlog[txq->backlog_head];
+        uint16_t idx = (uint16_t)(txq->vq.posted % txq->size);
+
+        txq->lease_buffer = txq->buffers[idx];
+        txq->lease_pool = NULL;
+        util_memcpy(txq->lease_buffer + sizeof(struct virtio_net_hdr), entry->data, entry->len);
+        virtio_net_tx_publish(dev, txq, idx, entry->len, (entry->has_offload != 0u) ? &entry->offload : NULL);
+
+        txq->backlog_head = (uint16_t)((txq->backlog_head + 1u) % VIRTIO_NET_TX_BACKLOG_DEPTH);
+        txq->backlog_count--;
+        free_slots--;
+        moved = 1u;
+    }
+
+    if (moved != 0u) {
+        virtio_net_tx_flush_batch(dev, txq, VIRTIO_NET_TX_FLUSH_BACKLOG);
+    }
+}
+
+/*
+ * Give up a claim on the TX ring (see virtio_net_txq.busy). Before letting go,
+ * drain the backlog and keep the TX interrupt armed while frames are queued or
+ * senders are blocked; after arming, completions that raced it are picked up
+ * here rather than waited for. An interrupt or batch deadline skipped while
+ * the claim was held is replayed by running the same step again.
+ */
+static void virtio_net_tx_unclaim(struct virtio_net_device *dev, struct virtio_net_txq *txq)
+{
+    struct virtio_queue *queue = &txq->vq;
+
+    for (;;) {
+        txq->irq_missed = 0u;
+        if (txq->flush_due != 0u) {
+            virtio_net_tx_flush_batch(dev, txq, VIRTIO_NET_TX_FLUSH_DEADLINE);
+        }
+        for (;;) {
+            virtio_net_tx_drain(dev, txq);
+            if (txq->backlog_count == 0u && dev->tx_waiters == 0u) {
+                if (txq->irq_armed != 0u) {
+                    virtio_queue_disable_irq(queue, txq->size, dev->event_idx);
+                    txq->irq_armed = 0u;
+                }
+                break;
+            }
+            virtio_queue_enable_irq(queue, txq->size, dev->event_idx);
+            txq->irq_armed = 1u;
+
+            uint16_t used_before = queue->used_count;
+            (void)virtio_net_tx_reclaim(txq);
+            if (queue->used_count == used_before) {
+                break;
+            }
+        }
+
+        /* Blocked senders retry once the ring has room again */
+        if (dev->tx_waiters != 0u && dev->tx_sem != NULL &&
+            (uint16_t)(queue->posted - queue->used_count) < txq->size) {
+            OSSemPost(dev->tx_sem);
+        }
+
+        txq->busy = 0u;
+        if (txq->irq_missed == 0u) {
+            break;
+        }
+        txq->busy = 1u;
+    }
+}
+
+/* Claim the ring for a task; the caller holds the scheduler lock */
+static inline void virtio_net_tx_claim(struct virtio_net_txq *txq)
+{
+    txq->busy = 1u;
+}
+
+/* Used-buffer interrupt for a TX queue that asked for one */
+static void virtio_net_tx_irq(struct virtio_net_device *dev, struct virtio_net_txq *txq)
+{
+    if (txq->irq_armed == 0u) {
+        return;
+    }
+    if (txq->busy != 0u) {
+        txq->irq_missed = 1u;
+        return;
+    }
+    txq->busy = 1u;
+    virtio_net_tx_unclaim(dev, txq);
+}
+
+/*
+ * One-shot timer: notify every TX batch whose deadline has passed and re-arm
+ * for the earliest one still open. A queue a task holds is flagged instead
+ * and notified when the task lets go of it.
+ */
+static void virtio_net_tx_timer_isr(uint32_t int_id)
+{
+    uint64_t now = timer_count();
+    uint64_t next = 0u;
+
+    (void)int_id;
+    timer_oneshot_cancel();
+    g_tx_timer_at = 0u;
+
+    for (size_t d = 0u; d < g_device_count; ++d) {
+        struct virtio_net_device *dev = &g_devices[d];
+        if (!dev->driver_ok) {
+            continue;
+        }
+        for (uint16_t q = 0u; q < dev->queue_pairs; ++q) {
+            struct virtio_net_txq *txq = &dev->txq[q];
+            if (txq->batch_count == 0u) {
+                continue;
+            }
+            if ((int64_t)(txq->batch_deadline - now) > 0) {
+                if (next == 0u || (int64_t)(txq->batch_deadline - next) < 0) {
+                    next = txq->batch_deadline;
+                }
+                continue;
+            }
+            if (txq->busy != 0u) {
+                txq->flush_due = 1u;
+                txq->irq_missed = 1u;
+                continue;
+            }
+            txq->busy = 1u;
+            virtio_net_tx_flush_batch(dev, txq, VIRTIO_NET_TX_FLUSH_DEADLINE);
+            virtio_net_tx_unclaim(dev, txq);
+        }
+    }
+    if (next != 0u) {
+        virtio_net_tx_timer_arm(next);
+    }
+}
+
+/* Hook the coalescing deadline timer up once, on the first device init */
+static void virtio_net_tx_timer_init(void)
+{
+    if (g_tx_timer_ready != 0u) {
+        return;
+    }
+    timer_oneshot_cancel();
+    BSP_IntVectSet(TIMER_ONESHOT_IRQ, 0u, 0u, virtio_net_tx_timer_isr);
+    BSP_IntSrcEn(TIMER_ONESHOT_IRQ);
+    g_tx_timer_ready = 1u;
+}
+
+/* Largest frame a TX buffer of this queue holds: a slot, or whichever pools were carved */
+static size_t virtio_net_tx_max_frame(const struct virtio_net_txq *txq)
+{
+    size_t limit = VIRTIO_NET_BUFFER_SIZE - sizeof(struct virtio_net_hdr);
+
+    if (txq->jumbo.capacity > limit) {
+        limit = txq->jumbo.capacity;
+    }
+    if (txq->gso.capacity > limit) {
+        limit = txq->gso.capacity;
+    }
+    return limit;
+}
+
+/*
+ * Reserve the next TX slot for a frame of up to 'length' bytes that takes
+ * 'descs' descriptors. Frames larger than a slot buffer are built in a jumbo
+ * or TSO pool buffer instead. The scheduler stays locked until the slot is
+ * published or abandoned, so tasks sharing a queue cannot claim the same slot.
+ * Returns the slot index, VIRTIO_NET_EAGAIN while the ring, a buffer pool or
+ * the backlog ahead of it is full, or -1 on error. Never spins.
+ */
+static int virtio_net_tx_reserve(struct virtio_net_device *dev, struct virtio_net_txq *txq,
+                                 size_t length, uint16_t descs)
+{
+    OSSchedLock();
+    if (txq->leased != 0u) {
+        OSSchedUnlock();
+        uart_puts("[virtio-net] TX lease already outstanding\n");
+        return -1;
+    }
+    if (length > virtio_net_tx_max_frame(txq)) {
+        OSSchedUnlock();
+        uart_puts("[virtio-net] TX frame too large\n");
+        return -1;
+    }
+    virtio_net_tx_claim(txq);
+
+    /* Queued frames go first; a new frame only gets the ring once they are out */
+    virtio_net_tx_drain(dev, txq);
+    uint16_t available_slots = virtio_net_tx_room(dev, txq, descs);
+    if (txq->backlog_count > 0u || available_slots < descs) {
+        virtio_net_tx_unclaim(dev, txq);
+        OSSchedUnlock();
+        return VIRTIO_NET_EAGAIN;
+    }
+
+    uint16_t idx = (uint16_t)(txq->vq.posted % txq->size);
+    txq->lease_buffer = txq->buffers[idx];
+    txq->lease_capacity = VIRTIO_NET_BUFFER_SIZE - sizeof(struct virtio_net_hdr);
+    txq->lease_pool = NULL;
+
+    if (length > txq->lease_capacity) {
+        struct virtio_net_tx_pool *pool = (length <= txq->jumbo.capacity) ? &txq->jumbo : &txq->gso;
+        if (pool->inflight >= pool->count && dev->in_order != 0u) {
+            /* The lazy reclaim may not have looked at the used ring lately */
+            (void)virtio_net_tx_reclaim(txq);
+        }
+        if (pool->inflight >= pool->count) {
+            virtio_net_tx_unclaim(dev, txq);
+            OSSchedUnlock();
+            return VIRTIO_NET_EAGAIN;
+        }
+        txq->lease_buffer = pool->buffers[pool->next];
+        txq->lease_capacity = pool->capacity;
+        txq->lease_pool = pool;
+    }
+
+    txq->leased = 1u;
+    return (int)idx;
+}
+
+static void virtio_net_tx_release(struct virtio_net_device *dev, struct virtio_net_txq *txq)
+{
+    txq->leased = 0u;
+    virtio_net_tx_unclaim(dev, txq);
+    OSSchedUnlock();
+}
+
+/* Queue a copy of a frame behind a full ring; -1 if it does not fit or the backlog is full */
+static int virtio_net_tx_backlog_push(struct virtio_net_device *dev, struct virtio_net_txq *txq,
+                                      const uint8_t *frame, size_t length,
+                                      const struct virtio_net_tx_offload *offload)
+{
+    int result = -1;
+
+    if (length > VIRTIO_NET_TX_BACKLOG_FRAME) {
+        return -1;
+    }
+
+    OSSchedLock();
+    if (txq->leased == 0u && txq->backlog_count < VIRTIO_NET_TX_BACKLOG_DEPTH) {
+        virtio_net_tx_claim(txq);
+        uint16_t tail = (uint16_t)((txq->backlog_head + txq->backlog_count) % VIRTIO_NET_TX_BACKLOG_DEPTH);
+        struct virtio_net_tx_backlog_entry *entry = &txq->backlog[tail];
+
+        util_memcpy(entry->data, frame, length);
+        entry->len = (uint16_t)length;
+        entry->has_offload = (uint8_t)(offload != NULL);
+        if (offload != NULL) {
+            entry->offload = *offload;
+        }
+        txq->backlog_count++;
+        if (txq->backlog_count > txq->backlog_max) {
+            txq->backlog_max = txq->backlog_count;
+        }
+        virtio_net_tx_unclaim(dev, txq);
+        result = 0;
+    }
+    OSSchedUnlock();
+    return result;
+}
+
+/*
+ * The frame found the ring and backlog full: apply the device's policy.
+ * Returns 0 to retry (BLOCK woke up), otherwise the code to hand back.
+ */
+static int virtio_net_tx_backpressure(struct virtio_net_device *dev, struct virtio_net_txq *txq)
+{
+    if (dev->tx_policy == VIRTIO_NET_TX_POLICY_EAGAIN) {
+        txq->eagain++;
+        return VIRTIO_NET_EAGAIN;
+    }
+    if (dev->tx_policy != VIRTIO_NET_TX_POLICY_BLOCK || dev->tx_sem == NULL || OSIntNesting > 0u) {
+        txq->drops++;
+        return -1;
+    }
+
+    /* Arm the TX interrupt (unclaim does, now that someone waits), then sleep until it fires */
+    INT8U err;
+    OSSchedLock();
+    dev->tx_waiters++;
+    virtio_net_tx_claim(txq);
+    virtio_net_tx_unclaim(dev, txq);
+    OSSchedUnlock();
+
+    txq->blocked++;
+    OSSemPend(dev->tx_sem, virtio_ms_to_ticks(dev->tx_block_ms), &err);
+
+    OSSchedLock();
+    dev->tx_waiters--;
+    OSSchedUnlock();
+
+    if (err != OS_ERR_NONE) {
+        txq->drops++;
+        return -1;
+    }
+    return 0;
+}
+
+/* Reserve a slot, applying the backpressure policy while the ring stays full */
+static int virtio_net_tx_reserve_wait(struct virtio_net_device *dev, struct virtio_net_txq *txq,
+                                      size_t length, uint16_t descs)
+{
+    for (;;) {
+        int slot = virtio_net_tx_reserve(dev, txq, length, descs);
+        if (slot != VIRTIO_NET_EAGAIN) {
+            return slot;
+        }
+        int result = virtio_net_tx_backpressure(dev, txq);
+        if (result != 0) {
+            return result;
+        }
+    }
+}
+
+/*
+ * Software TSO for devices without VIRTIO_NET_F_HOST_TSO4: cut an IPv4/TCP
+ * super-frame into gso_size segments, each with its own copy of the headers,
+ * fixed-up IP length/id/checksum, TCP sequence number and flags, and a partial
+ * TCP checksum that virtio_net_tx_publish() completes. Must not be called with
+ * a lease outstanding.
+ */
+static int virtio_net_tx_segment(struct virtio_net_device *dev, struct virtio_net_txq *txq,
+                                 const uint8_t *frame, size_t length, uint16_t gso_size)
+{
+    const size_t l3 = VIRTIO_NET_ETH_HLEN;
+    size_t hdr_len = virtio_net_tso_hdr_len(frame, length);
+    size_t l4 = l3 + (size_t)(frame[l3] & 0x0Fu) * 4u;
+    size_t payload_len = length - hdr_len;
+    uint16_t ip_id = virtio_net_load_be16(frame + l3 + 4u);
+    uint32_t seq = ((uint32_t)virtio_net_load_be16(frame + l4 + 4u) << 16) |
+                   virtio_net_load_be16(frame + l4 + 6u);
+    struct virtio_net_tx_offload seg_offload;
+    size_t offset = 0u;
+    uint16_t segment = 0u;
+
+    seg_offload.flags = VIRTIO_NET_TX_CSUM;
+    seg_offload.csum_start = (uint16_t)l4;
+    seg_offload.csum_offset = 16u;   /* TCP checksum field */
+    seg_offload.gso_size = 0u;
+
+    do {
+        size_t chunk = payload_len - offset;
+        if (chunk > gso_size) {
+            chunk = gso_size;
+        }
+        size_t seg_len = hdr_len + chunk;
+
+        int slot = virtio_net_tx_reserve_wait(dev, txq, seg_len, 1u);
+        if (slot < 0) {
+            return slot;
+        }
+        uint8_t *out = txq->lease_buffer + sizeof(struct virtio_net_hdr);
+        util_memcpy(out, frame, hdr_len);
+        util_memcpy(out + hdr_len, frame + hdr_len + offset, chunk);
+
+        uint8_t *ip = out + l3;
+        uint8_t *tcp = out + l4;
+        uint16_t tcp_len = (uint16_t)(seg_len - l4);
+
+        virtio_net_store_be16(ip + 2u, (uint16_t)(seg_len - l3));
+        virtio_net_store_be16(ip + 4u, (uint16_t)(ip_id + segment));
+        virtio_net_store_be16(ip + 10u, 0u);
+        virtio_net_store_be16(ip + 10u, (uint16_t)~virtio_net_csum_fold(virtio_net_csum_add(0u, ip, l4 - l3)));
+
+        uint32_t seg_seq = seq + (uint32_t)offset;
+        virtio_net_store_be16(tcp + 4u, (uint16_t)(seg_seq >> 16));
+        virtio_net_store_be16(tcp + 6u, (uint16_t)(seg_seq & 0xFFFFu));
+        if (offset + chunk < payload_len) {
+            tcp[13] = (uint8_t)(tcp[13] & ~(VIRTIO_NET_TCP_FIN | VIRTIO_NET_TCP_PSH));
+        }
+        if (offset > 0u) {
+            tcp[13] = (uint8_t)(tcp[13] & ~VIRTIO_NET_TCP_CWR);
+        }
+
+        /* Pseudo-header sum: addresses, protocol, TCP length */
+        uint32_t pseudo = virtio_net_csum_add(0u, ip + 12u, 8u);
+        pseudo += 6u;
+        pseudo += tcp_len;
+        virtio_net_store_be16(tcp + 16u, virtio_net_csum_fold(pseudo));
+
+        virtio_net_tx_publish(dev, txq, (uint16_t)slot, seg_len, &seg_offload);
+        virtio_net_tx_release(dev, txq);
+
+        offset += chunk;
+        segment++;
+    } while (offset < payload_len);
+
+    return 0;
+}
+
+/* Whether a frame offered with this offload must be cut up in software first */
+static int virtio_net_tx_needs_segment(const struct virtio_net_device *dev,
+                                       const struct virtio_net_tx_offload *offload, size_t length)
+{
+    return offload != NULL && (offload->flags & VIRTIO_NET_TX_TSO4) != 0u &&
+           (dev->offloads & VIRTIO_NET_OFFLOAD_TX_TSO4) == 0u &&
+           length > virtio_net_get_max_frame_dev((virtio_net_dev_t)dev);
+}
+
+int virtio_net_send_frame_dev(virtio_net_dev_t dev, const uint8_t *frame, size_t length)
+{
+    return virtio_net_send_frame_offload_queue(dev, 0u, frame, length, NULL);
+}
+
+int virtio_net_send_frame_offload_dev(virtio_net_dev_t dev, const uint8_t *frame, size_t length,
+                                      const struct virtio_net_tx_offload *offload)
+{
+    return virtio_net_send_frame_offload_queue(dev, 0u, frame, length, offload);
+}
+
+int virtio_net_send_frame_offload_queue(virtio_net_dev_t dev, uint16_t queue, const uint8_t *frame,
+                                        size_t length, const struct virtio_net_tx_offload *offload)
+{
+    if (dev == NULL || !dev->driver_ok) {
+        uart_puts("[virtio-net] Invalid device or driver not initialised\n");
+        return -1;
+    }
+
+    if (queue >= dev->queue_pairs) {
+        uart_puts("[virtio-net] Invalid TX queue\n");
+        return -1;
+    }
+
+    if (length == 0u || frame == NULL) {
+        uart_puts("[virtio-net] Invalid frame length\n");
+        return -1;
+    }
+
+    if (!virtio_net_tx_offload_valid(dev, frame, length, offload)) {
+        uart_puts("[virtio-net] Invalid TX offload or frame length\n");
+        return -1;
+    }
+
+    struct virtio_net_txq *txq = &dev->txq[queue];
+    if (virtio_net_tx_needs_segment(dev, offload, length)) {
+        return virtio_net_tx_segment(dev, txq, frame, length, offload->gso_size);
+    }
+
+    /* A full ring queues the frame in the backlog; only a full backlog invokes the policy */
+    for (;;) {
+        int slot = virtio_net_tx_reserve(dev, txq, length, 1u);
+        if (slot >= 0) {
+            util_memcpy(txq->lease_buffer + sizeof(struct virtio_net_hdr), frame, length);
+            virtio_net_tx_publish(dev, txq, (uint16_t)slot, length, offload);
+            virtio_net_tx_release(dev, txq);
+            return 0;
+        }
+        if (slot != VIRTIO_NET_EAGAIN) {
+            return -1;
+        }
+        if (virtio_net_tx_backlog_push(dev, txq, frame, length, offload) == 0) {
+            return 0;
+        }
+        int result = virtio_net_tx_backpressure(dev, txq);
+        if (result != 0) {
+            return result;
+        }
+    }
+}
+
+/*
+ * Stage up to 'count' frames that each fit a slot buffer under one claim:
+ * one reclaim, descriptors and avail slots written back to back (cleaned as
+ * one range each), one publish and one notify decision. Stops at the first
+ * frame that does not fit a slot or the ring, or when a backlog is queued
+ * ahead. Returns the number of frames staged.
+ */
+static size_t virtio_net_tx_burst(struct virtio_net_device *dev, struct virtio_net_txq *txq,
+                                  const uint8_t *const *frames, const size_t *lens, uint16_t count)
+{
+    const size_t capacity = VIRTIO_NET_BUFFER_SIZE - sizeof(struct virtio_net_hdr);
+    size_t max_frame = virtio_net_get_max_frame_dev(dev);
+    uint16_t staged = 0u;
+
+    OSSchedLock();
+    if (txq->leased != 0u) {
+        OSSchedUnlock();
+        return 0u;
+    }
+    virtio_net_tx_claim(txq);
+
+    virtio_net_tx_drain(dev, txq);
+    uint16_t room = virtio_net_tx_room(dev, txq, count);
+    if (txq->backlog_count == 0u) {
+        while (staged < count && staged < room) {
+            size_t length = lens[staged];
+            if (frames[staged] == NULL || length == 0u || length > capacity || length > max_frame) {
+                break;
+            }
+            uint16_t idx = (uint16_t)((txq->vq.posted + staged) % txq->size);
+            uint8_t *buffer = txq->buffers[idx];
+            struct virtio_net_hdr *hdr = (struct virtio_net_hdr *)buffer;
+
+            util_memcpy(buffer + sizeof(*hdr), frames[staged], length);
+            virtio_net_tx_fill_hdr(dev, hdr, buffer + sizeof(*hdr), length, NULL);
+            dma_sync_for_device(txq->vq.dma, buffer, length + sizeof(*hdr));
+            virtio_queue_stage(&txq->vq, txq->size, idx, (uint64_t)(uintptr_t)buffer,
+                               (uint32_t)(length + sizeof(*hdr)), 0u);
+            staged++;
+        }
+    }
+    if (staged > 0u) {
+        txq->lease_pool = NULL;
+        virtio_net_tx_post(dev, txq, staged);
+        txq->bursts++;
+        txq->burst_frames += staged;
+    }
+
+    virtio_net_tx_unclaim(dev, txq);
+    OSSchedUnlock();
+    return staged;
+}
+
+int virtio_net_send_burst_dev(virtio_net_dev_t dev, const uint8_t *const *frames, const size_t *lens,
+                              size_t count)
+{
+    return virtio_net_send_burst_queue(dev, 0u, frames, lens, count);
+}
+
+int virtio_net_send_burst_queue(virtio_net_dev_t dev, uint16_t queue, const uint8_t *const *frames,
+                                const size_t *lens, size_t count)
+{
+    if (dev == NULL || !dev->driver_ok) {
+        uart_puts("[virtio-net] Invalid device or driver not initialised\n");
+        return -1;
+    }
+
+    if (queue >= dev->queue_pairs) {
+        uart_puts("[virtio-net] Invalid TX queue\n");
+        return -1;
+    }
+
+    if (count > 0u && (frames == NULL || lens == NULL)) {
+        uart_puts("[virtio-net] Invalid TX burst\n");
+        return -1;
+    }
+
+    struct virtio_net_txq *txq = &dev->txq[queue];
+    size_t sent = 0u;
+
+    while (sent < count) {
+        uint16_t chunk = (count - sent > txq->size) ? txq->size : (uint16_t)(count - sent);
+        size_t staged = virtio_net_tx_burst(dev, txq, frames + sent, lens + sent, chunk);
+
+        sent += staged;
+        if (staged == chunk) {
+            continue;
+        }
+        /* The frame that stopped the burst takes the single-frame path: jumbo pool, backlog, policy */
+        if (virtio_net_send_frame_offload_queue(dev, queue, frames[sent], lens[sent], NULL) != 0) {
+            break;
+        }
+        sent++;
+    }
+    return (int)sent;
+}
+
+/*
+ * Whether a scatter-gather frame can go out straight from the fragments: the
+ * device must do every requested offload itself (the fragments are not ours
+ * to patch) and TSO needs the L2-L4 headers inside the first fragment.
+ */
+static int virtio_net_tx_sg_direct(struct virtio_net_device *dev, const struct virtio_net_tx_frag *frags,
+                                   size_t total, const struct virtio_net_tx_offload *offload)
+{
+    if (offload == NULL) {
+        return total <= virtio_net_get_max_frame_dev(dev);
+    }
+    if ((offload->flags & VIRTIO_NET_TX_CSUM) != 0u && (dev->offloads & VIRTIO_NET_OFFLOAD_TX_CSUM) == 0u) {
+        return 0;
+    }
+    if ((offload->flags & VIRTIO_NET_TX_TSO4) != 0u &&
+        ((dev->offloads & VIRTIO_NET_OFFLOAD_TX_TSO4) == 0u ||
+         !virtio_net_tx_offload_valid(dev, frags[0].data, frags[0].len, offload))) {
+        return 0;
+    }
+    /* The header check above saw only the first fragment; the sizes apply to the whole frame */
+    return (offload->flags & VIRTIO_NET_TX_TSO4) != 0u ? total <= VIRTIO_NET_MAX_GSO_FRAME_SIZE :
+           total <= virtio_net_get_max_frame_dev(dev);
+}
+
+/*
+ * Emit a frame as the virtio header (in the slot buffer) followed by the
+ * caller's fragments. With indirect descriptors the whole chain lives in a
+ * table in the slot buffer and takes one ring entry; otherwise it is a NEXT
+ * chain of count + 1 ring entries.
+ */
+static int virtio_net_tx_send_sg(struct virtio_net_device *dev, struct virtio_net_txq *txq,
+                                 const struct virtio_net_tx_frag *frags, size_t count,
+                                 const struct virtio_net_tx_offload *offload)
+{
+    struct virtio_queue *queue = &txq->vq;
+    uint16_t descs = (dev->indirect != 0u) ? 1u : (uint16_t)(count + 1u);
+
+    int slot = virtio_net_tx_reserve_wait(dev, txq, 0u, descs);
+    if (slot < 0) {
+        return slot;
+    }
+    uint16_t idx = (uint16_t)slot;
+    uint8_t *buffer = txq->lease_buffer;
+    struct virtio_net_hdr *hdr = (struct virtio_net_hdr *)buffer;
+
+    virtio_net_tx_fill_hdr(dev, hdr, frags[0].data, frags[0].len, offload);
+    for (size_t i = 0u; i < count; ++i) {
+        dma_sync_for_device(queue->dma, frags[i].data, frags[i].len);
+    }
+
+    if (dev->indirect != 0u) {
+        uint8_t *table = buffer + VIRTIO_NET_TX_SG_TABLE_OFFSET;
+        size_t table_len = (count + 1u) * sizeof(struct vring_desc);
+
+        if (queue->packed != 0u) {
+            /* Packed tables are read in order; ids and NEXT are not used */
+            struct vring_packed_desc *entry = (struct vring_packed_desc *)table;
+            entry[0].addr = (uint64_t)(uintptr_t)hdr;
+            entry[0].len = sizeof(*hdr);
+            entry[0].id = 0u;
+            entry[0].flags = 0u;
+            for (size_t i = 0u; i < count; ++i) {
+                entry[i + 1u].addr = (uint64_t)(uintptr_t)frags[i].data;
+                entry[i + 1u].len = (uint32_t)frags[i].len;
+                entry[i + 1u].id = 0u;
+                entry[i + 1u].flags = 0u;
+            }
+        } else {
+            struct vring_desc *entry = (struct vring_desc *)table;
+            for (size_t i = 0u; i <= count; ++i) {
+                entry[i].addr = (i == 0u) ? (uint64_t)(uintptr_t)hdr : (uint64_t)(uintptr_t)frags[i - 1u].data;
+                entry[i].len = (i == 0u) ? (uint32_t)sizeof(*hdr) : (uint32_t)frags[i - 1u].len;
+                entry[i].flags = (i < count) ? VRING_DESC_F_NEXT : 0u;
+                entry[i].next = (i < count) ? (uint16_t)(i + 1u) : 0u;
+            }
+        }
+        dma_sync_for_device(queue->dma, buffer, VIRTIO_NET_TX_SG_TABLE_OFFSET + table_len);
+        virtio_queue_stage(queue, txq->size, idx, (uint64_t)(uintptr_t)table, (uint32_t)table_len,
+                           VRING_DESC_F_INDIRECT);
+    } else {
+        dma_sync_for_device(queue->dma, hdr, sizeof(*hdr));
+        virtio_queue_stage(queue, txq->size, idx, (uint64_t)(uintptr_t)hdr, sizeof(*hdr), VRING_DESC_F_NEXT);
+        for (size_t i = 0u; i < count; ++i) {
+            virtio_queue_stage(queue, txq->size, (uint16_t)((idx + 1u + i) % txq->size),
+                               (uint64_t)(uintptr_t)frags[i].data, (uint32_t)frags[i].len,
+                               (i + 1u < count) ? VRING_DESC_F_NEXT : 0u);
+        }
+    }
+
+    virtio_net_tx_post(dev, txq, 1u);
+    virtio_net_tx_release(dev, txq);
+    txq->sg_frames++;
+    return 0;
+}
+
+/* Fallback: gather the fragments into a TX buffer and send that */
+static int virtio_net_tx_send_linearised(struct virtio_net_device *dev, struct virtio_net_txq *txq,
+                                         const struct virtio_net_tx_frag *frags, size_t count, size_t total,
+                                         const struct virtio_net_tx_offload *offload)
+{
+    int slot = virtio_net_tx_reserve_wait(dev, txq, total, 1u);
+    if (slot < 0) {
+        return slot;
+    }
+
+    uint8_t *frame = txq->lease_buffer + sizeof(struct virtio_net_hdr);
+    size_t offset = 0u;
+    for (size_t i = 0u; i < count; ++i) {
+        util_memcpy(frame + offset, frags[i].data, frags[i].len);
+        offset += frags[i].len;
+    }
+    if (!virtio_net_tx_offload_valid(dev, frame, total, offload) ||
+        virtio_net_tx_needs_segment(dev, offload, total)) {
+        virtio_net_tx_release(dev, txq);
+        uart_puts("[virtio-net] Invalid TX offload or frame length\n");
+        return -1;
+    }
+
+    virtio_net_tx_publish(dev, txq, (uint16_t)slot, total, offload);
+    virtio_net_tx_release(dev, txq);
+    txq->sg_copied++;
+    return 0;
+}
+
+int virtio_net_send_sg_dev(virtio_net_dev_t dev, const struct virtio_net_tx_frag *frags, size_t count,
+                           const struct virtio_net_tx_offload *offload, uint16_t *ticket_out)
+{
+    return virtio_net_send_sg_queue(dev, 0u, frags, count, offload, ticket_out);
+}
+
+int virtio_net_send_sg_queue(virtio_net_dev_t dev, uint16_t queue, const struct virtio_net_tx_frag *frags,
+                             size_t count, const struct virtio_net_tx_offload *offload, uint16_t *ticket_out)
+{
+    if (dev == NULL || !dev->driver_ok) {
+        uart_puts("[virtio-net] Invalid device or driver not initialised\n");
+        return -1;
+    }
+
+    if (queue >= dev->queue_pairs) {
+        uart_puts("[virtio-net] Invalid TX queue\n");
+        return -1;
+    }
+
+    if (frags == NULL || count == 0u || count > VIRTIO_NET_TX_MAX_FRAGS) {
+        uart_puts("[virtio-net] Invalid fragment list\n");
+        return -1;
+    }
+
+    size_t total = 0u;
+    for (size_t i = 0u; i < count; ++i) {
+        if (frags[i].data == NULL || frags[i].len == 0u) {
+            uart_puts("[virtio-net] Invalid fragment list\n");
+            return -1;
+        }
+        total += frags[i].len;
+    }
+
+    struct virtio_net_txq *txq = &dev->txq[queue];
+    int result;
+    if (virtio_net_tx_sg_direct(dev, frags, total, offload)) {
+        if (offload != NULL && (offload->flags & VIRTIO_NET_TX_CSUM) != 0u &&
+            (size_t)offload->csum_start + offload->csum_offset + sizeof(uint16_t) > total) {
+            uart_puts("[virtio-net] Invalid TX offload or frame length\n");
+            return -1;
+        }
+        result = virtio_net_tx_send_sg(dev, txq, frags, count, offload);
+    } else {
+        result = virtio_net_tx_send_linearised(dev, txq, frags, count, total, offload);
+    }
+
+    if (result == 0 && ticket_out != NULL) {
+        *ticket_out = txq->vq.posted;
+    }
+    return result;
+}
+
+int virtio_net_tx_done_queue(virtio_net_dev_t dev, uint16_t queue, uint16_t ticket)
+{
+    if (dev == NULL || !dev->driver_ok || queue >= dev->max_queue_pairs) {
+        return -1;
+    }
+
+    struct virtio_net_txq *txq = &dev->txq[queue];
+    OSSchedLock();
+    virtio_net_tx_claim(txq);
+    (void)virtio_net_tx_reclaim(txq);
+    virtio_net_tx_unclaim(dev, txq);
+    int done = (int16_t)(uint16_t)(txq->vq.used_count - ticket) >= 0;
+    OSSchedUnlock();
+    return done;
+}
+
+int virtio_net_fwd_pool_init(size_t buffers)
+{
+    if (g_fwd_pool.total != 0u) {
+        return (buffers <= g_fwd_pool.total) ? 0 : -1;
+    }
+    if (buffers == 0u || buffers > VIRTIO_NET_FWD_POOL_MAX) {
+        return -1;
+    }
+
+    uint8_t **free_list = dma_alloc(sizeof(uint8_t *) * buffers, sizeof(uint8_t *));
+    uint8_t *storage = dma_alloc((size_t)VIRTIO_NET_RX_BUFFER_SIZE * buffers, VIRTIO_NET_CACHE_LINE);
+    if (free_list == NULL || storage == NULL) {
+        uart_puts("[virtio-net] No DMA memory for the forwarding pool\n");
+        return -1;
+    }
+
+    /* Spares may land in a non-coherent RX ring: nothing dirty may be left in them */
+    util_memset(storage, 0, (size_t)VIRTIO_NET_RX_BUFFER_SIZE * buffers);
+    dma_sync_for_device(DMA_NONCOHERENT, storage, (size_t)VIRTIO_NET_RX_BUFFER_SIZE * buffers);
+    for (size_t i = 0u; i < buffers; ++i) {
+        free_list[i] = storage + i * VIRTIO_NET_RX_BUFFER_SIZE;
+    }
+    g_fwd_pool.free = free_list;
+    g_fwd_pool.count = (uint16_t)buffers;
+    g_fwd_pool.total = (uint16_t)buffers;
+    return 0;
+}
+
+/* A frame can travel in its own RX buffer: single buffer, and no software segmentation on egress */
+static int virtio_net_fwd_direct(struct virtio_net_device *tx_dev, const struct virtio_net_rxq *rxq,
+                                 const struct virtio_net_rx_frame *frame, size_t length,
+                                 const struct virtio_net_tx_offload *offload)
+{
+    if (g_fwd_pool.total == 0u || frame->desc_id >= rxq->size ||
+        frame->data != rxq->buffers[frame->desc_id] + sizeof(struct virtio_net_hdr)) {
+        return 0;
+    }
+    if (virtio_net_tx_needs_segment(tx_dev, offload, length)) {
+        return 0;
+    }
+    return virtio_net_tx_offload_valid(tx_dev, frame->data, length, offload);
+}
+
+int virtio_net_forward_queue(virtio_net_dev_t rx_dev, uint16_t rx_queue, const struct virtio_net_rx_frame *frame,
+                             size_t length, virtio_net_dev_t tx_dev, uint16_t tx_queue,
+                             const struct virtio_net_tx_offload *offload)
+{
+    if (rx_dev == NULL || tx_dev == NULL || !rx_dev->driver_ok || !tx_dev->driver_ok ||
+        rx_queue >= rx_dev->max_queue_pairs || tx_queue >= tx_dev->queue_pairs) {
+        uart_puts("[virtio-net] Invalid forwarding device or queue\n");
+        return -1;
+    }
+    if (frame == NULL || length == 0u || length > frame->len) {
+        uart_puts("[virtio-net] Invalid frame length\n");
+        return -1;
+    }
+
+    struct virtio_net_rxq *rxq = &rx_dev->rxq[rx_queue];
+    struct virtio_net_txq *txq = &tx_dev->txq[tx_queue];
+    uint8_t *spare = NULL;
+    int slot = VIRTIO_NET_EAGAIN;
+
+    if (virtio_net_fwd_direct(tx_dev, rxq, frame, length, offload)) {
+        spare = virtio_net_fwd_pool_get();
+    }
+    if (spare != NULL) {
+        slot = virtio_net_tx_reserve(tx_dev, txq, 0u, 1u);
+        if (slot < 0) {
+            virtio_net_fwd_pool_put(spare);
+        }
+    }
+    if (slot < 0) {
+        /* No spare or no room: the copy path has the backlog and the policy */
+        txq->fwd_copied++;
+        return virtio_net_send_frame_offload_queue(tx_dev, tx_queue, frame->data, length, offload);
+    }
+
+    /* The RX header room in front of the frame becomes its TX header */
+    uint8_t *buffer = rxq->buffers[frame->desc_id];
+    struct virtio_net_hdr *hdr = (struct virtio_net_hdr *)buffer;
+    virtio_net_tx_fill_hdr(tx_dev, hdr, frame->data, length, offload);
+    if (offload != NULL && (offload->flags & VIRTIO_NET_TX_CSUM) != 0u &&
+        (tx_dev->offloads & VIRTIO_NET_OFFLOAD_TX_CSUM) == 0u) {
+        virtio_net_csum_complete(frame->data, length, offload->csum_start, offload->csum_offset);
+    }
+    dma_sync_for_device(txq->vq.dma, buffer, length + sizeof(*hdr));
+    virtio_queue_stage(&txq->vq, txq->size, (uint16_t)slot, (uint64_t)(uintptr_t)buffer,
+                       (uint32_t)(length + sizeof(*hdr)), 0u);
+    txq->loans[slot] = buffer;
+    txq->loans_out++;
+    txq->fwd_frames++;
+    virtio_net_tx_post(tx_dev, txq, 1u);
+    virtio_net_tx_release(tx_dev, txq);
+
+    /* The spare takes the RX slot; release still sees a one-buffer frame there */
+    ((struct virtio_net_hdr *)spare)->num_buffers = 1u;
+    dma_sync_for_device(rxq->vq.dma, spare, VIRTIO_NET_RX_BUFFER_SIZE);
+    rxq->buffers[frame->desc_id] = spare;
+    return 0;
+}
+
+uint8_t *virtio_net_tx_lease_dev(virtio_net_dev_t dev, size_t length)
+{
+    if (dev == NULL || !dev->driver_ok) {
+        uart_puts("[virtio-net] Invalid device or driver not initialised\n");
+        return NULL;
+    }
+
+    size_t limit = virtio_net_get_max_frame_dev(dev);
+    if ((dev->offloads & VIRTIO_NET_OFFLOAD_TX_TSO4) != 0u) {
+        limit = VIRTIO_NET_MAX_GSO_FRAME_SIZE;
+    }
+    if (length == 0u || length > limit) {
+        uart_puts("[virtio-net] Invalid frame length\n");
+        return NULL;
+    }
+
+    struct virtio_net_txq *txq = &dev->txq[0];
+    if (virtio_net_tx_reserve_wait(dev, txq, length, 1u) < 0) {
+        return NULL;
+    }
+    return txq->lease_buffer + sizeof(struct virtio_net_hdr);
+}
+
+int virtio_net_tx_commit_dev(virtio_net_dev_t dev, uint8_t *frame, size_t length)
+{
+    return virtio_net_tx_commit_offload_dev(dev, frame, length, NULL);
+}
+
+int virtio_net_tx_commit_offload_dev(virtio_net_dev_t dev, uint8_t *frame, size_t length,
+                                     const struct virtio_net_tx_offload *offload)
+{
+    if (dev == NULL || dev->txq[0].leased == 0u) {
+        uart_puts("[virtio-net] TX commit without lease\n");
+        return -1;
+    }
+
+    struct virtio_net_txq *txq = &dev->txq[0];
+    uint16_t idx = (uint16_t)(txq->vq.posted % txq->size);
+    if (frame != txq->lease_buffer + sizeof(struct virtio_net_hdr) ||
+        length == 0u || length > txq->lease_capacity ||
+        !virtio_net_tx_offload_valid(dev, frame, length, offload) ||
+        virtio_net_tx_needs_segment(dev, offload, length)) {
+        uart_puts("[virtio-net] Invalid TX commit\n");
+        virtio_net_tx_release(dev, txq);
+        return -1;
+    }
+
+    virtio_net_tx_publish(dev, txq, idx, length, offload);
+    virtio_net_tx_release(dev, txq);
+    return 0;
+}
+
+void virtio_net_tx_abort_dev(virtio_net_dev_t dev)
+{
+    if (dev == NULL || dev->txq[0].leased == 0u) {
+        return;
+    }
+    virtio_net_tx_release(dev, &dev->txq[0]);
+}
+
+void virtio_net_tx_flush_queue(size_t dev_idx, uint16_t queue)
+{
+    if (dev_idx >= g_device_count || queue >= g_devices[dev_idx].queue_pairs) {
+        return;
+    }
+    struct virtio_net_device *dev = &g_devices[dev_idx];
+    struct virtio_net_txq *txq = &dev->txq[queue];
+    OSSchedLock();
+    virtio_net_tx_claim(txq);
+    virtio_net_tx_flush_batch(dev, txq, VIRTIO_NET_TX_FLUSH_EXPLICIT);
+    virtio_net_tx_unclaim(dev, txq);
+    OSSchedUnlock();
+}
+
+void virtio_net_rx_flush_queue(size_t dev_idx, uint16_t queue)
+{
+    if (dev_idx >= g_device_count || queue >= g_devices[dev_idx].max_queue_pairs) {
+        return;
+    }
+    struct virtio_net_device *dev = &g_devices[dev_idx];
+    struct virtio_net_rxq *rxq = &dev->rxq[queue];
+    virtio_net_kick(dev, &rxq->vq, rxq->size, rxq->index);
+}
+
+void virtio_net_tx_flush_dev(size_t dev_idx)
+{
+    if (dev_idx >= g_device_count) {
+        return;
+    }
+    for (uint16_t q = 0u; q < g_devices[dev_idx].queue_pairs; ++q) {
+        virtio_net_tx_flush_queue(dev_idx, q);
+    }
+}
+
+void virtio_net_rx_flush_dev(size_t dev_idx)
+{
+    if (dev_idx >= g_device_count) {
+        return;
+    }
+    for (uint16_t q = 0u; q < g_devices[dev_idx].max_queue_pairs; ++q) {
+        virtio_net_rx_flush_queue(dev_idx, q);
+    }
+}
+
+/* RX buffers a frame spans; the head buffer's header must already be invalidated */
+static uint16_t virtio_net_rx_segments(const struct virtio_net_device *dev, const struct virtio_net_rxq *rxq,
+                                       uint16_t desc_id)
+{
+    if (dev->mrg_rxbuf == 0u) {
+        return 1u;
+    }
+    const struct virtio_net_hdr *hdr = (const struct virtio_net_hdr *)virtio_net_rx_head(rxq, desc_id);
+    uint16_t num_buffers = hdr->num_buffers;
+    return (num_buffers == 0u) ? 1u : num_buffers;
+}
+
+/*
+ * Make the first 'length' bytes of a used buffer readable and return where
+ * they start. In split mode a frame that stayed within its header buffer is
+ * read there; a longer one gets the header buffer copied in front of its
+ * payload, so the frame is contiguous in the payload buffer.
+ */
+static uint8_t *virtio_net_rx_pull(struct virtio_net_rxq *rxq, uint16_t desc_id, size_t length)
+{
+    uint8_t *buffer = rxq->buffers[desc_id];
+
+    if (rxq->split == NULL) {
+        dma_sync_for_cpu(rxq->vq.dma, buffer, length);
+        return buffer;
+    }
+
+    uint8_t *head = virtio_net_rx_split_buffer(rxq, desc_id);
+    dma_sync_for_cpu(rxq->vq.dma, head, VIRTIO_NET_RX_SMALL_SIZE);
+    if (length <= VIRTIO_NET_RX_SMALL_SIZE) {
+        return head;
+    }
+    dma_sync_for_cpu(rxq->vq.dma, buffer + VIRTIO_NET_RX_SMALL_SIZE, length - VIRTIO_NET_RX_SMALL_SIZE);
+    util_memcpy(buffer, head, VIRTIO_NET_RX_SMALL_SIZE);
+    return buffer;
+}
+
+/*
+ * Resolve the frame whose first completion is entry 'pos' of the completion
+ * ring, with 'pending' completions queued from there on. A frame in a single
+ * buffer is returned in place; one spread over several buffers is gathered
+ * into the queue's merge buffer, which only one frame can hold at a time.
+ * Returns the number of completions the frame spans, or 0 if it cannot be
+ * handed out yet (segments still arriving, or the merge buffer is taken).
+ */
+static uint16_t virtio_net_rx_resolve(const struct virtio_net_device *dev, struct virtio_net_rxq *rxq,
+                                      uint16_t pos, size_t pending, int merge_free,
+                                      struct virtio_net_rx_frame *out)
+{
+    const size_t hdr_len = sizeof(struct virtio_net_hdr);
+    const struct rx_completion_entry *entry = &rxq->completions[pos];
+    uint8_t *buffer;
+    uint16_t segments = 1u;
+
+    /* Out-of-range ids were filtered by the ISR; a copied frame is already in CPU memory */
+    if (entry->copied != 0u) {
+        buffer = rxq->small + (size_t)pos * VIRTIO_NET_RX_SMALL_SIZE;
+    } else {
+        buffer = virtio_net_rx_head(rxq, entry->desc_id);
+        dma_sync_for_cpu(rxq->vq.dma, buffer, hdr_len);
+        segments = virtio_net_rx_segments(dev, rxq, entry->desc_id);
+        if (segments > pending) {
+            return 0u;
+        }
+    }
+    const struct virtio_net_hdr *hdr = (const struct virtio_net_hdr *)buffer;
+
+    out->desc_id = entry->desc_id;
+    out->csum = VIRTIO_NET_RX_CSUM_NONE;
+    out->csum_start = 0u;
+    out->csum_offset = 0u;
+    out->gso_size = 0u;
+    if ((hdr->gso_type & (uint8_t)~VIRTIO_NET_HDR_GSO_ECN) == VIRTIO_NET_HDR_GSO_TCPV4) {
+        out->gso_size = hdr->gso_size;
+    }
+    if ((hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) != 0u) {
+        out->csum = VIRTIO_NET_RX_CSUM_PARTIAL;
+        out->csum_start = hdr->csum_start;
+        out->csum_offset = hdr->csum_offset;
+    } else if ((hdr->flags & VIRTIO_NET_HDR_F_DATA_VALID) != 0u) {
+        out->csum = VIRTIO_NET_RX_CSUM_VALID;
+    }
+
+    if (segments == 1u) {
+        size_t payload_len = 0u;
+        if (entry->total_len > hdr_len) {
+            payload_len = entry->total_len - hdr_len;
+            if (payload_len > VIRTIO_NET_RX_BUFFER_SIZE - hdr_len) {
+                payload_len = VIRTIO_NET_RX_BUFFER_SIZE - hdr_len;
+            }
+        }
+        if (entry->copied == 0u) {
+            buffer = virtio_net_rx_pull(rxq, entry->desc_id, hdr_len + payload_len);
+        }
+        out->data = buffer + hdr_len;
+        out->len = payload_len;
+        return 1u;
+    }
+
+    if (!merge_free) {
+        return 0u;
+    }
+
+    /* The header sits only in the first buffer; the rest carry payload from offset 0 */
+    uint8_t *merged = rxq->merge_buffer;
+    size_t merged_len = 0u;
+    for (uint16_t i = 0u; i < segments; ++i) {
+        const struct rx_completion_entry *seg = &rxq->completions[(pos + i) % rxq->size];
+        size_t offset = (i == 0u) ? hdr_len : 0u;
+        size_t seg_len = (seg->total_len > offset) ? seg->total_len - offset : 0u;
+
+        if (seg_len > VIRTIO_NET_RX_BUFFER_SIZE - offset) {
+            seg_len = VIRTIO_NET_RX_BUFFER_SIZE - offset;
+        }
+        if (merged_len + seg_len > rxq->merge_size) {
+            seg_len = rxq->merge_size - merged_len;
+        }
+        if (seg_len == 0u) {
+            continue;
+        }
+
+        uint8_t *src = virtio_net_rx_pull(rxq, seg->desc_id, offset + seg_len) + offset;
+        util_memcpy(merged + merged_len, src, seg_len);
+        merged_len += seg_len;
+    }
+
+    /* Without a merge buffer the frame is longer than anything negotiated: hand it out empty */
+    out->data = (merged != NULL) ? merged : buffer + hdr_len;
+    out->len = merged_len;
+    return segments;
+}
+
+/*
+ * Retire the completions behind 'count' frames (all of each frame's buffers)
+ * and give their descriptors, with any harvest recycled, back to the device
+ * with one publish. Frames must match the head of the completion ring in
+ * order. Only the RX task stages RX descriptors, so nothing here masks
+ * interrupts.
+ */
+static void virtio_net_rx_retire(const struct virtio_net_device *dev, struct virtio_net_rxq *rxq,
+                                 const struct virtio_net_rx_frame *frames, size_t count)
+{
+    struct spsc_ring *ring = &rxq->ring;
+    uint32_t head = spsc_ring_head(ring);
+    uint32_t pending = spsc_ring_count(ring);
+    uint32_t retired = 0u;
+
+    for (size_t i = 0u; i < count; ++i) {
+        const struct rx_completion_entry *entry = &rxq->completions[spsc_ring_slot(ring, head + retired)];
+        if (retired >= pending || entry->desc_id != frames[i].desc_id) {
+            break;
+        }
+        /* A copied frame's buffer is back with the device and may already hold another */
+        uint16_t segments = (entry->copied != 0u) ? 1u : virtio_net_rx_segments(dev, rxq, frames[i].desc_id);
+        if (segments > pending - retired) {
+            break;
+        }
+        for (uint16_t s = 0u; s < segments; ++s) {
+            entry = &rxq->completions[spsc_ring_slot(ring, head + retired)];
+            if (entry->copied == 0u) {
+                virtio_net_rx_post(rxq, entry->desc_id);
+            }
+            retired++;
+        }
+    }
+    spsc_ring_pop(ring, retired);
+    (void)virtio_net_rx_refill(rxq);
+    virtio_queue_publish(&rxq->vq, rxq->size);
+
+    if (retired < count) {
+        uart_puts("[virtio-net] RX release desc_id mismatch\n");
+    }
+}
+
+int virtio_net_poll_frame_dev(virtio_net_dev_t dev, uint8_t *out_frame, size_t *out_length)
+{
+    if (dev == NULL || !dev->driver_ok) {
+        return -1;
+    }
+
+    size_t payload_len = 0u;
+    uint16_t desc_id;
+    const uint8_t *frame = virtio_net_peek_rx_buffer_dev(dev, &payload_len, &desc_id);
+    if (frame == NULL) {
+        return 0;
+    }
+
+    /* Copy-out callers size their buffers for standard frames */
+    if (payload_len > VIRTIO_NET_MAX_FRAME_SIZE) {
+        payload_len = VIRTIO_NET_MAX_FRAME_SIZE;
+    }
+
+    if (out_frame != NULL && out_length != NULL) {
+        util_memcpy(out_frame, frame, payload_len);
+        *out_length = payload_len;
+    } else if (out_length != NULL) {
+        *out_length = 0u;
+    }
+
+    virtio_net_release_rx_buffer_dev(dev, desc_id);
+
+    return (payload_len > 0u) ? 1 : 0;
+}
+
+const uint8_t *virtio_net_peek_rx_buffer_dev(virtio_net_dev_t dev, size_t *out_len, uint16_t *out_desc_id)
+{
+    if (dev == NULL || !dev->driver_ok || out_len == NULL || out_desc_id == NULL) {
+        return NULL;
+    }
+
+    struct virtio_net_rxq *rxq = &dev->rxq[0];
+
+    if (virtio_net_rx_service(dev, rxq) != 0) {
+        return NULL;
+    }
+    virtio_net_rx_replenish(dev, rxq);
+
+    uint32_t pending = spsc_ring_count(&rxq->ring);
+    if (pending == 0u) {
+        return NULL;
+    }
+
+    struct virtio_net_rx_frame frame;
+    uint16_t head = (uint16_t)spsc_ring_slot(&rxq->ring, spsc_ring_head(&rxq->ring));
+    if (virtio_net_rx_resolve(dev, rxq, head, pending, 1, &frame) == 0u) {
+        return NULL;
     }
 
-    g_device_count = 1u;
-    g_dev = &g_devices[0];
+    /* Callers of the single-frame API do not see checksum state: finish partial sums here */
+    if (frame.csum == VIRTIO_NET_RX_CSUM_PARTIAL &&
+        (size_t)frame.csum_start + frame.csum_offset + sizeof(uint16_t) <= frame.len) {
+        virtio_net_csum_complete(frame.data, frame.len, frame.csum_start, frame.csum_offset);
+        if (frame.data != rxq->merge_buffer) {
+            /* Completed where the frame lies: a second peek must not sum again */
+            struct virtio_net_hdr *hdr = (struct virtio_net_hdr *)(frame.data - sizeof(struct virtio_net_hdr));
+            hdr->flags = VIRTIO_NET_HDR_F_DATA_VALID;
+            dma_sync_for_device(rxq->vq.dma, hdr, sizeof(*hdr));
+            dma_sync_for_device(rxq->vq.dma, frame.data + frame.csum_start + frame.csum_offset, sizeof(uint16_t));
+        }
+    }
 
-    return 0;
+    *out_len = frame.len;
+    *out_desc_id = frame.desc_id;
+    return frame.data;
 }
 
-virtio_net_dev_t virtio_net_get_device(size_t index)
+void virtio_net_release_rx_buffer_dev(virtio_net_dev_t dev, uint16_t desc_id)
 {
-    if (index >= g_device_count) {
-        return NULL;
+    if (dev == NULL || !dev->driver_ok) {
+        return;
     }
-    return &g_devices[index];
+
+    struct virtio_net_rx_frame frame;
+    frame.data = NULL;
+    frame.len = 0u;
+    frame.desc_id = desc_id;
+    virtio_net_rx_retire(dev, &dev->rxq[0], &frame, 1u);
 }
 
-size_t virtio_net_get_device_count(void)
+const uint8_t *virtio_net_get_mac_dev(virtio_net_dev_t dev)
 {
-    return g_device_count;
+    if (dev == NULL) {
+        return NULL;
+    }
+    return dev->mac;
 }
 
-int virtio_net_send_frame_dev(virtio_net_dev_t dev, const uint8_t *frame, size_t length)
+int virtio_net_set_mtu_dev(virtio_net_dev_t dev, uint16_t mtu)
 {
     if (dev == NULL || !dev->driver_ok) {
-        uart_puts("[virtio-net] Invalid device or driver not initialised\n");
         return -1;
     }
 
-    if (length == 0u || length > VIRTIO_NET_MAX_FRAME_SIZE || frame == NULL) {
-        uart_puts("[virtio-net] Invalid frame length\n");
+    if (mtu < VIRTIO_NET_MIN_MTU || mtu > dev->mtu_max) {
+        uart_puts("[virtio-net] MTU out of range\n");
         return -1;
     }
 
-    struct virtio_queue *queue = dev->tx_queue;
-    struct vring_used *used = queue->used;
-    struct vring_avail *avail = queue->avail;
-    struct vring_desc *desc = queue->desc;
-    uint16_t in_flight, available_slots;
-
-    /* Check and update completed TX descriptors */
-    cache_invalidate_range(used, sizeof(*used));
-    dev->tx_last_used = used->idx;
+    dev->mtu = mtu;
+    return 0;
+}
 
-    /* Calculate in-flight packets (handle wrap-around) */
-    in_flight = (uint16_t)((avail->idx - dev->tx_last_used) & 0xFFFFu);
-    available_slots = (uint16_t)(dev->tx_queue_size - in_flight);
-
-    /* If queue is critically full, poll for completions before giving up */
-    if (available_slots < 4u) {
-        uint16_t retries = 0u;
-        while (available_slots < 4u && retries < 100u) {
-            /* Force check the used ring again */
-            cache_invalidate_range(used, sizeof(*used));
-            dev->tx_last_used = used->idx;
-            in_flight = (uint16_t)((avail->idx - dev->tx_last_used) & 0xFFFFu);
-            available_slots = (uint16_t)(dev->tx_queue_size - in_flight);
-
-            if (available_slots >= 4u) {
-                break;
-            }
+uint16_t virtio_net_get_mtu_dev(virtio_net_dev_t dev)
+{
+    if (dev == NULL) {
+        return 0u;
+    }
+    return dev->mtu;
+}
 
-            retries++;
-            /* Small delay to let device process */
-            if (retries % 10u == 0u) {
-                /* Re-read used index to catch any completions */
-                cache_invalidate_range(used, sizeof(*used));
-                dev->tx_last_used = used->idx;
-                in_flight = (uint16_t)((avail->idx - dev->tx_last_used) & 0xFFFFu);
-                available_slots = (uint16_t)(dev->tx_queue_size - in_flight);
-            }
-        }
+size_t virtio_net_get_max_frame_dev(virtio_net_dev_t dev)
+{
+    if (dev == NULL) {
+        return 0u;
+    }
+    return (size_t)dev->mtu + VIRTIO_NET_FRAME_OVERHEAD;
+}
 
-        if (available_slots < 2u) {
-            uart_puts("[virtio-net] TX queue full\n");
-            return -1;
-        }
+uint32_t virtio_net_get_offloads_dev(virtio_net_dev_t dev)
+{
+    if (dev == NULL) {
+        return 0u;
     }
+    return dev->offloads;
+}
 
-    uint16_t idx = (uint16_t)(avail->idx % dev->tx_queue_size);
-    uint8_t *buffer = dev->tx_buffers[idx];
-    struct virtio_net_hdr *hdr = (struct virtio_net_hdr *)buffer;
+size_t virtio_net_rx_burst_dev(virtio_net_dev_t dev, struct virtio_net_rx_frame *frames, size_t max_frames)
+{
+    return virtio_net_rx_burst_queue(dev, 0u, frames, max_frames);
+}
 
-    util_memset(hdr, 0, sizeof(*hdr));
-    util_memcpy(buffer + sizeof(*hdr), frame, length);
-    cache_clean_range(buffer, length + sizeof(*hdr));
+void virtio_net_rx_release_burst_dev(virtio_net_dev_t dev, const struct virtio_net_rx_frame *frames, size_t count)
+{
+    virtio_net_rx_release_burst_queue(dev, 0u, frames, count);
+}
 
-    desc[idx].addr = (uint64_t)(uintptr_t)buffer;
-    desc[idx].len = (uint32_t)(length + sizeof(*hdr));
-    desc[idx].flags = 0u;
-    desc[idx].next = 0u;
-    cache_clean_range(&desc[idx], sizeof(desc[idx]));
+size_t virtio_net_rx_burst_queue(virtio_net_dev_t dev, uint16_t queue,
+                                 struct virtio_net_rx_frame *frames, size_t max_frames)
+{
+    if (dev == NULL || !dev->driver_ok || frames == NULL || max_frames == 0u ||
+        queue >= dev->max_queue_pairs) {
+        return 0u;
+    }
 
-    avail->ring[idx] = idx;
-    avail->idx++;
-    cache_clean_range(&avail->ring[idx], sizeof(avail->ring[idx]));
-    cache_clean_range(&avail->idx, sizeof(avail->idx));
+    struct virtio_net_rxq *rxq = &dev->rxq[queue];
 
-    dev->tx_batch_count++;
-    if (dev->tx_batch_count >= VIRTIO_NET_TX_BATCH_SIZE) {
-        virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_NOTIFY, VIRTIO_NET_TX_QUEUE);
-        dev->tx_batch_count = 0u;
+    if (virtio_net_rx_service(dev, rxq) != 0) {
+        return 0u;
     }
+    virtio_net_rx_replenish(dev, rxq);
+
+    /* Snapshot the queued completions; they stay queued until released */
+    uint32_t pending = spsc_ring_count(&rxq->ring);
+    uint16_t head = (uint16_t)spsc_ring_slot(&rxq->ring, spsc_ring_head(&rxq->ring));
+    size_t count = 0u;
+    int merge_free = 1;
+    while (count < max_frames && pending > 0u) {
+        uint16_t segments = virtio_net_rx_resolve(dev, rxq, head, pending, merge_free, &frames[count]);
+        if (segments == 0u) {
+            break;
+        }
+        if (segments > 1u) {
+            merge_free = 0;
+        }
+        count++;
 
-    return 0;
+        head = (uint16_t)((head + segments) % rxq->size);
+        pending -= segments;
+    }
+
+    return count;
 }
 
-void virtio_net_tx_flush_dev(size_t dev_idx)
+void virtio_net_rx_release_burst_queue(virtio_net_dev_t dev, uint16_t queue,
+                                       const struct virtio_net_rx_frame *frames, size_t count)
 {
-    if (dev_idx >= g_device_count) {
+    if (dev == NULL || !dev->driver_ok || frames == NULL || count == 0u ||
+        queue >= dev->max_queue_pairs) {
         return;
     }
-    struct virtio_net_device *dev = &g_devices[dev_idx];
-    if (dev->tx_batch_count > 0u) {
-        virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_NOTIFY, VIRTIO_NET_TX_QUEUE);
-        dev->tx_batch_count = 0u;
-    }
+
+    virtio_net_rx_retire(dev, &dev->rxq[queue], frames, count);
 }
 
-void virtio_net_rx_flush_dev(size_t dev_idx)
+uint16_t virtio_net_get_queue_pairs_dev(virtio_net_dev_t dev)
 {
-    if (dev_idx >= VIRTIO_NET_MAX_DEVICES) {
-        return;
-    }
-    struct virtio_net_device *dev = &g_devices[dev_idx];
     if (dev == NULL) {
-        return;
+        return 0u;
     }
-    virtio_reg_write(dev, VIRTIO_MMIO_QUEUE_NOTIFY, VIRTIO_NET_RX_QUEUE);
+    return dev->queue_pairs;
 }
 
-int virtio_net_poll_frame_dev(virtio_net_dev_t dev, uint8_t *out_frame, size_t *out_length)
+uint16_t virtio_net_select_queue_dev(virtio_net_dev_t dev, uint32_t flow_hash)
 {
-    if (dev == NULL || !dev->driver_ok) {
+    if (dev == NULL || dev->queue_pairs <= 1u) {
+        return 0u;
+    }
+    return (uint16_t)(flow_hash % dev->queue_pairs);
+}
+
+/*
+ * Issue one control-queue command and wait for the device's ack. The chain is
+ * header (class, cmd), optional data, then a one-byte ack the device writes.
+ * Commands are rare and the device answers them from the notify itself, so the
+ * used ring is polled with the scheduler locked rather than taking interrupts.
+ */
+static int virtio_net_ctrl_cmd(struct virtio_net_device *dev, uint8_t class, uint8_t cmd,
+                               const void *data, size_t length)
+{
+    if (dev->ctrl_size == 0u) {
+        uart_puts("[virtio-net] No control queue\n");
+        return -1;
+    }
+    if (length > VIRTIO_NET_CTRL_DATA_MAX) {
+        uart_puts("[virtio-net] Control command too long\n");
         return -1;
     }
 
-    /* Find device index */
-    size_t dev_idx = 0u;
-    for (dev_idx = 0u; dev_idx < g_device_count; ++dev_idx) {
-        if (&g_devices[dev_idx] == dev) {
-            break;
-        }
+    OSSchedLock();
+    struct virtio_queue *queue = &dev->ctrl;
+    uint8_t *buffer = dev->ctrl_buffer;
+    struct virtio_net_ctrl_hdr *hdr = (struct virtio_net_ctrl_hdr *)buffer;
+    uint8_t *payload = buffer + sizeof(*hdr);
+    volatile uint8_t *ack = buffer + VIRTIO_NET_CTRL_ACK_OFFSET;
+    /* The chain starts where the last one ended: VIRTIO_F_IN_ORDER wants descriptors in ring order */
+    uint16_t first = (uint16_t)(queue->posted % dev->ctrl_size);
+    uint16_t next = (uint16_t)((first + 1u) % dev->ctrl_size);
+
+    hdr->class = class;
+    hdr->cmd = cmd;
+    if (length > 0u) {
+        util_memcpy(payload, data, length);
     }
-    if (dev_idx >= g_device_count) {
+    *ack = 0xFFu;
+    dma_sync_for_device(queue->dma, buffer, VIRTIO_NET_CTRL_BUFFER_SIZE);
+
+    /* Consecutive descriptors form the chain (a packed ring files it all under the first id) */
+    virtio_queue_stage(queue, dev->ctrl_size, first, (uint64_t)(uintptr_t)hdr, sizeof(*hdr), VRING_DESC_F_NEXT);
+    if (length > 0u) {
+        virtio_queue_stage(queue, dev->ctrl_size, next, (uint64_t)(uintptr_t)payload,
+                           (uint32_t)length, VRING_DESC_F_NEXT);
+        next = (uint16_t)((next + 1u) % dev->ctrl_size);
+    }
+    virtio_queue_stage(queue, dev->ctrl_size, next, (uint64_t)(uintptr_t)ack, 1u, VRING_DESC_F_WRITE);
+    virtio_queue_publish(queue, dev->ctrl_size);
+    virtio_net_notify(dev, queue, dev->ctrl_index);
+    queue->kicks++;
+
+    uint32_t polls = 0u;
+    int done;
+    do {
+        done = virtio_queue_has_used(queue, dev->ctrl_size);
+    } while (!done && ++polls < VIRTIO_NET_CTRL_POLL_LIMIT);
+
+    if (!done) {
+        /* The chain is still the device's; never reuse it */
+        dev->ctrl_size = 0u;
+        OSSchedUnlock();
+        uart_puts("[virtio-net] Control command timed out\n");
         return -1;
     }
+    uint16_t used_id;
+    uint32_t used_len;
+    (void)virtio_queue_get_used(queue, dev->ctrl_size, &used_id, &used_len);
 
-    OS_CPU_SR cpu_sr;
-    uint16_t desc_id;
-    uint32_t total_len;
+    dma_sync_for_cpu(queue->dma, (void *)ack, 1u);
+    uint8_t status = *ack;
+    OSSchedUnlock();
 
-    OS_ENTER_CRITICAL();
-    if (g_rx_completion_count[dev_idx] == 0u) {
-        OS_EXIT_CRITICAL();
-        return 0;
+    return (status == VIRTIO_NET_OK) ? 0 : -1;
+}
+
+int virtio_net_set_queue_pairs_dev(virtio_net_dev_t dev, uint16_t pairs)
+{
+    if (dev == NULL || !dev->driver_ok || pairs == 0u) {
+        return -1;
     }
 
-    desc_id = g_rx_completions[dev_idx][g_rx_completion_head[dev_idx]].desc_id;
-    total_len = g_rx_completions[dev_idx][g_rx_completion_head[dev_idx]].total_len;
-    g_rx_completion_head[dev_idx] = (uint16_t)((g_rx_completion_head[dev_idx] + 1u) % dev->rx_queue_size);
-    g_rx_completion_count[dev_idx]--;
-    OS_EXIT_CRITICAL();
+    if (pairs > dev->max_queue_pairs) {
+        pairs = dev->max_queue_pairs;
+    }
+    if (pairs == dev->queue_pairs || dev->mq == 0u) {
+        return (int)dev->queue_pairs;
+    }
 
-    if (desc_id >= dev->rx_queue_size) {
-        uart_puts("[virtio-net] RX completion descriptor out of range\n");
+    uint16_t value = pairs;
+    if (virtio_net_ctrl_cmd(dev, VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET,
+                            &value, sizeof(value)) != 0) {
+        uart_puts("[virtio-net] VQ_PAIRS_SET rejected, staying on ");
+        uart_write_dec(dev->queue_pairs);
+        uart_puts(" queue pair(s)\n");
         return -1;
     }
 
-    size_t payload_len = 0u;
-    if (total_len > sizeof(struct virtio_net_hdr)) {
-        payload_len = total_len - sizeof(struct virtio_net_hdr);
-        if (payload_len > VIRTIO_NET_MAX_FRAME_SIZE) {
-            payload_len = VIRTIO_NET_MAX_FRAME_SIZE;
-        }
+    dev->queue_pairs = pairs;
+    uart_puts("[virtio-net] Steering across ");
+    uart_write_dec(pairs);
+    uart_puts(" queue pairs\n");
+    return (int)pairs;
+}
+
+int virtio_net_set_rx_mode_dev(virtio_net_dev_t dev, uint8_t mode)
+{
+    static const uint8_t cmds[] = {
+        VIRTIO_NET_CTRL_RX_PROMISC, VIRTIO_NET_CTRL_RX_ALLMULTI, VIRTIO_NET_CTRL_RX_ALLUNI,
+        VIRTIO_NET_CTRL_RX_NOMULTI, VIRTIO_NET_CTRL_RX_NOUNI, VIRTIO_NET_CTRL_RX_NOBCAST
+    };
 
-        cache_invalidate_range(dev->rx_buffers[desc_id], total_len);
+    if (dev == NULL || !dev->driver_ok) {
+        return -1;
+    }
+    if ((mode & (uint8_t)~dev->ctrl_rx) != 0u) {
+        uart_puts("[virtio-net] RX mode not supported by device\n");
+        return -1;
+    }
 
-        if (out_frame != NULL && out_length != NULL) {
-            util_memcpy(out_frame,
-                        dev->rx_buffers[desc_id] + sizeof(struct virtio_net_hdr),
-                        payload_len);
-            *out_length = payload_len;
+    /* One command per switch, and only for the ones that change */
+    for (uint8_t i = 0u; i < (uint8_t)sizeof(cmds); ++i) {
+        uint8_t bit = (uint8_t)(1u << i);
+        if ((dev->ctrl_rx & bit) == 0u || ((dev->rx_mode ^ mode) & bit) == 0u) {
+            continue;
         }
-    } else {
-        if (out_length != NULL) {
-            *out_length = 0u;
+        uint8_t on = (uint8_t)((mode & bit) != 0u);
+        if (virtio_net_ctrl_cmd(dev, VIRTIO_NET_CTRL_RX, cmds[i], &on, sizeof(on)) != 0) {
+            uart_puts("[virtio-net] RX mode command rejected\n");
+            return -1;
         }
+        dev->rx_mode = (uint8_t)((dev->rx_mode & (uint8_t)~bit) | (mode & bit));
     }
+    return 0;
+}
 
-    struct vring_avail *avail = dev->rx_queue->avail;
-    uint16_t avail_slot = (uint16_t)(avail->idx % dev->rx_queue_size);
-    avail->ring[avail_slot] = desc_id;
-    cache_clean_range(&avail->ring[avail_slot], sizeof(avail->ring[avail_slot]));
-    avail->idx++;
-    cache_clean_range(&avail->idx, sizeof(avail->idx));
+int virtio_net_set_mac_filter_dev(virtio_net_dev_t dev, const uint8_t (*unicast)[6], size_t unicast_count,
+                                  const uint8_t (*multicast)[6], size_t multicast_count)
+{
+    /* Two tables, each a 32-bit entry count followed by its addresses */
+    uint8_t table[VIRTIO_NET_CTRL_DATA_MAX];
+    size_t length = 2u * sizeof(uint32_t) + (unicast_count + multicast_count) * 6u;
 
-    return (payload_len > 0u) ? 1 : 0;
+    if (dev == NULL || !dev->driver_ok || dev->ctrl_rx == 0u) {
+        return -1;
+    }
+    if (unicast_count + multicast_count > VIRTIO_NET_MAC_FILTER_MAX || length > sizeof(table)) {
+        uart_puts("[virtio-net] MAC filter table too large\n");
+        return -1;
+    }
+
+    uint32_t entries = (uint32_t)unicast_count;
+    uint8_t *cursor = table;
+    util_memcpy(cursor, &entries, sizeof(entries));
+    cursor += sizeof(entries);
+    for (size_t i = 0u; i < unicast_count; ++i, cursor += 6u) {
+        util_memcpy(cursor, unicast[i], 6u);
+    }
+    entries = (uint32_t)multicast_count;
+    util_memcpy(cursor, &entries, sizeof(entries));
+    cursor += sizeof(entries);
+    for (size_t i = 0u; i < multicast_count; ++i, cursor += 6u) {
+        util_memcpy(cursor, multicast[i], 6u);
+    }
+
+    if (virtio_net_ctrl_cmd(dev, VIRTIO_NET_CTRL_MAC, VIRTIO_NET_CTRL_MAC_TABLE_SET, table, length) != 0) {
+        uart_puts("[virtio-net] MAC table rejected\n");
+        return -1;
+    }
+    return 0;
 }
 
-const uint8_t *virtio_net_peek_rx_buffer_dev(virtio_net_dev_t dev, size_t *out_len, uint16_t *out_desc_id)
+int virtio_net_set_vlan_filter_dev(virtio_net_dev_t dev, uint16_t vid, uint8_t enable)
 {
-    if (dev == NULL || !dev->driver_ok || out_len == NULL || out_desc_id == NULL) {
-        return NULL;
+    if (dev == NULL || !dev->driver_ok || dev->ctrl_vlan == 0u || vid >= 4096u) {
+        return -1;
     }
 
-    /* Find device index */
-    size_t dev_idx = 0u;
-    for (dev_idx = 0u; dev_idx < g_device_count; ++dev_idx) {
-        if (&g_devices[dev_idx] == dev) {
-            break;
-        }
+    uint16_t value = vid;
+    if (virtio_net_ctrl_cmd(dev, VIRTIO_NET_CTRL_VLAN,
+                            (enable != 0u) ? VIRTIO_NET_CTRL_VLAN_ADD : VIRTIO_NET_CTRL_VLAN_DEL,
+                            &value, sizeof(value)) != 0) {
+        uart_puts("[virtio-net] VLAN filter command rejected\n");
+        return -1;
     }
-    if (dev_idx >= g_device_count) {
-        return NULL;
+    return 0;
+}
+
+int virtio_net_set_napi_dev(virtio_net_dev_t dev, uint8_t enable, uint16_t budget)
+{
+    if (dev == NULL || !dev->driver_ok) {
+        return -1;
     }
 
+    /* The scheduler lock defers the semaphore posts of the drain below */
     OS_CPU_SR cpu_sr;
-    uint16_t desc_id;
-    uint32_t total_len;
-
+    OSSchedLock();
     OS_ENTER_CRITICAL();
-    if (g_rx_completion_count[dev_idx] == 0u) {
-        OS_EXIT_CRITICAL();
-        return NULL;
+    dev->napi_budget = (budget != 0u) ? budget : VIRTIO_NET_NAPI_BUDGET;
+    dev->napi = (uint8_t)(enable != 0u);
+    if (dev->napi == 0u) {
+        /* Back to interrupt mode: unmask polled queues and queue what they hold */
+        for (uint16_t q = 0u; q < dev->max_queue_pairs; ++q) {
+            struct virtio_net_rxq *rxq = &dev->rxq[q];
+            if (rxq->polling != 0u) {
+                rxq->polling = 0u;
+                virtio_queue_enable_irq(&rxq->vq, rxq->size, dev->event_idx);
+                virtio_net_handle_rx_used(dev, rxq);
+            }
+        }
     }
+    OS_EXIT_CRITICAL();
+    OSSchedUnlock();
+
+    uart_puts(dev->napi != 0u ? "[virtio-net] NAPI RX polling on, budget " : "[virtio-net] NAPI RX polling off, budget ");
+    uart_write_dec(dev->napi_budget);
+    uart_putc('\n');
+    return 0;
+}
 
-    desc_id = g_rx_completions[dev_idx][g_rx_completion_head[dev_idx]].desc_id;
-    total_len = g_rx_completions[dev_idx][g_rx_completion_head[dev_idx]].total_len;
+int virtio_net_set_rx_copybreak_dev(virtio_net_dev_t dev, size_t bytes)
+{
+    if (dev == NULL || bytes > VIRTIO_NET_RX_COPYBREAK_MAX) {
+        return -1;
+    }
+    /* Read by the harvest under the same critical section */
+    OS_CPU_SR cpu_sr;
+    OS_ENTER_CRITICAL();
+    for (uint16_t q = 0u; q < VIRTIO_NET_MAX_QUEUE_PAIRS; ++q) {
+        dev->rxq[q].copybreak = (uint16_t)bytes;
+    }
     OS_EXIT_CRITICAL();
+    return 0;
+}
 
-    if (desc_id >= dev->rx_queue_size) {
-        return NULL;
+int virtio_net_set_tx_policy_dev(virtio_net_dev_t dev, uint8_t policy, uint16_t block_ms)
+{
+    if (dev == NULL || !dev->driver_ok || policy > VIRTIO_NET_TX_POLICY_EAGAIN) {
+        return -1;
     }
 
-    size_t payload_len = 0u;
-    if (total_len > sizeof(struct virtio_net_hdr)) {
-        payload_len = total_len - sizeof(struct virtio_net_hdr);
-        if (payload_len > VIRTIO_NET_MAX_FRAME_SIZE) {
-            payload_len = VIRTIO_NET_MAX_FRAME_SIZE;
+    if (policy == VIRTIO_NET_TX_POLICY_BLOCK && dev->tx_sem == NULL) {
+        dev->tx_sem = OSSemCreate(0u);
+        if (dev->tx_sem == NULL) {
+            uart_puts("[virtio-net] Failed to create TX semaphore\n");
+            return -1;
         }
-        cache_invalidate_range(dev->rx_buffers[desc_id], total_len);
     }
-
-    *out_len = payload_len;
-    *out_desc_id = desc_id;
-    return dev->rx_buffers[desc_id] + sizeof(struct virtio_net_hdr);
+    dev->tx_block_ms = (block_ms != 0u) ? block_ms : VIRTIO_NET_TX_BLOCK_MS;
+    dev->tx_policy = policy;
+    return 0;
 }
 
-void virtio_net_release_rx_buffer_dev(virtio_net_dev_t dev, uint16_t desc_id)
+int virtio_net_set_tx_coalesce_dev(virtio_net_dev_t dev, uint32_t deadline_us, uint16_t max_batch)
 {
     if (dev == NULL || !dev->driver_ok) {
-        return;
+        return -1;
     }
 
-    /* Find device index */
-    size_t dev_idx = 0u;
-    for (dev_idx = 0u; dev_idx < g_device_count; ++dev_idx) {
-        if (&g_devices[dev_idx] == dev) {
-            break;
-        }
+    if (max_batch == 0u || max_batch > VIRTIO_NET_TX_BATCH_MAX) {
+        max_batch = VIRTIO_NET_TX_BATCH_MAX;
     }
-    if (dev_idx >= g_device_count) {
-        return;
+    OSSchedLock();
+    dev->tx_deadline = virtio_net_us_to_counts((deadline_us != 0u) ? deadline_us : VIRTIO_NET_TX_DEADLINE_US);
+    for (uint16_t q = 0u; q < dev->max_queue_pairs; ++q) {
+        struct virtio_net_txq *txq = &dev->txq[q];
+        txq->batch_max = (uint16_t)((max_batch < txq->size / 2u) ? max_batch : txq->size / 2u);
+        if (txq->batch_max == 0u) {
+            txq->batch_max = 1u;
+        }
+        if (txq->batch_limit > txq->batch_max) {
+            txq->batch_limit = txq->batch_max;
+        }
     }
+    OSSchedUnlock();
+    return 0;
+}
 
-    OS_CPU_SR cpu_sr;
-
-    OS_ENTER_CRITICAL();
-    if (g_rx_completion_count[dev_idx] == 0u) {
-        OS_EXIT_CRITICAL();
-        return;
-    }
-    /* Verify the head matches the released descriptor */
-    uint16_t head_desc_id = g_rx_completions[dev_idx][g_rx_completion_head[dev_idx]].desc_id;
-    if (head_desc_id != desc_id) {
-        OS_EXIT_CRITICAL();
-        uart_puts("[virtio-net] RX release desc_id mismatch\n");
-        return;
+int virtio_net_get_stats_dev(virtio_net_dev_t dev, struct virtio_net_stats *out)
+{
+    if (dev == NULL || out == NULL || !dev->driver_ok) {
+        return -1;
     }
-    g_rx_completion_head[dev_idx] = (uint16_t)((g_rx_completion_head[dev_idx] + 1u) % dev->rx_queue_size);
-    g_rx_completion_count[dev_idx]--;
-    OS_EXIT_CRITICAL();
 
-    struct vring_avail *avail = dev->rx_queue->avail;
-    uint16_t avail_slot = (uint16_t)(avail->idx % dev->rx_queue_size);
-    avail->ring[avail_slot] = desc_id;
-    cache_clean_range(&avail->ring[avail_slot], sizeof(avail->ring[avail_slot]));
-    avail->idx++;
-    cache_clean_range(&avail->idx, sizeof(avail->idx));
+    util_memset(out, 0, sizeof(*out));
+    for (uint16_t q = 0u; q < dev->max_queue_pairs; ++q) {
+        out->rx_kicks += dev->rxq[q].vq.kicks;
+        out->rx_kicks_suppressed += dev->rxq[q].vq.kicks_suppressed;
+        out->tx_kicks += dev->txq[q].vq.kicks;
+        out->tx_kicks_suppressed += dev->txq[q].vq.kicks_suppressed;
+        out->rx_completions += dev->rxq[q].completed;
+        out->tx_completions += dev->txq[q].completed;
+        out->rx_ring_lines += dev->rxq[q].vq.ring_lines;
+        out->rx_used_reads += dev->rxq[q].vq.used_reads;
+        out->tx_used_reads += dev->txq[q].vq.used_reads;
+        out->tx_ring_lines += dev->txq[q].vq.ring_lines;
+        out->rx_polls += dev->rxq[q].polls;
+        out->rx_budget_exhausted += dev->rxq[q].budget_exhausted;
+        out->rx_copybreaks += dev->rxq[q].copybreaks;
+        out->tx_backlog += dev->txq[q].backlog_count;
+        if (dev->txq[q].backlog_max > out->tx_backlog_max) {
+            out->tx_backlog_max = dev->txq[q].backlog_max;
+        }
+        out->tx_drops += dev->txq[q].drops;
+        out->tx_eagain += dev->txq[q].eagain;
+        out->tx_blocked += dev->txq[q].blocked;
+        out->tx_sg_frames += dev->txq[q].sg_frames;
+        out->tx_sg_copied += dev->txq[q].sg_copied;
+        out->fwd_frames += dev->txq[q].fwd_frames;
+        out->fwd_copied += dev->txq[q].fwd_copied;
+        out->tx_bursts += dev->txq[q].bursts;
+        out->tx_burst_frames += dev->txq[q].burst_frames;
+        for (uint32_t r = 0u; r < VIRTIO_NET_TX_FLUSH_REASONS; ++r) {
+            out->tx_flushes[r] += dev->txq[q].flushes[r];
+        }
+        for (uint32_t b = 0u; b < VIRTIO_NET_TX_BATCH_BUCKETS; ++b) {
+            out->tx_batch_hist[b] += dev->txq[q].batch_hist[b];
+        }
+    }
+    out->tx_batch_limit = dev->txq[0].batch_limit;
+    out->fwd_pool_free = g_fwd_pool.count;
+    out->tx_deadline_us = (uint32_t)(((uint64_t)dev->tx_deadline * 1000000u) / timer_cntfrq());
+    out->irqs = dev->irq_count;
+    out->rx_ring_size = dev->rxq[0].size;
+    out->tx_ring_size = dev->txq[0].size;
+    out->dma_bytes = (uint32_t)dev->dma_bytes;
+    out->packed_ring = dev->packed;
+    out->in_order = dev->in_order;
+    out->napi = dev->napi;
+    out->dma_coherent = (uint8_t)(dev->dma_coherency == DMA_COHERENT);
+    out->rx_mode = dev->rx_mode;
+    out->rx_filter = (uint8_t)(dev->ctrl_rx != 0u);
+    out->rx_copybreak = dev->rxq[0].copybreak;
+    out->rx_split = dev->rx_split;
+
+    uint32_t completions = out->rx_completions + out->tx_completions;
+    out->irqs_suppressed = (completions > out->irqs) ? (completions - out->irqs) : 0u;
+    return 0;
 }
 
-const uint8_t *virtio_net_get_mac_dev(virtio_net_dev_t dev)
+void virtio_net_dump_stats_dev(virtio_net_dev_t dev)
 {
-    if (dev == NULL) {
-        return NULL;
+    struct virtio_net_stats stats;
+
+    if (virtio_net_get_stats_dev(dev, &stats) != 0) {
+        return;
+    }
+
+    uart_puts("[virtio-net] rings RX ");
+    uart_write_dec(stats.rx_ring_size);
+    uart_puts(" TX ");
+    uart_write_dec(stats.tx_ring_size);
+    uart_puts(", ");
+    uart_write_dec(stats.dma_bytes / 1024u);
+    uart_puts(stats.dma_coherent != 0u ? " KB DMA (coherent)\n" : " KB DMA (non-coherent)\n");
+    uart_puts("[virtio-net] kicks RX ");
+    uart_write_dec(stats.rx_kicks);
+    uart_puts(" (suppressed ");
+    uart_write_dec(stats.rx_kicks_suppressed);
+    uart_puts("), TX ");
+    uart_write_dec(stats.tx_kicks);
+    uart_puts(" (suppressed ");
+    uart_write_dec(stats.tx_kicks_suppressed);
+    uart_puts(")\n");
+    uart_puts("[virtio-net] irqs ");
+    uart_write_dec(stats.irqs);
+    uart_puts(" for ");
+    uart_write_dec(stats.rx_completions);
+    uart_puts(" RX + ");
+    uart_write_dec(stats.tx_completions);
+    uart_puts(" TX completions (suppressed ");
+    uart_write_dec(stats.irqs_suppressed);
+    uart_puts(")\n");
+    if (stats.rx_filter != 0u) {
+        uart_puts("[virtio-net] host RX filter on");
+        uart_puts((stats.rx_mode & VIRTIO_NET_RX_MODE_PROMISC) != 0u ? ", promiscuous" : "");
+        uart_puts((stats.rx_mode & VIRTIO_NET_RX_MODE_ALLMULTI) != 0u ? ", all multicast" : "");
+        uart_putc('\n');
+    }
+    uart_puts(stats.packed_ring != 0u ? "[virtio-net] packed" : "[virtio-net] split");
+    uart_puts(" ring cache lines RX ");
+    uart_write_dec(stats.rx_ring_lines);
+    uart_puts(", TX ");
+    uart_write_dec(stats.tx_ring_lines);
+    uart_putc('\n');
+    if (stats.packed_ring == 0u) {
+        uart_puts(stats.in_order != 0u ? "[virtio-net] in-order used index reads RX " :
+                                         "[virtio-net] used index reads RX ");
+        uart_write_dec(stats.rx_used_reads);
+        uart_puts(", TX ");
+        uart_write_dec(stats.tx_used_reads);
+        uart_putc('\n');
+    }
+    if (stats.napi != 0u || stats.rx_polls != 0u) {
+        uart_puts("[virtio-net] NAPI polls ");
+        uart_write_dec(stats.rx_polls);
+        uart_puts(" (budget exhausted ");
+        uart_write_dec(stats.rx_budget_exhausted);
+        uart_puts("), RX completions per irq ");
+        uart_write_dec((stats.irqs != 0u) ? stats.rx_completions / stats.irqs : stats.rx_completions);
+        uart_putc('\n');
+    }
+    if (stats.rx_copybreaks != 0u || stats.rx_split != 0u) {
+        uart_puts("[virtio-net] RX copy-break ");
+        uart_write_dec(stats.rx_copybreaks);
+        uart_puts(" frames (up to ");
+        uart_write_dec(stats.rx_copybreak);
+        uart_puts(stats.rx_split != 0u ? " bytes), header split on\n" : " bytes)\n");
+    }
+    if (stats.tx_backlog_max + stats.tx_drops + stats.tx_eagain + stats.tx_blocked != 0u) {
+        uart_puts("[virtio-net] TX backlog ");
+        uart_write_dec(stats.tx_backlog);
+        uart_puts(" (max ");
+        uart_write_dec(stats.tx_backlog_max);
+        uart_puts("), drops ");
+        uart_write_dec(stats.tx_drops);
+        uart_puts(", EAGAIN ");
+        uart_write_dec(stats.tx_eagain);
+        uart_puts(", blocked ");
+        uart_write_dec(stats.tx_blocked);
+        uart_putc('\n');
+    }
+    uart_puts("[virtio-net] TX batches: full ");
+    uart_write_dec(stats.tx_flushes[VIRTIO_NET_TX_FLUSH_BATCH]);
+    uart_puts(", deadline ");
+    uart_write_dec(stats.tx_flushes[VIRTIO_NET_TX_FLUSH_DEADLINE]);
+    uart_puts(", flush ");
+    uart_write_dec(stats.tx_flushes[VIRTIO_NET_TX_FLUSH_EXPLICIT]);
+    uart_puts(", backlog ");
+    uart_write_dec(stats.tx_flushes[VIRTIO_NET_TX_FLUSH_BACKLOG]);
+    uart_puts("; limit ");
+    uart_write_dec(stats.tx_batch_limit);
+    uart_puts(", deadline ");
+    uart_write_dec(stats.tx_deadline_us);
+    uart_puts(" us\n[virtio-net] TX batch sizes 1/2/4/8/16/32/64+:");
+    for (uint32_t b = 0u; b < VIRTIO_NET_TX_BATCH_BUCKETS; ++b) {
+        uart_putc(' ');
+        uart_write_dec(stats.tx_batch_hist[b]);
+    }
+    uart_putc('\n');
+    if (stats.tx_bursts != 0u) {
+        uart_puts("[virtio-net] TX bursts ");
+        uart_write_dec(stats.tx_bursts);
+        uart_puts(" carrying ");
+        uart_write_dec(stats.tx_burst_frames);
+        uart_puts(" frames\n");
+    }
+    if (stats.fwd_frames + stats.fwd_copied != 0u) {
+        uart_puts("[virtio-net] forwarded TX zero-copy ");
+        uart_write_dec(stats.fwd_frames);
+        uart_puts(", copied ");
+        uart_write_dec(stats.fwd_copied);
+        uart_puts(", spare buffers ");
+        uart_write_dec(stats.fwd_pool_free);
+        uart_putc('\n');
+    }
+    if (stats.tx_sg_frames + stats.tx_sg_copied != 0u) {
+        uart_puts("[virtio-net] scatter-gather TX ");
+        uart_write_dec(stats.tx_sg_frames);
+        uart_puts(" (linearised ");
+        uart_write_dec(stats.tx_sg_copied);
+        uart_puts(")\n");
     }
-    return dev->mac;
 }
 
 void virtio_net_enable_interrupts_dev(virtio_net_dev_t dev)
@@ -958,28 +4467,29 @@ int virtio_net_has_pending_rx_dev(virtio_net_dev_t dev)
         return 0;
     }
 
-    size_t dev_idx = 0u;
-    for (dev_idx = 0u; dev_idx < g_device_count; ++dev_idx) {
-        if (&g_devices[dev_idx] == dev) {
-            break;
+    for (uint16_t q = 0u; q < dev->max_queue_pairs; ++q) {
+        if (spsc_ring_count(&dev->rxq[q].ring) > 0u || dev->rxq[q].polling != 0u) {
+            return 1;
         }
     }
-    if (dev_idx >= g_device_count) {
-        return 0;
-    }
-
-    return (g_rx_completion_count[dev_idx] > 0u) ? 1 : 0;
+    return 0;
 }
 
 INT8U virtio_net_wait_rx_dev(virtio_net_dev_t dev, INT16U timeout_ms)
 {
-    if (dev == NULL) {
+    return virtio_net_wait_rx_queue(dev, 0u, timeout_ms);
+}
+
+INT8U virtio_net_wait_rx_queue(virtio_net_dev_t dev, uint16_t queue, INT16U timeout_ms)
+{
+    if (dev == NULL || queue >= dev->max_queue_pairs) {
         return OS_ERR_PEVENT_NULL;
     }
 
-    if (dev->rx_sem == NULL) {
+    struct virtio_net_rxq *rxq = &dev->rxq[queue];
+    if (rxq->sem == NULL) {
         if (timeout_ms == 0u) {
-            while (!virtio_net_has_pending_rx_dev(dev)) {
+            while (spsc_ring_count(&rxq->ring) == 0u && rxq->polling == 0u) {
                 OSTimeDly(1u);
             }
             return OS_ERR_NONE;
@@ -992,7 +4502,7 @@ INT8U virtio_net_wait_rx_dev(virtio_net_dev_t dev, INT16U timeout_ms)
         }
 
         while ((OSTimeGet() - start) < timeout_ticks) {
-            if (virtio_net_has_pending_rx_dev(dev)) {
+            if (spsc_ring_count(&rxq->ring) > 0u || rxq->polling != 0u) {
                 return OS_ERR_NONE;
             }
             OSTimeDly(1u);
@@ -1002,7 +4512,7 @@ INT8U virtio_net_wait_rx_dev(virtio_net_dev_t dev, INT16U timeout_ms)
 
     INT8U err;
     INT32U ticks = virtio_ms_to_ticks(timeout_ms);
-    OSSemPend(dev->rx_sem, ticks, &err);
+    OSSemPend(rxq->sem, ticks, &err);
     return err;
 }
 
@@ -1100,25 +4610,18 @@ void virtio_net_debug_dump_status(void)
 
     uint32_t interrupt_status = virtio_reg_read(g_dev, VIRTIO_MMIO_INTERRUPT_STATUS);
     log_status("[virtio-net] INTERRUPT_STATUS", interrupt_status);
+
+    virtio_net_dump_stats_dev(g_dev);
 }
 
-/* VirtIO network interrupt handler */
-void virtio_net_interrupt_handler(uint32_t int_id)
+/* VirtIO network interrupt handler, registered with the device as its context */
+static void virtio_net_isr(uint32_t int_id, void *p_arg)
 {
+    struct virtio_net_device *dev = (struct virtio_net_device *)p_arg;
     uint32_t interrupt_status;
-    size_t dev_idx;
-    struct virtio_net_device *dev = NULL;
-
-    /* Find which device triggered the interrupt based on IRQ number.
-     * Scan all slots (not just g_device_count) because the interrupt can fire
-     * during device init before g_device_count is incremented by the caller. */
-    for (dev_idx = 0u; dev_idx < VIRTIO_NET_MAX_DEVICES; ++dev_idx) {
-        if (g_devices[dev_idx].irq == int_id) {
-            dev = &g_devices[dev_idx];
-            break;
-        }
-    }
 
+    (void)int_id;
+    /* A device being re-initialised has driver_ok clear until it is ready again */
     if (dev == NULL || !dev->driver_ok) {
         return;
     }
@@ -1127,23 +4630,58 @@ void virtio_net_interrupt_handler(uint32_t int_id)
     interrupt_status = virtio_reg_read(dev, VIRTIO_MMIO_INTERRUPT_STATUS);
 
     if (interrupt_status & 0x1u) {  /* Used buffer notification */
-        if (dev->tx_queue != NULL) {
-            cache_invalidate_range(dev->tx_queue->used, sizeof(*dev->tx_queue->used));
-            dev->tx_last_used = dev->tx_queue->used->idx;
+        /* TX completions are reaped by the sender; the ISR only drains a backlog */
+        dev->irq_count++;
+        for (uint16_t q = 0u; q < dev->max_queue_pairs; ++q) {
+            virtio_net_handle_rx_used(dev, &dev->rxq[q]);
+            virtio_net_tx_irq(dev, &dev->txq[q]);
         }
-
-        virtio_net_handle_rx_used(dev, dev_idx);
     }
 
     /* Acknowledge interrupt */
     virtio_reg_write(dev, VIRTIO_MMIO_INTERRUPT_ACK, interrupt_status);
 }
 
+/*
+ * virtio-pci: each data virtqueue has its own MSI-X vector, and vector n
+ * belongs to virtqueue n, so the LPI alone names the queue. Nothing is read
+ * from or acknowledged on the device.
+ */
+static void virtio_net_msix_isr(uint32_t int_id, void *p_arg)
+{
+    struct virtio_net_device *dev = (struct virtio_net_device *)p_arg;
+
+    if (dev == NULL || !dev->driver_ok) {
+        return;
+    }
+
+    uint32_t vq = int_id - dev->msix_lpi;
+    uint16_t pair = (uint16_t)(vq / 2u);
+    if (pair >= dev->max_queue_pairs) {
+        return;
+    }
+    dev->irq_count++;
+    if ((vq & 1u) == 0u) {
+        virtio_net_handle_rx_used(dev, &dev->rxq[pair]);
+    } else {
+        virtio_net_tx_irq(dev, &dev->txq[pair]);
+    }
+}
+
+void virtio_net_interrupt_handler(uint32_t int_id)
+{
+    uint32_t slot = int_id - VIRTIO_NET_DEFAULT_IRQ;
+
+    if (int_id >= VIRTIO_NET_DEFAULT_IRQ && slot < VIRTIO_NET_MMIO_TRANSPORTS) {
+        virtio_net_isr(int_id, g_irq_devices[slot]);
+    }
+}
+
 /* Check if there are pending RX packets */
 int virtio_net_has_pending_rx(void)
 {
     for (size_t i = 0u; i < g_device_count; ++i) {
-        if (g_rx_completion_count[i] > 0u) {
+        if (virtio_net_has_pending_rx_dev(&g_devices[i])) {
             return 1;
         }
     }
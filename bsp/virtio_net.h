@@ -11,17 +11,186 @@
 /* SPI interrupt base used by QEMU for VirtIO devices */
 #define VIRTIO_NET_DEFAULT_IRQ         48u
 
+/* QEMU virt: transport n sits at base + n * stride and raises IRQ 48 + n */
+#define VIRTIO_NET_MMIO_STRIDE         0x200u
+#define VIRTIO_NET_MMIO_TRANSPORTS     32u
+
 #define VIRTIO_NET_MAX_FRAME_SIZE      1518u
 
-/* Maximum number of VirtIO network devices supported */
-#define VIRTIO_NET_MAX_DEVICES         2u
+/* MTU range; MTUs above the default need mergeable RX buffers (VIRTIO_NET_F_MRG_RXBUF) */
+#define VIRTIO_NET_MIN_MTU             68u
+#define VIRTIO_NET_DEFAULT_MTU         1500u
+#define VIRTIO_NET_MAX_MTU             9000u
+
+/* Ethernet header plus one VLAN tag on top of the MTU */
+#define VIRTIO_NET_FRAME_OVERHEAD      18u
+#define VIRTIO_NET_MAX_JUMBO_FRAME_SIZE (VIRTIO_NET_MAX_MTU + VIRTIO_NET_FRAME_OVERHEAD)
+
+/* Largest TSO super-frame: a 64 KB IPv4 datagram */
+#define VIRTIO_NET_MAX_GSO_FRAME_SIZE  (65535u + VIRTIO_NET_FRAME_OVERHEAD)
+
+/* Maximum number of VirtIO network devices supported: one per virtio-mmio transport */
+#define VIRTIO_NET_MAX_DEVICES         VIRTIO_NET_MMIO_TRANSPORTS
+
+/* Queue pairs per device (VIRTIO_NET_F_MQ); each pair carries its own rings and buffers */
+#define VIRTIO_NET_MAX_QUEUE_PAIRS     2u
+
+/* Ring depths accepted by virtio_net_set_queue_size(); MIN leaves room for a full scatter-gather chain */
+#define VIRTIO_NET_QUEUE_SIZE_DEFAULT  256u
+#define VIRTIO_NET_QUEUE_SIZE_MIN      16u
+#define VIRTIO_NET_QUEUE_SIZE_MAX      1024u
 
 /* Device handle type */
 typedef struct virtio_net_device* virtio_net_dev_t;
 
+/* Offloads reported by virtio_net_get_offloads_dev() */
+#define VIRTIO_NET_OFFLOAD_TX_CSUM     0x01u  /* device completes partial TX checksums (VIRTIO_NET_F_CSUM) */
+#define VIRTIO_NET_OFFLOAD_RX_CSUM     0x02u  /* device reports RX checksum state (VIRTIO_NET_F_GUEST_CSUM) */
+#define VIRTIO_NET_OFFLOAD_TX_TSO4     0x04u  /* device segments TCPv4 super-frames (VIRTIO_NET_F_HOST_TSO4) */
+#define VIRTIO_NET_OFFLOAD_RX_TSO4     0x08u  /* device may deliver TCPv4 super-frames (VIRTIO_NET_F_GUEST_TSO4) */
+
+/* Checksum state of a received frame */
+#define VIRTIO_NET_RX_CSUM_NONE        0u  /* not checked by the device */
+#define VIRTIO_NET_RX_CSUM_VALID       1u  /* L4 checksum verified by the device */
+#define VIRTIO_NET_RX_CSUM_PARTIAL     2u  /* L4 checksum field holds only the pseudo-header sum */
+
+/* One received frame as handed out by virtio_net_rx_burst_dev() */
+struct virtio_net_rx_frame {
+    uint8_t *data;          /* Ethernet frame in the RX (or merge) buffer, may be rewritten in place */
+    size_t len;             /* Frame length, 0 for a runt that only needs releasing */
+    uint16_t desc_id;       /* RX descriptor to hand back on release */
+    uint8_t csum;           /* VIRTIO_NET_RX_CSUM_* */
+    uint16_t csum_start;    /* PARTIAL: checksummed data starts here (offset into data) */
+    uint16_t csum_offset;   /* PARTIAL: checksum field offset from csum_start */
+    uint16_t gso_size;      /* nonzero: TCPv4 super-frame to be segmented at this MSS on egress */
+};
+
+/* TX offload flags */
+#define VIRTIO_NET_TX_CSUM             0x01u  /* complete the checksum described by csum_start/csum_offset */
+#define VIRTIO_NET_TX_TSO4             0x02u  /* segment a TCPv4 super-frame at gso_size (needs TX_CSUM) */
+
+/*
+ * Per-frame TX offload request. With VIRTIO_NET_TX_CSUM the checksum field
+ * must hold the pseudo-header sum (not complemented); the device completes it,
+ * or the driver does in software when VIRTIO_NET_F_CSUM was not negotiated.
+ * With VIRTIO_NET_TX_TSO4 a frame above the MTU is segmented by the device,
+ * or by the driver when VIRTIO_NET_F_HOST_TSO4 was not negotiated.
+ */
+struct virtio_net_tx_offload {
+    uint8_t flags;          /* VIRTIO_NET_TX_* */
+    uint16_t csum_start;    /* offset into the frame where checksumming starts */
+    uint16_t csum_offset;   /* checksum field offset from csum_start */
+    uint16_t gso_size;      /* TSO4: TCP payload bytes per segment */
+};
+
+/*
+ * TX backpressure. A frame that finds its TX ring full is copied into a small
+ * per-queue software queue, drained from the TX completion interrupt. Only
+ * when that is full too does the device's policy apply.
+ */
+#define VIRTIO_NET_TX_POLICY_DROP      0u  /* tail-drop the new frame (default) */
+#define VIRTIO_NET_TX_POLICY_BLOCK     1u  /* sleep on a semaphore until there is room */
+#define VIRTIO_NET_TX_POLICY_EAGAIN    2u  /* return VIRTIO_NET_EAGAIN; the caller retries */
+
+/* Send result under VIRTIO_NET_TX_POLICY_EAGAIN: nothing was queued, try again later */
+#define VIRTIO_NET_EAGAIN              (-2)
+
+/*
+ * TX doorbell coalescing. Each TX queue notifies the device once it holds as
+ * many unnotified frames as are expected to arrive within the deadline at the
+ * current send rate (1 when sending slowly, so lone frames go out at once),
+ * and a one-shot timer notifies whatever is left when the deadline expires.
+ */
+#define VIRTIO_NET_TX_DEADLINE_US      50u   /* default longest wait of an unnotified frame */
+#define VIRTIO_NET_TX_BATCH_MAX        64u   /* default and largest batch limit */
+
+/* Why a TX batch was notified, indexing virtio_net_stats.tx_flushes */
+#define VIRTIO_NET_TX_FLUSH_BATCH      0u  /* batch reached the adaptive limit */
+#define VIRTIO_NET_TX_FLUSH_DEADLINE   1u  /* deadline timer expired */
+#define VIRTIO_NET_TX_FLUSH_EXPLICIT   2u  /* virtio_net_tx_flush_dev/queue() */
+#define VIRTIO_NET_TX_FLUSH_BACKLOG    3u  /* backlog frames moved into the ring */
+#define VIRTIO_NET_TX_FLUSH_REASONS    4u
+
+/* Batch size histogram buckets: 1, 2-3, 4-7, 8-15, 16-31, 32-63, 64 and up */
+#define VIRTIO_NET_TX_BATCH_BUCKETS    7u
+
+/* Host-side RX filter switches for virtio_net_set_rx_mode_dev() */
+#define VIRTIO_NET_RX_MODE_PROMISC     0x01u  /* accept every frame (device default) */
+#define VIRTIO_NET_RX_MODE_ALLMULTI    0x02u  /* accept every multicast frame */
+#define VIRTIO_NET_RX_MODE_ALLUNI      0x04u  /* accept every unicast frame (needs CTRL_RX_EXTRA) */
+#define VIRTIO_NET_RX_MODE_NOMULTI     0x08u  /* drop all multicast (needs CTRL_RX_EXTRA) */
+#define VIRTIO_NET_RX_MODE_NOUNI       0x10u  /* drop all unicast (needs CTRL_RX_EXTRA) */
+#define VIRTIO_NET_RX_MODE_NOBCAST     0x20u  /* drop broadcast (needs CTRL_RX_EXTRA) */
+
+/* Extra unicast plus multicast addresses one MAC filter table can hold */
+#define VIRTIO_NET_MAC_FILTER_MAX      30u
+
+/* One piece of a scatter-gather TX frame */
+struct virtio_net_tx_frag {
+    const uint8_t *data;
+    size_t len;
+};
+
+#define VIRTIO_NET_TX_MAX_FRAGS        8u
+
+/* Per-device notification and interrupt counters */
+struct virtio_net_stats {
+    uint32_t rx_kicks;              /* RX QUEUE_NOTIFY writes issued */
+    uint32_t rx_kicks_suppressed;   /* RX notifies skipped (device did not ask) */
+    uint32_t tx_kicks;              /* TX QUEUE_NOTIFY writes issued */
+    uint32_t tx_kicks_suppressed;   /* TX notifies skipped (device did not ask) */
+    uint32_t irqs;                  /* used-buffer interrupts taken */
+    uint32_t rx_completions;        /* RX used elements consumed */
+    uint32_t tx_completions;        /* TX used elements reclaimed */
+    uint32_t irqs_suppressed;       /* completions that did not raise their own interrupt */
+    uint32_t rx_ring_lines;         /* cache lines cleaned/invalidated on RX ring memory */
+    uint32_t tx_ring_lines;         /* cache lines cleaned/invalidated on TX ring memory */
+    uint32_t rx_polls;              /* NAPI: interrupts that handed an RX queue to its task */
+    uint32_t rx_budget_exhausted;   /* NAPI: polls that used their whole budget */
+    uint32_t rx_used_reads;         /* split ring: RX used->idx reads */
+    uint32_t tx_used_reads;         /* split ring: TX used->idx reads */
+    uint32_t rx_copybreaks;         /* RX frames copied out and their buffer reposted at harvest */
+    uint32_t tx_backlog;            /* frames in the software TX queues now */
+    uint32_t tx_backlog_max;        /* deepest any software TX queue has been */
+    uint32_t tx_drops;              /* frames dropped: backlog full (tail-drop) or block timed out */
+    uint32_t tx_eagain;             /* sends refused with VIRTIO_NET_EAGAIN */
+    uint32_t tx_blocked;            /* times a sender slept waiting for room */
+    uint32_t tx_sg_frames;          /* scatter-gather frames sent without copying */
+    uint32_t tx_sg_copied;          /* scatter-gather frames that had to be linearised */
+    uint32_t fwd_frames;            /* frames sent from another device's RX buffer (zero-copy) */
+    uint32_t fwd_copied;            /* forwarded frames that had to be copied */
+    uint32_t tx_bursts;             /* virtio_net_send_burst_queue() batches staged together */
+    uint32_t tx_burst_frames;       /* frames those batches carried */
+    uint32_t fwd_pool_free;         /* spare forwarding buffers available (shared by all devices) */
+    uint32_t dma_bytes;             /* DMA arena memory behind the rings and buffers */
+    uint32_t tx_flushes[VIRTIO_NET_TX_FLUSH_REASONS];       /* TX batches notified, by reason */
+    uint32_t tx_batch_hist[VIRTIO_NET_TX_BATCH_BUCKETS];    /* TX batches notified, by size */
+    uint32_t tx_deadline_us;        /* TX coalescing deadline */
+    uint16_t tx_batch_limit;        /* current adaptive batch limit of TX queue 0 */
+    uint16_t rx_copybreak;          /* copy-break threshold in bytes, 0 when off */
+    uint16_t rx_ring_size;          /* RX ring depth in use */
+    uint16_t tx_ring_size;          /* TX ring depth in use */
+    uint8_t packed_ring;            /* rings use the packed layout (VIRTIO_F_RING_PACKED) */
+    uint8_t in_order;               /* buffers are used in the order posted (VIRTIO_F_IN_ORDER) */
+    uint8_t napi;                   /* RX runs in NAPI polling mode */
+    uint8_t dma_coherent;           /* rings and buffers are handed over without cache maintenance */
+    uint8_t rx_filter;              /* device filters RX on the host (VIRTIO_NET_F_CTRL_RX) */
+    uint8_t rx_mode;                /* VIRTIO_NET_RX_MODE_* in effect */
+    uint8_t rx_split;               /* RX header split in use */
+};
+
 /* Initialize and discover all VirtIO network devices */
 int virtio_net_init_all(void);
 
+/*
+ * Also probe the virtio-pci functions on bus 0 of this PCIe ECAM window
+ * (PCI_ECAM_BASE on QEMU virt with highmem=off) after the virtio-mmio
+ * transports. Each data virtqueue of a PCI device gets its own MSI-X vector,
+ * delivered as an LPI through the GICv3 ITS. Set before init; 0 (default)
+ * keeps to virtio-mmio.
+ */
+void virtio_net_set_pci_ecam(uintptr_t ecam);
+
 /* Legacy single-device init (initializes device 0) */
 int virtio_net_init(uintptr_t base_addr, uint32_t irq);
 
@@ -31,8 +200,33 @@ virtio_net_dev_t virtio_net_get_device(size_t index);
 /* Get number of initialized devices */
 size_t virtio_net_get_device_count(void);
 
+/*
+ * Ring depths for device 'index' (0 keeps VIRTIO_NET_QUEUE_SIZE_DEFAULT), taken
+ * by the next init. The device's QUEUE_NUM_MAX caps them and they round down to
+ * a power of two; rings and buffers come from the DMA arena at that size.
+ */
+int virtio_net_set_queue_size(size_t index, uint16_t rx_size, uint16_t tx_size);
+
+/*
+ * DMA coherency policy for device 'index', taken by the next init. AUTO (the
+ * default) trusts the platform (DMA_PLATFORM_COHERENCY in dma.h, coherent on
+ * QEMU virt) unless the device negotiates VIRTIO_F_ACCESS_PLATFORM; a
+ * coherent device skips all cache maintenance and keeps only the barriers.
+ */
+#define VIRTIO_NET_DMA_AUTO            0u
+#define VIRTIO_NET_DMA_COHERENT        1u
+#define VIRTIO_NET_DMA_NONCOHERENT     2u
+
+int virtio_net_set_dma_policy(size_t index, uint8_t policy);
+
+/* Index of a device handle, the inverse of virtio_net_get_device() */
+size_t virtio_net_get_index_dev(virtio_net_dev_t dev);
+
 /* Device-specific operations */
 int virtio_net_send_frame_dev(virtio_net_dev_t dev, const uint8_t *frame, size_t length);
+int virtio_net_send_frame_offload_dev(virtio_net_dev_t dev, const uint8_t *frame, size_t length,
+                                      const struct virtio_net_tx_offload *offload);
+uint32_t virtio_net_get_offloads_dev(virtio_net_dev_t dev);
 int virtio_net_poll_frame_dev(virtio_net_dev_t dev, uint8_t *out_frame, size_t *out_length);
 const uint8_t *virtio_net_get_mac_dev(virtio_net_dev_t dev);
 void virtio_net_enable_interrupts_dev(virtio_net_dev_t dev);
@@ -41,9 +235,176 @@ INT8U virtio_net_wait_rx_dev(virtio_net_dev_t dev, uint16_t timeout_ms);
 INT8U virtio_net_wait_rx_any(uint16_t timeout_ms);
 void virtio_net_tx_flush_dev(size_t dev_idx);
 void virtio_net_rx_flush_dev(size_t dev_idx);
+
+/* Runtime MTU, bounded by what the device negotiated; frames may be MTU + 18 bytes */
+int virtio_net_set_mtu_dev(virtio_net_dev_t dev, uint16_t mtu);
+uint16_t virtio_net_get_mtu_dev(virtio_net_dev_t dev);
+size_t virtio_net_get_max_frame_dev(virtio_net_dev_t dev);
+
+/*
+ * In-place TX: lease a TX buffer with room for 'length' frame bytes (pointer
+ * just past the virtio header), build the frame there, then commit it with its
+ * final length (at most 'length') or abort. At most one lease per device is
+ * outstanding and the scheduler is locked while it is held, so keep the build
+ * short and do not block in between.
+ */
+uint8_t *virtio_net_tx_lease_dev(virtio_net_dev_t dev, size_t length);
+int virtio_net_tx_commit_dev(virtio_net_dev_t dev, uint8_t *frame, size_t length);
+int virtio_net_tx_commit_offload_dev(virtio_net_dev_t dev, uint8_t *frame, size_t length,
+                                     const struct virtio_net_tx_offload *offload);
+void virtio_net_tx_abort_dev(virtio_net_dev_t dev);
+
 const uint8_t *virtio_net_peek_rx_buffer_dev(virtio_net_dev_t dev, size_t *out_len, uint16_t *out_desc_id);
 void virtio_net_release_rx_buffer_dev(virtio_net_dev_t dev, uint16_t desc_id);
 
+/*
+ * Burst RX: collect up to max_frames completed frames from the queue's
+ * lock-free completion ring, then return them all with a single avail->idx
+ * publish. Only one task may consume a given queue. Frames must
+ * be released in the order they were returned. A frame spread over several
+ * mergeable buffers is gathered into a per-device merge buffer, so a burst
+ * holds at most one such frame.
+ */
+size_t virtio_net_rx_burst_dev(virtio_net_dev_t dev, struct virtio_net_rx_frame *frames, size_t max_frames);
+void virtio_net_rx_release_burst_dev(virtio_net_dev_t dev, const struct virtio_net_rx_frame *frames, size_t count);
+
+/*
+ * Multiqueue: a device starts on one queue pair; virtio_net_set_queue_pairs_dev()
+ * asks it (through the control queue) to steer across up to 'pairs', capped by
+ * what it offers and VIRTIO_NET_MAX_QUEUE_PAIRS, and returns the pair count in
+ * effect. The _dev calls above use pair 0. Each queue has its own completion
+ * ring and semaphore, so one task per RX queue can drain it without sharing
+ * state with the others. The device steers a flow's RX to the queue its TX was
+ * last seen on, so sending a flow on virtio_net_select_queue_dev(flow hash)
+ * keeps both directions on one queue index.
+ */
+int virtio_net_set_queue_pairs_dev(virtio_net_dev_t dev, uint16_t pairs);
+uint16_t virtio_net_get_queue_pairs_dev(virtio_net_dev_t dev);
+uint16_t virtio_net_select_queue_dev(virtio_net_dev_t dev, uint32_t flow_hash);
+int virtio_net_send_frame_offload_queue(virtio_net_dev_t dev, uint16_t queue, const uint8_t *frame,
+                                        size_t length, const struct virtio_net_tx_offload *offload);
+size_t virtio_net_rx_burst_queue(virtio_net_dev_t dev, uint16_t queue,
+                                 struct virtio_net_rx_frame *frames, size_t max_frames);
+void virtio_net_rx_release_burst_queue(virtio_net_dev_t dev, uint16_t queue,
+                                       const struct virtio_net_rx_frame *frames, size_t count);
+INT8U virtio_net_wait_rx_queue(virtio_net_dev_t dev, uint16_t queue, uint16_t timeout_ms);
+void virtio_net_tx_flush_queue(size_t dev_idx, uint16_t queue);
+void virtio_net_rx_flush_queue(size_t dev_idx, uint16_t queue);
+
+/*
+ * Scatter-gather TX: send the concatenation of up to VIRTIO_NET_TX_MAX_FRAGS
+ * fragments (e.g. rebuilt headers plus a payload still sitting in an RX
+ * buffer) without copying them. The device reads the fragments after the call
+ * returns, so they must stay unchanged until virtio_net_tx_done_queue()
+ * reports the ticket complete (within 32768 descriptors of the send). With
+ * VIRTIO_F_INDIRECT_DESC the frame takes one ring entry, otherwise a chain of
+ * count + 1. Offloads the device cannot do, or TSO headers not contained in
+ * the first fragment, make the driver copy the fragments into a TX buffer.
+ */
+int virtio_net_send_sg_dev(virtio_net_dev_t dev, const struct virtio_net_tx_frag *frags, size_t count,
+                           const struct virtio_net_tx_offload *offload, uint16_t *ticket_out);
+int virtio_net_send_sg_queue(virtio_net_dev_t dev, uint16_t queue, const struct virtio_net_tx_frag *frags,
+                             size_t count, const struct virtio_net_tx_offload *offload, uint16_t *ticket_out);
+int virtio_net_tx_done_queue(virtio_net_dev_t dev, uint16_t queue, uint16_t ticket);
+
+/*
+ * Burst TX: copy frames[0..count) (lens[i] bytes each, no offloads) into
+ * consecutive TX slots with one reclaim, one descriptor and avail clean, one
+ * avail->idx publish and one notify decision for the lot. A frame too large
+ * for a slot, or one that finds the ring full, goes through the
+ * single-frame path (jumbo pool, backlog, backpressure policy) and the burst
+ * carries on after it. Returns how many frames were accepted, in order;
+ * fewer than 'count' means the policy refused frames[result]. -1 on a bad
+ * device or queue.
+ */
+int virtio_net_send_burst_dev(virtio_net_dev_t dev, const uint8_t *const *frames, const size_t *lens,
+                              size_t count);
+int virtio_net_send_burst_queue(virtio_net_dev_t dev, uint16_t queue, const uint8_t *const *frames,
+                                const size_t *lens, size_t count);
+
+/*
+ * Zero-copy forwarding. virtio_net_forward_queue() sends a frame received on
+ * rx_dev/rx_queue (rewritten in place, 'length' bytes from frame->data) on
+ * tx_dev/tx_queue by posting its RX buffer as the TX descriptor. A spare
+ * from the shared pool takes over the RX slot, and the buffer becomes a
+ * spare once the TX completes. The frame is released with rx_release_burst
+ * afterwards as usual. Frames spread over several RX buffers, frames the
+ * egress device would need segmented in software, an empty pool or a full
+ * TX ring fall back to the copying send path. The pool is set up once, from
+ * the DMA arena, after the devices; buffers in flight when a device is
+ * initialised again are lost to the pool.
+ */
+#define VIRTIO_NET_FWD_POOL_MAX        1024u
+
+int virtio_net_fwd_pool_init(size_t buffers);
+int virtio_net_forward_queue(virtio_net_dev_t rx_dev, uint16_t rx_queue, const struct virtio_net_rx_frame *frame,
+                             size_t length, virtio_net_dev_t tx_dev, uint16_t tx_queue,
+                             const struct virtio_net_tx_offload *offload);
+
+/*
+ * NAPI-style RX: with 'enable' set, a used-buffer interrupt masks its queue
+ * and only wakes the queue's task. The RX calls (rx_burst, peek, poll_frame)
+ * then harvest up to 'budget' completions per wake-up (0 selects the default)
+ * and unmask the queue once the ring is empty. A poll that uses its whole
+ * budget returns no frames once, after the harvested ones, so the task goes
+ * back through its refill/flush/wait step (its semaphore is already posted).
+ * Off by default; compare irqs with rx_completions to tune the budget.
+ */
+int virtio_net_set_napi_dev(virtio_net_dev_t dev, uint8_t enable, uint16_t budget);
+
+/*
+ * RX copy-break: a frame of at most 'bytes' is copied into a 128-byte slot
+ * as its completion is harvested and the RX buffer goes straight back to the
+ * device, so short frames (ACKs, ARP) keep the ring full. 0 turns it off;
+ * VIRTIO_NET_RX_COPYBREAK by default. Such frames are never lent out by
+ * virtio_net_forward_queue(). Not done on VIRTIO_F_IN_ORDER devices, where
+ * the early repost would break ring order.
+ */
+#define VIRTIO_NET_RX_COPYBREAK_MAX    116u   /* slot less the virtio header */
+#define VIRTIO_NET_RX_COPYBREAK        VIRTIO_NET_RX_COPYBREAK_MAX
+
+int virtio_net_set_rx_copybreak_dev(virtio_net_dev_t dev, size_t bytes);
+
+/*
+ * RX header split for device 'index', taken by the next init. Each RX buffer
+ * is posted behind a 128-byte header buffer from a dense per-queue array:
+ * L2-L4 headers, and whole short frames, land there and a short frame is
+ * read in place; a longer one is joined in its payload buffer. A buffer
+ * takes two descriptors, so the ring holds half as many frames.
+ */
+int virtio_net_set_rx_split(size_t index, uint8_t enable);
+
+/*
+ * Select the policy for a full ring and backlog. BLOCK waits at most block_ms
+ * (0 selects the default) and then drops; it falls back to DROP in interrupt
+ * context. Scatter-gather, TSO and leased frames skip the backlog and meet the
+ * policy directly.
+ */
+int virtio_net_set_tx_policy_dev(virtio_net_dev_t dev, uint8_t policy, uint16_t block_ms);
+
+/*
+ * Tune TX doorbell coalescing: no unnotified frame waits longer than
+ * deadline_us, and no batch grows beyond max_batch frames (half the TX ring
+ * at most). 0 selects VIRTIO_NET_TX_DEADLINE_US / VIRTIO_NET_TX_BATCH_MAX.
+ */
+int virtio_net_set_tx_coalesce_dev(virtio_net_dev_t dev, uint32_t deadline_us, uint16_t max_batch);
+
+/*
+ * Host-side RX filtering through the control queue. The device starts
+ * promiscuous; once set_rx_mode_dev() clears VIRTIO_NET_RX_MODE_PROMISC it
+ * delivers only frames for its own MAC, broadcast, and the addresses in the
+ * MAC filter table (which replaces the previous one). With CTRL_VLAN
+ * negotiated, tagged frames pass only for VLAN ids added here; untagged
+ * frames are not affected. Return -1 when the device lacks the feature.
+ */
+int virtio_net_set_rx_mode_dev(virtio_net_dev_t dev, uint8_t mode);
+int virtio_net_set_mac_filter_dev(virtio_net_dev_t dev, const uint8_t (*unicast)[6], size_t unicast_count,
+                                  const uint8_t (*multicast)[6], size_t multicast_count);
+int virtio_net_set_vlan_filter_dev(virtio_net_dev_t dev, uint16_t vid, uint8_t enable);
+
+int virtio_net_get_stats_dev(virtio_net_dev_t dev, struct virtio_net_stats *out);
+void virtio_net_dump_stats_dev(virtio_net_dev_t dev);
+
 /* Legacy single-device operations (operate on device 0) */
 int virtio_net_self_test_registers(void);
 int virtio_net_send_frame(const uint8_t *frame, size_t length);
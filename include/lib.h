@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* src/lib_mem.S; util_memcpy regions must not overlap */
 void *util_memcpy(void *dest, const void *src, size_t n);
 void *util_memset(void *dest, int value, size_t n);
 int util_memcmp(const void *lhs, const void *rhs, size_t n);
@@ -19,9 +19,9 @@
 void irq_dispatch(void)
 {
     uint32_t raw_id = gic_acknowledge();
-    uint32_t int_id = raw_id & 0x3FFu;
+    uint32_t int_id = raw_id & 0xFFFFFFu;   /* 24-bit INTID: LPIs start at 8192 */
 
-    if (int_id >= GIC_SPURIOUS_BASE) {
+    if (int_id >= GIC_SPURIOUS_BASE && int_id < GIC_LPI_BASE) {
         return;
     }
 
@@ -8,12 +8,57 @@
 #include "uart.h"
 #include "lib.h"
 #include "nat.h"
+#include "pci.h"
 
 #define NET_DEMO_ARP_INTERVAL_TICKS     (OS_TICKS_PER_SEC)
 #define NET_DEMO_PING_INTERVAL_TICKS    (OS_TICKS_PER_SEC / 2u)
 #define NET_RX_TASK_STACK_SIZE          1024u
+#define NET_RX_BURST_SIZE               32u
 #define NET_LAN_RX_TASK_PRIO            5u
 #define NET_WAN_RX_TASK_PRIO            6u
+#define NET_RX_QUEUES                   VIRTIO_NET_MAX_QUEUE_PAIRS
+#define NET_RX_QUEUE_PRIO_STEP          2u   /* queue n workers run at the queue 0 priority + 2n */
+#define NET_RX_NAPI_BUDGET              64u  /* RX completions per NAPI poll, 0 for one interrupt per burst */
+#define NET_AUX_RX_TASK_PRIO            9u   /* one worker drains every port past LAN and WAN */
+#define NET_AUX_RX_WAIT_MS              10u
+#define NET_TX_DEADLINE_US              50u  /* longest a forwarded frame waits for its doorbell */
+#define NET_FWD_POOL_BUFFERS            128u /* RX buffers lent out by zero-copy forwarding */
+#define NET_FWD_TASK_PRIO               5u   /* run-to-completion model: the one forwarding task */
+#define NET_FWD_PORT_BUDGET             64u  /* frames taken from each RX queue per round */
+#define NET_FWD_IDLE_WAIT_MS            10u
+#define NET_DEMO_REPORT_TICKS           (10u * OS_TICKS_PER_SEC)
+
+/*
+ * Forwarding model. PER_PORT runs one RX task per (interface, queue), plus
+ * one for the ports past LAN and WAN. RTC runs a single task that polls every
+ * port round-robin with a per-queue budget, forwards each frame to completion
+ * into the egress TX batch, kicks each device once per round and sleeps on
+ * any device's RX when every ring is empty. make run-rtc builds the latter.
+ */
+#define NET_DEMO_FWD_PER_PORT           0u
+#define NET_DEMO_FWD_RTC                1u
+#ifndef NET_DEMO_FWD_MODEL
+#define NET_DEMO_FWD_MODEL              NET_DEMO_FWD_PER_PORT
+#endif
+
+/* Per-interface MTU; the LAN segment may run jumbo frames (up to VIRTIO_NET_MAX_MTU) */
+#define NET_DEMO_LAN_MTU                VIRTIO_NET_DEFAULT_MTU
+#define NET_DEMO_WAN_MTU                VIRTIO_NET_DEFAULT_MTU
+
+/* Ring depths per port, 0 for the driver default; a quiet port can run shallow and free its memory */
+#define NET_DEMO_LAN_QUEUE_SIZE         VIRTIO_NET_QUEUE_SIZE_DEFAULT
+#define NET_DEMO_WAN_QUEUE_SIZE         VIRTIO_NET_QUEUE_SIZE_DEFAULT
+#define NET_DEMO_AUX_QUEUE_SIZE         64u
+
+/* PCIe ECAM to probe for virtio-pci NICs after virtio-mmio, 0 for none (make run-pci sets PCI_ECAM_BASE) */
+#ifndef NET_DEMO_PCI_ECAM
+#define NET_DEMO_PCI_ECAM               0u
+#endif
+
+/* One interface per device; NAT runs between the first two, the rest answer ARP and ping */
+#define NET_DEMO_MAX_IFACES             VIRTIO_NET_MAX_DEVICES
+#define NET_DEMO_LAN_PORT               0u
+#define NET_DEMO_WAN_PORT               1u
 
 /* Network interface configuration */
 struct net_interface {
@@ -22,33 +67,99 @@ struct net_interface {
     uint8_t peer_ip[4];
     uint8_t peer_mac[6];
     bool peer_mac_valid;
+    uint16_t mtu;
+    uint16_t queue_size;
+    uint8_t rx_mode;        /* VIRTIO_NET_RX_MODE_*; 0 lets the host drop foreign unicast and multicast */
+    uint16_t vlan_id;       /* tagged VLAN accepted besides untagged traffic, 0 for none */
     const char *name;
+    uint16_t icmp_sequence;
+    INT32U last_ping_tick;
 };
 
-/* Static addressing for dual network interfaces */
-static struct net_interface g_lan_if = {
-    .dev = NULL,
-    .local_ip = {192u, 168u, 1u, 2u},
-    .peer_ip = {192u, 168u, 1u, 103u},
-    .peer_mac = {0},
-    .peer_mac_valid = false,
-    .name = "LAN"
+/*
+ * Static addressing per port, in device order. Ports past the table come up
+ * unaddressed (no IP, no ARP or ping) and only have their RX drained.
+ */
+static struct net_interface g_ifaces[NET_DEMO_MAX_IFACES] = {
+    [NET_DEMO_LAN_PORT] = {
+        .local_ip = {192u, 168u, 1u, 2u},
+        .peer_ip = {192u, 168u, 1u, 103u},
+        .mtu = NET_DEMO_LAN_MTU,
+        .queue_size = NET_DEMO_LAN_QUEUE_SIZE,
+        .name = "LAN"
+    },
+    [NET_DEMO_WAN_PORT] = {
+        .local_ip = {10u, 3u, 5u, 99u},
+        .peer_ip = {10u, 3u, 5u, 103u},
+        .mtu = NET_DEMO_WAN_MTU,
+        .queue_size = NET_DEMO_WAN_QUEUE_SIZE,
+        .name = "WAN"
+    },
+    [2] = {
+        .local_ip = {192u, 168u, 2u, 2u},
+        .peer_ip = {192u, 168u, 2u, 103u},
+        .mtu = VIRTIO_NET_DEFAULT_MTU,
+        .queue_size = NET_DEMO_AUX_QUEUE_SIZE,
+        .name = "LAN2"
+    },
+    [3] = {
+        .local_ip = {10u, 3u, 6u, 99u},
+        .peer_ip = {10u, 3u, 6u, 103u},
+        .mtu = VIRTIO_NET_DEFAULT_MTU,
+        .queue_size = NET_DEMO_AUX_QUEUE_SIZE,
+        .name = "WAN2"
+    }
 };
 
-static struct net_interface g_wan_if = {
-    .dev = NULL,
-    .local_ip = {10u, 3u, 5u, 99u},
-    .peer_ip = {10u, 3u, 5u, 103u},
-    .peer_mac = {0},
-    .peer_mac_valid = false,
-    .name = "WAN"
+static struct net_interface *const g_lan_if = &g_ifaces[NET_DEMO_LAN_PORT];
+static struct net_interface *const g_wan_if = &g_ifaces[NET_DEMO_WAN_PORT];
+static size_t g_iface_count = 0u;
+
+/* One RX worker per (interface, queue); LAN uses slot 0, WAN slot 1 */
+struct net_rx_worker {
+    struct net_interface *iface;
+    uint16_t queue;
+    uint32_t frames;        /* frames processed, written by this worker only */
 };
 
-static OS_STK net_lan_rx_task_stack[NET_RX_TASK_STACK_SIZE];
-static OS_STK net_wan_rx_task_stack[NET_RX_TASK_STACK_SIZE];
+static struct net_rx_worker g_rx_workers[2][NET_RX_QUEUES];
+static OS_STK net_rx_task_stack[2][NET_RX_QUEUES][NET_RX_TASK_STACK_SIZE];
+static OS_STK net_aux_rx_task_stack[NET_RX_TASK_STACK_SIZE];
+static OS_STK net_fwd_task_stack[NET_RX_TASK_STACK_SIZE];
+static uint32_t g_aux_frames = 0u;
+static uint32_t g_fwd_frames = 0u;
+static uint32_t g_fwd_rounds = 0u;
 
 static void net_rx_task(void *p_arg);
 
+static void net_demo_apply_mtu(struct net_interface *iface)
+{
+    if (virtio_net_set_mtu_dev(iface->dev, iface->mtu) != 0) {
+        uart_puts("[net-demo] ");
+        uart_puts(iface->name);
+        uart_puts(": MTU not supported by device, keeping default\n");
+        iface->mtu = virtio_net_get_mtu_dev(iface->dev);
+    }
+    uart_puts("[net-demo]   MTU: ");
+    uart_write_dec(iface->mtu);
+    uart_putc('\n');
+}
+
+/* Let the host drop what this port would discard anyway: only its MAC, broadcast and its VLAN */
+static void net_demo_apply_rx_filter(struct net_interface *iface)
+{
+    if (virtio_net_set_mac_filter_dev(iface->dev, NULL, 0u, NULL, 0u) != 0 ||
+        virtio_net_set_rx_mode_dev(iface->dev, iface->rx_mode) != 0) {
+        uart_puts("[net-demo]   RX filter: none, device delivers all traffic\n");
+        return;
+    }
+    if (iface->vlan_id != 0u && virtio_net_set_vlan_filter_dev(iface->dev, iface->vlan_id, 1u) != 0) {
+        uart_puts("[net-demo]   VLAN filter not supported by device\n");
+    }
+    uart_puts("[net-demo]   RX filter: ");
+    uart_puts((iface->rx_mode & VIRTIO_NET_RX_MODE_PROMISC) != 0u ? "promiscuous\n" : "own MAC + broadcast\n");
+}
+
 struct eth_header {
     uint8_t dest[6];
     uint8_t src[6];
@@ -145,48 +256,124 @@ static uint16_t checksum16(const void *data, size_t length)
     return (uint16_t)~sum;
 }
 
-/* TCP/UDP checksum with pseudo-header (RFC 793, RFC 768) */
-static uint16_t tcp_udp_checksum(const struct ipv4_header *ip, const void *transport_hdr, size_t transport_len)
+static uint16_t load_be16(const uint8_t *bytes)
 {
-    uint32_t sum = 0u;
-    const uint16_t *words;
-    size_t i;
-
-    /* Pseudo-header: Source IP (4 bytes) - already in network byte order in packet */
-    /* Read as 16-bit words directly from the byte array (no byte swap) */
-    words = (const uint16_t *)ip->src;
-    sum += words[0];
-    sum += words[1];
-
-    /* Pseudo-header: Destination IP (4 bytes) - already in network byte order */
-    words = (const uint16_t *)ip->dst;
-    sum += words[0];
-    sum += words[1];
-
-    /* Pseudo-header: Zero + Protocol (convert from host variable to network order) */
-    sum += util_htons((uint16_t)ip->protocol);
-
-    /* Pseudo-header: TCP/UDP Length (convert from host variable to network order) */
-    sum += util_htons((uint16_t)transport_len);
-
-    /* TCP/UDP header and data - already in network byte order in packet */
-    /* Read as 16-bit words directly (no byte swap) */
-    words = (const uint16_t *)transport_hdr;
-    for (i = 0; i < transport_len; i += 2) {
-        if (i + 1 < transport_len) {
-            sum += *words++;
-        } else {
-            /* Odd byte: pad with zero (convert to network order) */
-            sum += util_htons((uint16_t)(*(const uint8_t *)words) << 8);
+    return (uint16_t)(((uint16_t)bytes[0] << 8) | bytes[1]);
+}
+
+static void store_be16(uint8_t *bytes, uint16_t value)
+{
+    bytes[0] = (uint8_t)(value >> 8);
+    bytes[1] = (uint8_t)(value & 0xFFu);
+}
+
+/*
+ * Incremental checksum update (RFC 1624) for one 16-bit word change.
+ * A full checksum is stored complemented; a partial (pseudo-header only)
+ * sum left for the device to finish is not.
+ */
+static uint16_t csum_update16(uint16_t check, uint16_t old_word, uint16_t new_word, bool partial)
+{
+    uint32_t sum = partial ? check : (uint16_t)~check;
+
+    sum += (uint16_t)~old_word;
+    sum += new_word;
+    while ((sum >> 16u) != 0u) {
+        sum = (sum & 0xFFFFu) + (sum >> 16u);
+    }
+
+    return partial ? (uint16_t)sum : (uint16_t)~sum;
+}
+
+/*
+ * NAT rewrite of one IP address and the matching TCP/UDP port (source or
+ * destination), patching the L4 checksum for just the changed words instead
+ * of re-summing the payload. A partial checksum from the device covers only
+ * the pseudo-header, so the port change is left to whoever completes it.
+ */
+static void nat_rewrite_l4(struct ipv4_header *ip, size_t ip_header_len,
+                           const struct virtio_net_rx_frame *rx, bool rewrite_src,
+                           const uint8_t new_addr[4], uint16_t new_port)
+{
+    uint8_t *addr = rewrite_src ? ip->src : ip->dst;
+    uint8_t *l4 = (uint8_t *)ip + ip_header_len;
+    uint8_t *port = l4 + (rewrite_src ? offsetof(struct udp_header, src_port) : offsetof(struct udp_header, dst_port));
+    uint8_t *check_field = l4 + ((ip->protocol == 6u) ? offsetof(struct tcp_header, checksum)
+                                                       : offsetof(struct udp_header, checksum));
+    bool partial = (rx->csum == VIRTIO_NET_RX_CSUM_PARTIAL);
+    uint16_t check = load_be16(check_field);
+
+    /* A zero UDP checksum means none was sent; keep it that way */
+    if (partial || ip->protocol == 6u || check != 0u) {
+        check = csum_update16(check, load_be16(&addr[0]), load_be16(&new_addr[0]), partial);
+        check = csum_update16(check, load_be16(&addr[2]), load_be16(&new_addr[2]), partial);
+        if (!partial) {
+            check = csum_update16(check, load_be16(port), new_port, false);
+            if (ip->protocol == 17u && check == 0u) {
+                check = 0xFFFFu;
+            }
         }
+        store_be16(check_field, check);
     }
 
-    /* Fold 32-bit sum to 16 bits */
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
+    util_memcpy(addr, new_addr, 4u);
+    store_be16(port, new_port);
+}
+
+/*
+ * FNV-1a over the parts of a NAT session both directions share: protocol,
+ * remote address and port, and the translated WAN port. Outbound and return
+ * traffic of one session hash alike, so they pick the same queue index.
+ */
+static uint32_t net_demo_session_hash(uint8_t proto, const uint8_t remote_ip[4],
+                                      uint16_t remote_port, uint16_t wan_port)
+{
+    uint8_t key[9];
+    uint32_t hash = 2166136261u;
+
+    key[0] = proto;
+    util_memcpy(&key[1], remote_ip, 4u);
+    store_be16(&key[5], remote_port);
+    store_be16(&key[7], wan_port);
+    for (size_t i = 0u; i < sizeof(key); ++i) {
+        hash = (hash ^ key[i]) * 16777619u;
     }
+    return hash;
+}
 
-    return (uint16_t)~sum;
+/*
+ * Forward a frame rewritten in its RX buffer on the TX queue its session
+ * hashes to, passing a partial checksum and any TSO segmentation on for the
+ * egress device (or driver) to finish. The RX buffer itself is handed to the
+ * egress device where the driver allows it.
+ */
+static void net_demo_forward(virtio_net_dev_t in_dev, uint16_t in_queue, virtio_net_dev_t dev,
+                             uint32_t session_hash, const struct virtio_net_rx_frame *rx, size_t length)
+{
+    uint16_t queue = virtio_net_select_queue_dev(dev, session_hash);
+
+    if (rx->csum == VIRTIO_NET_RX_CSUM_PARTIAL) {
+        struct virtio_net_tx_offload offload;
+        offload.flags = VIRTIO_NET_TX_CSUM;
+        offload.csum_start = rx->csum_start;
+        offload.csum_offset = rx->csum_offset;
+        offload.gso_size = rx->gso_size;
+        if (rx->gso_size != 0u) {
+            offload.flags |= VIRTIO_NET_TX_TSO4;
+        }
+        virtio_net_forward_queue(in_dev, in_queue, rx, length, dev, queue, &offload);
+        return;
+    }
+    virtio_net_forward_queue(in_dev, in_queue, rx, length, dev, queue, NULL);
+}
+
+/* TSO super-frames are cut to the egress MTU on the way out; anything else must already fit */
+static bool net_demo_fits(virtio_net_dev_t dev, const struct virtio_net_rx_frame *rx, size_t length)
+{
+    if (rx->gso_size != 0u) {
+        return length <= VIRTIO_NET_MAX_GSO_FRAME_SIZE;
+    }
+    return length <= virtio_net_get_max_frame_dev(dev);
 }
 
 static bool ip_equals(const uint8_t *lhs, const uint8_t *rhs)
@@ -194,10 +381,13 @@ static bool ip_equals(const uint8_t *lhs, const uint8_t *rhs)
     return (util_memcmp(lhs, rhs, 4u) == 0);
 }
 
-static void net_demo_send_arp_request(struct net_interface *iface)
+static void send_arp_request_for_ip(struct net_interface *iface, const uint8_t target_ip[4])
 {
-    uint8_t frame[64];
-    util_memset(frame, 0, sizeof(frame));
+    /* Build the request directly in the leased TX buffer */
+    uint8_t *frame = virtio_net_tx_lease_dev(iface->dev, sizeof(struct eth_header) + sizeof(struct arp_packet));
+    if (frame == NULL) {
+        return;
+    }
 
     const uint8_t *mac = virtio_net_get_mac_dev(iface->dev);
     const uint8_t broadcast[6] = {0xFFu, 0xFFu, 0xFFu, 0xFFu, 0xFFu, 0xFFu};
@@ -216,8 +406,13 @@ static void net_demo_send_arp_request(struct net_interface *iface)
     util_memcpy(arp->sha, mac, sizeof(arp->sha));
     util_memcpy(arp->spa, iface->local_ip, sizeof(arp->spa));
     util_memset(arp->tha, 0, sizeof(arp->tha));
-    util_memcpy(arp->tpa, iface->peer_ip, sizeof(arp->tpa));
+    util_memcpy(arp->tpa, target_ip, sizeof(arp->tpa));
 
+    virtio_net_tx_commit_dev(iface->dev, frame, sizeof(*eth) + sizeof(*arp));
+}
+
+static void net_demo_send_arp_request(struct net_interface *iface)
+{
     uart_puts("[net-demo] ");
     uart_puts(iface->name);
     uart_puts(": Sending ARP who-has ");
@@ -237,41 +432,18 @@ static void net_demo_send_arp_request(struct net_interface *iface)
     uart_putc((char)('0' + (iface->peer_ip[3] / 10u) % 10u));
     uart_putc((char)('0' + iface->peer_ip[3] % 10u));
     uart_putc('\n');
-    virtio_net_send_frame_dev(iface->dev, frame, sizeof(*eth) + sizeof(*arp));
-}
-
-static void send_arp_request_for_ip(struct net_interface *iface, const uint8_t target_ip[4])
-{
-    uint8_t frame[64];
-    util_memset(frame, 0, sizeof(frame));
-
-    const uint8_t *mac = virtio_net_get_mac_dev(iface->dev);
-    const uint8_t broadcast[6] = {0xFFu, 0xFFu, 0xFFu, 0xFFu, 0xFFu, 0xFFu};
-
-    struct eth_header *eth = (struct eth_header *)frame;
-    util_memcpy(eth->dest, broadcast, sizeof(eth->dest));
-    util_memcpy(eth->src, mac, sizeof(eth->src));
-    eth->type = util_htons(0x0806u);
-
-    struct arp_packet *arp = (struct arp_packet *)(frame + sizeof(*eth));
-    arp->htype = util_htons(1u);
-    arp->ptype = util_htons(0x0800u);
-    arp->hlen = 6u;
-    arp->plen = 4u;
-    arp->oper = util_htons(1u);
-    util_memcpy(arp->sha, mac, sizeof(arp->sha));
-    util_memcpy(arp->spa, iface->local_ip, sizeof(arp->spa));
-    util_memset(arp->tha, 0, sizeof(arp->tha));
-    util_memcpy(arp->tpa, target_ip, sizeof(arp->tpa));
-
-    virtio_net_send_frame_dev(iface->dev, frame, sizeof(*eth) + sizeof(*arp));
+    send_arp_request_for_ip(iface, iface->peer_ip);
 }
 
 static void send_arp_reply(struct net_interface *iface,
                            const struct eth_header *eth,
                            const struct arp_packet *request)
 {
-    uint8_t frame[64];
+    uint8_t *frame = virtio_net_tx_lease_dev(iface->dev, sizeof(struct eth_header) + sizeof(struct arp_packet));
+    if (frame == NULL) {
+        return;
+    }
+
     struct eth_header *reply_eth = (struct eth_header *)frame;
     struct arp_packet *reply_arp = (struct arp_packet *)(frame + sizeof(*reply_eth));
     const uint8_t *local_mac = virtio_net_get_mac_dev(iface->dev);
@@ -290,44 +462,41 @@ static void send_arp_reply(struct net_interface *iface,
     util_memcpy(reply_arp->tha, request->sha, sizeof(reply_arp->tha));
     util_memcpy(reply_arp->tpa, request->spa, sizeof(reply_arp->tpa));
 
-    virtio_net_send_frame_dev(iface->dev, frame, sizeof(*reply_eth) + sizeof(*reply_arp));
+    virtio_net_tx_commit_dev(iface->dev, frame, sizeof(*reply_eth) + sizeof(*reply_arp));
 }
 
 static void send_icmp_echo_reply(struct net_interface *iface,
                                   const uint8_t *rx_frame, size_t length)
 {
-    if (length > VIRTIO_NET_MAX_FRAME_SIZE) {
-        length = VIRTIO_NET_MAX_FRAME_SIZE;
+    const struct eth_header *rx_eth = (const struct eth_header *)rx_frame;
+    const struct ipv4_header *rx_ip = (const struct ipv4_header *)(rx_frame + sizeof(*rx_eth));
+    size_t ip_header_len = (size_t)((rx_ip->version_ihl & 0x0Fu) * 4u);
+    size_t payload_len = util_ntohs(rx_ip->total_length);
+    /* 'length' is what was received: a total_length beyond it would copy stale buffer bytes */
+    if (payload_len < ip_header_len + sizeof(struct icmp_header) ||
+        sizeof(*rx_eth) + payload_len > length) {
+        return;
     }
+    size_t icmp_len = payload_len - ip_header_len;
 
-    uint8_t frame[VIRTIO_NET_MAX_FRAME_SIZE];
-    util_memcpy(frame, rx_frame, length);
+    /* The request is copied once, straight into the leased TX buffer, and rewritten there */
+    uint8_t *frame = virtio_net_tx_lease_dev(iface->dev, sizeof(*rx_eth) + payload_len);
+    if (frame == NULL) {
+        return;
+    }
+    util_memcpy(frame, rx_frame, sizeof(*rx_eth) + payload_len);
 
     struct eth_header *eth = (struct eth_header *)frame;
     struct ipv4_header *ip = (struct ipv4_header *)(frame + sizeof(*eth));
-    size_t ip_header_len = (size_t)((ip->version_ihl & 0x0Fu) * 4u);
     struct icmp_header *icmp = (struct icmp_header *)((uint8_t *)ip + ip_header_len);
-    size_t payload_len = util_ntohs(ip->total_length);
-    if (payload_len < ip_header_len + sizeof(struct icmp_header)) {
-        return;
-    }
-    size_t icmp_len = payload_len - ip_header_len;
 
     const uint8_t *local_mac = virtio_net_get_mac_dev(iface->dev);
-    uint8_t original_src_mac[6];
-    util_memcpy(original_src_mac, eth->src, sizeof(original_src_mac));
-
-    util_memcpy(eth->dest, eth->src, sizeof(eth->dest));
+    util_memcpy(eth->dest, rx_eth->src, sizeof(eth->dest));
     util_memcpy(eth->src, local_mac, sizeof(eth->src));
 
-    uint8_t src_ip[4];
-    uint8_t original_dst_ip[4];
-    util_memcpy(src_ip, ip->src, sizeof(src_ip));
-    util_memcpy(original_dst_ip, ip->dst, sizeof(original_dst_ip));
-
     /* Reply with the IP that was pinged (could be local_ip or wan_ip on LAN interface) */
-    util_memcpy(ip->src, original_dst_ip, sizeof(ip->src));
-    util_memcpy(ip->dst, src_ip, sizeof(ip->dst));
+    util_memcpy(ip->src, rx_ip->dst, sizeof(ip->src));
+    util_memcpy(ip->dst, rx_ip->src, sizeof(ip->dst));
     ip->ttl = 64u;
     ip->header_checksum = 0u;
     uint16_t ip_checksum = checksum16(ip, ip_header_len);
@@ -339,23 +508,24 @@ static void send_icmp_echo_reply(struct net_interface *iface,
     uint16_t icmp_checksum = checksum16(icmp, icmp_len);
     icmp->checksum = util_htons(icmp_checksum);
 
+    virtio_net_tx_commit_dev(iface->dev, frame, sizeof(*eth) + payload_len);
+
     uart_puts("[net-demo] ");
     uart_puts(iface->name);
     uart_puts(": Replied to ICMP echo request (src=");
-    uart_write_dec(original_dst_ip[0]); uart_putc('.');
-    uart_write_dec(original_dst_ip[1]); uart_putc('.');
-    uart_write_dec(original_dst_ip[2]); uart_putc('.');
-    uart_write_dec(original_dst_ip[3]);
+    uart_write_dec(rx_ip->dst[0]); uart_putc('.');
+    uart_write_dec(rx_ip->dst[1]); uart_putc('.');
+    uart_write_dec(rx_ip->dst[2]); uart_putc('.');
+    uart_write_dec(rx_ip->dst[3]);
     uart_puts(")\n");
-    virtio_net_send_frame_dev(iface->dev, frame, sizeof(*eth) + payload_len);
-
-    /* Restore original src MAC in case buffer reused */
-    util_memcpy(eth->src, original_src_mac, sizeof(original_src_mac));
 }
 
-static int net_demo_process_frame(struct net_interface *iface,
-                                   uint8_t *frame, size_t length)
+static int net_demo_process_frame(struct net_interface *iface, uint16_t queue,
+                                   const struct virtio_net_rx_frame *rx)
 {
+    uint8_t *frame = rx->data;
+    size_t length = rx->len;
+
     if (length < sizeof(struct eth_header)) {
         return 0;
     }
@@ -412,7 +582,7 @@ static int net_demo_process_frame(struct net_interface *iface,
 
 
         /* Check if packet is from WAN destined for our WAN IP (NAT return traffic) - HANDLE FIRST */
-        if (nat_is_wan_ip(ip->dst) && iface == &g_wan_if && ip->protocol == 1u) {
+        if (nat_is_wan_ip(ip->dst) && iface == g_wan_if && ip->protocol == 1u) {
             uint16_t total_length = util_ntohs(ip->total_length);
             size_t ip_header_len = (size_t)((ip->version_ihl & 0x0Fu) * 4u);
 
@@ -427,14 +597,14 @@ static int net_demo_process_frame(struct net_interface *iface,
                     /* Perform reverse NAT translation */
                     if (nat_translate_inbound(NAT_PROTO_ICMP, wan_port,
                                              ip->src, 0, lan_ip, &lan_port) == 0) {
-                        /* Modify the packet in-place (frame is a private rx_buffer copy) */
-                        if (length <= VIRTIO_NET_MAX_FRAME_SIZE && g_lan_if.dev != NULL) {
+                        /* Modify the packet in-place (frame is the RX buffer, released after the burst) */
+                        if (g_lan_if->dev != NULL && length <= virtio_net_get_max_frame_dev(g_lan_if->dev)) {
                             struct eth_header *fwd_eth = (struct eth_header *)frame;
                             struct ipv4_header *fwd_ip = (struct ipv4_header *)(frame + sizeof(*fwd_eth));
                             struct icmp_header *fwd_icmp = (struct icmp_header *)((uint8_t *)fwd_ip + ip_header_len);
 
                             /* Update Ethernet header */
-                            const uint8_t *lan_mac = virtio_net_get_mac_dev(g_lan_if.dev);
+                            const uint8_t *lan_mac = virtio_net_get_mac_dev(g_lan_if->dev);
                             util_memcpy(fwd_eth->src, lan_mac, 6);
 
                             /* Try to get destination MAC from ARP cache */
@@ -455,14 +625,14 @@ static int net_demo_process_frame(struct net_interface *iface,
                             fwd_icmp->checksum = util_htons(checksum16(fwd_icmp, icmp_len));
 
                             /* Send on LAN interface */
-                            virtio_net_send_frame_dev(g_lan_if.dev, frame,
-                                                    sizeof(*fwd_eth) + total_length);
+                            virtio_net_forward_queue(iface->dev, queue, rx, sizeof(*fwd_eth) + total_length,
+                                                   g_lan_if->dev, 0u, NULL);
                             return 1;
                         }
                     }
                 } else if (icmp->type == 8u) {
                     /* ICMP Echo Request to our WAN IP - reply directly */
-                    send_icmp_echo_reply(iface, frame, sizeof(struct eth_header) + total_length);
+                    send_icmp_echo_reply(iface, frame, length);
                     return 1;
                 }
             }
@@ -470,7 +640,7 @@ static int net_demo_process_frame(struct net_interface *iface,
 
         /* Check if packet is from WAN destined for our WAN IP (NAT return traffic) */
         /* MUST be checked BEFORE "is_for_us" check, otherwise NAT return packets are dropped */
-        if (nat_is_wan_ip(ip->dst) && iface == &g_wan_if && (ip->protocol == 6u || ip->protocol == 17u)) {
+        if (nat_is_wan_ip(ip->dst) && iface == g_wan_if && (ip->protocol == 6u || ip->protocol == 17u)) {
 
             uint16_t total_length = util_ntohs(ip->total_length);
             size_t ip_header_len = (size_t)((ip->version_ihl & 0x0Fu) * 4u);
@@ -496,13 +666,13 @@ static int net_demo_process_frame(struct net_interface *iface,
                 /* Perform reverse NAT translation */
                 if (nat_translate_inbound(proto, wan_port,
                                          ip->src, src_port, lan_ip, &lan_port) == 0) {
-                    /* Modify the packet in-place (frame is a private rx_buffer copy) */
-                    if (length <= VIRTIO_NET_MAX_FRAME_SIZE && g_lan_if.dev != NULL) {
+                    /* Modify the packet in-place (frame is the RX buffer, released after the burst) */
+                    if (g_lan_if->dev != NULL && net_demo_fits(g_lan_if->dev, rx, length)) {
                         struct eth_header *fwd_eth = (struct eth_header *)frame;
                         struct ipv4_header *fwd_ip = (struct ipv4_header *)(frame + sizeof(*fwd_eth));
 
                         /* Update Ethernet header */
-                        const uint8_t *lan_mac = virtio_net_get_mac_dev(g_lan_if.dev);
+                        const uint8_t *lan_mac = virtio_net_get_mac_dev(g_lan_if->dev);
                         util_memcpy(fwd_eth->src, lan_mac, 6);
 
                         /* Try to get destination MAC from ARP cache */
@@ -511,30 +681,16 @@ static int net_demo_process_frame(struct net_interface *iface,
                             return 1;
                         }
 
-                        /* Update IP header */
-                        util_memcpy(fwd_ip->dst, lan_ip, 4);
+                        /* Update IP header, transport port and L4 checksum */
+                        nat_rewrite_l4(fwd_ip, ip_header_len, rx, false, lan_ip, lan_port);
                         fwd_ip->ttl--;
                         fwd_ip->header_checksum = 0u;
                         fwd_ip->header_checksum = util_htons(checksum16(fwd_ip, ip_header_len));
 
-                        /* Update transport port and checksum */
-                        if (ip->protocol == 6u) {
-                            struct tcp_header *fwd_tcp = (struct tcp_header *)((uint8_t *)fwd_ip + ip_header_len);
-                            fwd_tcp->dst_port = util_htons(lan_port);
-                            fwd_tcp->checksum = 0u;
-                            size_t tcp_len = total_length - ip_header_len;
-                            fwd_tcp->checksum = tcp_udp_checksum(fwd_ip, fwd_tcp, tcp_len);  /* Direct assignment */
-                        } else {
-                            struct udp_header *fwd_udp = (struct udp_header *)((uint8_t *)fwd_ip + ip_header_len);
-                            fwd_udp->dst_port = util_htons(lan_port);
-                            fwd_udp->checksum = 0u;
-                            size_t udp_len = total_length - ip_header_len;
-                            fwd_udp->checksum = tcp_udp_checksum(fwd_ip, fwd_udp, udp_len);  /* Direct assignment */
-                        }
-
                         /* Send on LAN interface */
-                        virtio_net_send_frame_dev(g_lan_if.dev, frame,
-                                                sizeof(*fwd_eth) + total_length);
+                        net_demo_forward(iface->dev, queue, g_lan_if->dev,
+                                         net_demo_session_hash(proto, ip->src, src_port, wan_port),
+                                         rx, sizeof(*fwd_eth) + total_length);
                         return 1;
                     }
                 }
@@ -545,7 +701,7 @@ static int net_demo_process_frame(struct net_interface *iface,
         bool is_for_us = ip_equals(ip->dst, iface->local_ip);
 
         /* LAN interface should also respond to WAN IP (acting as gateway) */
-        if (iface == &g_lan_if && nat_is_wan_ip(ip->dst)) {
+        if (iface == g_lan_if && nat_is_wan_ip(ip->dst)) {
             is_for_us = true;
         }
 
@@ -561,7 +717,7 @@ static int net_demo_process_frame(struct net_interface *iface,
                 size_t icmp_len = (size_t)total_length - ip_header_len;
 
                 if (icmp_len >= sizeof(struct icmp_header) && icmp->type == 8u) {
-                    send_icmp_echo_reply(iface, frame, sizeof(struct eth_header) + total_length);
+                    send_icmp_echo_reply(iface, frame, length);
                     return 1;
                 }
             }
@@ -569,10 +725,10 @@ static int net_demo_process_frame(struct net_interface *iface,
             /* Packet not for us - check if we should forward via NAT */
 
             /* Check if packet is from LAN network trying to reach outside */
-            if (nat_is_lan_ip(ip->src) && iface == &g_lan_if) {
+            if (nat_is_lan_ip(ip->src) && iface == g_lan_if) {
 
                 /* Forward ICMP, TCP, and UDP */
-                if (ip->protocol == 1u && g_wan_if.dev != NULL) {  /* ICMP */
+                if (ip->protocol == 1u && g_wan_if->dev != NULL) {  /* ICMP */
                     uint16_t total_length = util_ntohs(ip->total_length);
                     size_t ip_header_len = (size_t)((ip->version_ihl & 0x0Fu) * 4u);
 
@@ -586,14 +742,14 @@ static int net_demo_process_frame(struct net_interface *iface,
                             /* Perform NAT translation */
                             if (nat_translate_outbound(NAT_PROTO_ICMP, ip->src, icmp_id,
                                                       ip->dst, 0, &wan_port) == 0) {
-                                /* Modify the packet in-place (frame is a private rx_buffer copy) */
-                                if (length <= VIRTIO_NET_MAX_FRAME_SIZE) {
+                                /* Modify the packet in-place (frame is the RX buffer, released after the burst) */
+                                if (length <= virtio_net_get_max_frame_dev(g_wan_if->dev)) {
                                     struct eth_header *fwd_eth = (struct eth_header *)frame;
                                     struct ipv4_header *fwd_ip = (struct ipv4_header *)(frame + sizeof(*fwd_eth));
                                     struct icmp_header *fwd_icmp = (struct icmp_header *)((uint8_t *)fwd_ip + ip_header_len);
 
                                     /* Update Ethernet header */
-                                    const uint8_t *wan_mac = virtio_net_get_mac_dev(g_wan_if.dev);
+                                    const uint8_t *wan_mac = virtio_net_get_mac_dev(g_wan_if->dev);
                                     util_memcpy(fwd_eth->src, wan_mac, 6);
 
                                     /* Try to get destination MAC from ARP cache */
@@ -602,7 +758,7 @@ static int net_demo_process_frame(struct net_interface *iface,
                                     }
 
                                     /* Update IP header */
-                                    util_memcpy(fwd_ip->src, g_wan_if.local_ip, 4);
+                                    util_memcpy(fwd_ip->src, g_wan_if->local_ip, 4);
                                     fwd_ip->ttl--;
                                     fwd_ip->header_checksum = 0u;
                                     fwd_ip->header_checksum = util_htons(checksum16(fwd_ip, ip_header_len));
@@ -614,14 +770,14 @@ static int net_demo_process_frame(struct net_interface *iface,
                                     fwd_icmp->checksum = util_htons(checksum16(fwd_icmp, icmp_len));
 
                                     /* Send on WAN interface */
-                                    virtio_net_send_frame_dev(g_wan_if.dev, frame,
-                                                            sizeof(*fwd_eth) + total_length);
+                                    virtio_net_forward_queue(iface->dev, queue, rx, sizeof(*fwd_eth) + total_length,
+                                                           g_wan_if->dev, 0u, NULL);
                                     return 1;
                                 }
                             }
                         }
                     }
-                } else if ((ip->protocol == 6u || ip->protocol == 17u) && g_wan_if.dev != NULL) {  /* TCP or UDP */
+                } else if ((ip->protocol == 6u || ip->protocol == 17u) && g_wan_if->dev != NULL) {  /* TCP or UDP */
                     uint16_t total_length = util_ntohs(ip->total_length);
                     size_t ip_header_len = (size_t)((ip->version_ihl & 0x0Fu) * 4u);
                     size_t min_transport_len = (ip->protocol == 6u) ? sizeof(struct tcp_header) : sizeof(struct udp_header);
@@ -644,45 +800,31 @@ static int net_demo_process_frame(struct net_interface *iface,
                         /* Perform NAT translation */
                         if (nat_translate_outbound(proto, ip->src, src_port,
                                                   ip->dst, dst_port, &wan_port) == 0) {
-                            /* Modify the packet in-place (frame is a private rx_buffer copy) */
-                            if (length <= VIRTIO_NET_MAX_FRAME_SIZE) {
+                            /* Modify the packet in-place (frame is the RX buffer, released after the burst) */
+                            if (net_demo_fits(g_wan_if->dev, rx, length)) {
                                 struct eth_header *fwd_eth = (struct eth_header *)frame;
                                 struct ipv4_header *fwd_ip = (struct ipv4_header *)(frame + sizeof(*fwd_eth));
 
                                 /* Update Ethernet header */
-                                const uint8_t *wan_mac = virtio_net_get_mac_dev(g_wan_if.dev);
+                                const uint8_t *wan_mac = virtio_net_get_mac_dev(g_wan_if->dev);
                                 util_memcpy(fwd_eth->src, wan_mac, 6);
 
                                 /* Try to get destination MAC from ARP cache */
                                 if (!arp_cache_lookup(ip->dst, fwd_eth->dest)) {
-                                    send_arp_request_for_ip(&g_wan_if, ip->dst);
+                                    send_arp_request_for_ip(g_wan_if, ip->dst);
                                     return 1;
                                 }
 
-                                /* Update IP header */
-                                util_memcpy(fwd_ip->src, g_wan_if.local_ip, 4);
+                                /* Update IP header, transport port and L4 checksum */
+                                nat_rewrite_l4(fwd_ip, ip_header_len, rx, true, g_wan_if->local_ip, wan_port);
                                 fwd_ip->ttl--;
                                 fwd_ip->header_checksum = 0u;
                                 fwd_ip->header_checksum = util_htons(checksum16(fwd_ip, ip_header_len));
 
-                                /* Update transport port and checksum */
-                                if (ip->protocol == 6u) {
-                                    struct tcp_header *fwd_tcp = (struct tcp_header *)((uint8_t *)fwd_ip + ip_header_len);
-                                    fwd_tcp->src_port = util_htons(wan_port);
-                                    fwd_tcp->checksum = 0u;
-                                    size_t tcp_len = total_length - ip_header_len;
-                                    fwd_tcp->checksum = tcp_udp_checksum(fwd_ip, fwd_tcp, tcp_len);
-                                } else {
-                                    struct udp_header *fwd_udp = (struct udp_header *)((uint8_t *)fwd_ip + ip_header_len);
-                                    fwd_udp->src_port = util_htons(wan_port);
-                                    fwd_udp->checksum = 0u;
-                                    size_t udp_len = total_length - ip_header_len;
-                                    fwd_udp->checksum = tcp_udp_checksum(fwd_ip, fwd_udp, udp_len);  /* Direct assignment */
-                                }
-
                                 /* Send on WAN interface */
-                                virtio_net_send_frame_dev(g_wan_if.dev, frame,
-                                                        sizeof(*fwd_eth) + total_length);
+                                net_demo_forward(iface->dev, queue, g_wan_if->dev,
+                                                 net_demo_session_hash(proto, ip->dst, dst_port, wan_port),
+                                                 rx, sizeof(*fwd_eth) + total_length);
                                 return 1;
                             }
                         }
@@ -691,7 +833,7 @@ static int net_demo_process_frame(struct net_interface *iface,
             }
 
             /* Check if packet is from WAN destined for our WAN IP (NAT return traffic) */
-            if (nat_is_wan_ip(ip->dst) && iface == &g_wan_if && (ip->protocol == 1u || ip->protocol == 6u || ip->protocol == 17u)) {
+            if (nat_is_wan_ip(ip->dst) && iface == g_wan_if && (ip->protocol == 1u || ip->protocol == 6u || ip->protocol == 17u)) {
                 /* Debug: Show we're handling WAN return packet */
                 if (ip->protocol == 6u || ip->protocol == 17u) {
                 }
@@ -710,14 +852,14 @@ static int net_demo_process_frame(struct net_interface *iface,
                         /* Perform reverse NAT translation */
                         if (nat_translate_inbound(NAT_PROTO_ICMP, wan_port,
                                                  ip->src, 0, lan_ip, &lan_port) == 0) {
-                            /* Modify the packet in-place (frame is a private rx_buffer copy) */
-                            if (length <= VIRTIO_NET_MAX_FRAME_SIZE && g_lan_if.dev != NULL) {
+                            /* Modify the packet in-place (frame is the RX buffer, released after the burst) */
+                            if (g_lan_if->dev != NULL && length <= virtio_net_get_max_frame_dev(g_lan_if->dev)) {
                                 struct eth_header *fwd_eth = (struct eth_header *)frame;
                                 struct ipv4_header *fwd_ip = (struct ipv4_header *)(frame + sizeof(*fwd_eth));
                                 struct icmp_header *fwd_icmp = (struct icmp_header *)((uint8_t *)fwd_ip + ip_header_len);
 
                                 /* Update Ethernet header */
-                                const uint8_t *lan_mac = virtio_net_get_mac_dev(g_lan_if.dev);
+                                const uint8_t *lan_mac = virtio_net_get_mac_dev(g_lan_if->dev);
                                 util_memcpy(fwd_eth->src, lan_mac, 6);
 
                                 /* Try to get destination MAC from ARP cache */
@@ -739,8 +881,8 @@ static int net_demo_process_frame(struct net_interface *iface,
                                 fwd_icmp->checksum = util_htons(checksum16(fwd_icmp, icmp_len));
 
                                 /* Send on LAN interface */
-                                virtio_net_send_frame_dev(g_lan_if.dev, frame,
-                                                        sizeof(*fwd_eth) + total_length);
+                                virtio_net_forward_queue(iface->dev, queue, rx, sizeof(*fwd_eth) + total_length,
+                                                       g_lan_if->dev, 0u, NULL);
                                 return 1;
                             }
                         }
@@ -768,13 +910,13 @@ static int net_demo_process_frame(struct net_interface *iface,
                         /* Perform reverse NAT translation */
                         if (nat_translate_inbound(proto, wan_port,
                                                  ip->src, src_port, lan_ip, &lan_port) == 0) {
-                            /* Modify the packet in-place (frame is a private rx_buffer copy) */
-                            if (length <= VIRTIO_NET_MAX_FRAME_SIZE && g_lan_if.dev != NULL) {
+                            /* Modify the packet in-place (frame is the RX buffer, released after the burst) */
+                            if (g_lan_if->dev != NULL && net_demo_fits(g_lan_if->dev, rx, length)) {
                                 struct eth_header *fwd_eth = (struct eth_header *)frame;
                                 struct ipv4_header *fwd_ip = (struct ipv4_header *)(frame + sizeof(*fwd_eth));
 
                                 /* Update Ethernet header */
-                                const uint8_t *lan_mac = virtio_net_get_mac_dev(g_lan_if.dev);
+                                const uint8_t *lan_mac = virtio_net_get_mac_dev(g_lan_if->dev);
                                 util_memcpy(fwd_eth->src, lan_mac, 6);
 
                                 /* Try to get destination MAC from ARP cache */
@@ -782,30 +924,16 @@ static int net_demo_process_frame(struct net_interface *iface,
                                     return 1;
                                 }
 
-                                /* Update IP header */
-                                util_memcpy(fwd_ip->dst, lan_ip, 4);
+                                /* Update IP header, transport port and L4 checksum */
+                                nat_rewrite_l4(fwd_ip, ip_header_len, rx, false, lan_ip, lan_port);
                                 fwd_ip->ttl--;
                                 fwd_ip->header_checksum = 0u;
                                 fwd_ip->header_checksum = util_htons(checksum16(fwd_ip, ip_header_len));
 
-                                /* Update transport port and checksum */
-                                if (ip->protocol == 6u) {
-                                    struct tcp_header *fwd_tcp = (struct tcp_header *)((uint8_t *)fwd_ip + ip_header_len);
-                                    fwd_tcp->dst_port = util_htons(lan_port);
-                                    fwd_tcp->checksum = 0u;
-                                    size_t tcp_len = total_length - ip_header_len;
-                                    fwd_tcp->checksum = tcp_udp_checksum(fwd_ip, fwd_tcp, tcp_len);  /* Direct assignment */
-                                } else {
-                                    struct udp_header *fwd_udp = (struct udp_header *)((uint8_t *)fwd_ip + ip_header_len);
-                                    fwd_udp->dst_port = util_htons(lan_port);
-                                    fwd_udp->checksum = 0u;
-                                    size_t udp_len = total_length - ip_header_len;
-                                    fwd_udp->checksum = tcp_udp_checksum(fwd_ip, fwd_udp, udp_len);  /* Direct assignment */
-                                }
-
                                 /* Send on LAN interface */
-                                virtio_net_send_frame_dev(g_lan_if.dev, frame,
-                                                        sizeof(*fwd_eth) + total_length);
+                                net_demo_forward(iface->dev, queue, g_lan_if->dev,
+                                                 net_demo_session_hash(proto, ip->src, src_port, wan_port),
+                                                 rx, sizeof(*fwd_eth) + total_length);
                                 return 1;
                             }
                         }
@@ -824,14 +952,18 @@ static void net_demo_send_icmp_request(struct net_interface *iface, uint16_t seq
         return;
     }
 
-    const uint8_t *local_mac = virtio_net_get_mac_dev(iface->dev);
-    uint8_t frame[sizeof(struct eth_header) + sizeof(struct ipv4_header) + sizeof(struct icmp_header) + 16u];
+    size_t payload_len = 16u;
+    uint8_t *frame = virtio_net_tx_lease_dev(iface->dev, sizeof(struct eth_header) + sizeof(struct ipv4_header) +
+                                                         sizeof(struct icmp_header) + payload_len);
+    if (frame == NULL) {
+        return;
+    }
 
+    const uint8_t *local_mac = virtio_net_get_mac_dev(iface->dev);
     struct eth_header *eth = (struct eth_header *)frame;
     struct ipv4_header *ip = (struct ipv4_header *)(frame + sizeof(*eth));
     struct icmp_header *icmp = (struct icmp_header *)(frame + sizeof(*eth) + sizeof(*ip));
     uint8_t *payload = icmp->data;
-    size_t payload_len = 16u;
 
     util_memcpy(eth->dest, iface->peer_mac, sizeof(eth->dest));
     util_memcpy(eth->src, local_mac, sizeof(eth->src));
@@ -860,18 +992,19 @@ static void net_demo_send_icmp_request(struct net_interface *iface, uint16_t seq
     icmp->checksum = 0u;
     icmp->checksum = util_htons(checksum16(icmp, sizeof(struct icmp_header) + payload_len));
 
+    size_t frame_len = sizeof(struct eth_header) + total_length;
+    virtio_net_tx_commit_dev(iface->dev, frame, frame_len);
+
     uart_puts("[net-demo] ");
     uart_puts(iface->name);
     uart_puts(": Sending ICMP echo request\n");
-    size_t frame_len = sizeof(struct eth_header) + total_length;
-    virtio_net_send_frame_dev(iface->dev, frame, frame_len);
 }
 
 static void net_rx_task(void *p_arg)
 {
-    struct net_interface *iface = (struct net_interface *)p_arg;
-    uint8_t rx_buffer[VIRTIO_NET_MAX_FRAME_SIZE];
-    size_t rx_length = 0u;
+    struct net_rx_worker *worker = (struct net_rx_worker *)p_arg;
+    struct net_interface *iface = worker->iface;
+    struct virtio_net_rx_frame burst[NET_RX_BURST_SIZE];
 
     for (;;) {
         if (iface == NULL || iface->dev == NULL) {
@@ -879,35 +1012,220 @@ static void net_rx_task(void *p_arg)
             continue;
         }
 
-        while (virtio_net_has_pending_rx_dev(iface->dev)) {
-            uint16_t desc_id = 0u;
-            size_t len = 0u;
-            const uint8_t *frame = virtio_net_peek_rx_buffer_dev(iface->dev, &len, &desc_id);
-            if (frame != NULL && len > 0u) {
-                net_demo_process_frame(iface, frame, len);
-                virtio_net_release_rx_buffer_dev(iface->dev, desc_id);
-            } else {
-                break;
+        size_t count;
+        while ((count = virtio_net_rx_burst_queue(iface->dev, worker->queue, burst, NET_RX_BURST_SIZE)) > 0u) {
+            for (size_t i = 0u; i < count; ++i) {
+                if (burst[i].len > 0u) {
+                    net_demo_process_frame(iface, worker->queue, &burst[i]);
+                }
             }
+            virtio_net_rx_release_burst_queue(iface->dev, worker->queue, burst, count);
+            worker->frames += (uint32_t)count;
         }
-        /* Replenish RX descriptors once per burst */
-        virtio_net_rx_flush_dev(0u);
-        virtio_net_rx_flush_dev(1u);
+        /* Replenish this queue's RX descriptors once per burst */
+        virtio_net_rx_flush_queue(virtio_net_get_index_dev(iface->dev), worker->queue);
         /* Flush any TX frames batched during this RX burst */
         virtio_net_tx_flush_dev(0u);
         virtio_net_tx_flush_dev(1u);
 
-        INT8U err = virtio_net_wait_rx_dev(iface->dev, 0u);
+        INT8U err = virtio_net_wait_rx_queue(iface->dev, worker->queue, 0u);
         if (err != OS_ERR_NONE) {
             OSTimeDly(1u);
         }
     }
 }
 
+/* Spread the interface over as many queue pairs as the device offers; returns the pair count */
+static uint16_t net_demo_setup_queues(struct net_interface *iface)
+{
+    int pairs = virtio_net_set_queue_pairs_dev(iface->dev, NET_RX_QUEUES);
+    if (pairs < 1) {
+        pairs = (int)virtio_net_get_queue_pairs_dev(iface->dev);
+    }
+
+    uart_puts("[net-demo] ");
+    uart_puts(iface->name);
+    uart_puts(": ");
+    uart_write_dec((uint32_t)pairs);
+    uart_puts(" RX queue(s)\n");
+
+    if (NET_RX_NAPI_BUDGET != 0u) {
+        (void)virtio_net_set_napi_dev(iface->dev, 1u, NET_RX_NAPI_BUDGET);
+    }
+    return (uint16_t)pairs;
+}
+
+/* Per-port model: one RX task per queue of the interface */
+static void net_demo_start_rx_workers(struct net_interface *iface, size_t dev_idx, INT8U base_prio)
+{
+    uint16_t pairs = net_demo_setup_queues(iface);
+
+    for (uint16_t q = 0u; q < pairs; ++q) {
+        struct net_rx_worker *worker = &g_rx_workers[dev_idx][q];
+        worker->iface = iface;
+        worker->queue = q;
+
+        INT8U err = OSTaskCreate(net_rx_task,
+                                 (void *)worker,
+                                 &net_rx_task_stack[dev_idx][q][NET_RX_TASK_STACK_SIZE - 1u],
+                                 (INT8U)(base_prio + q * NET_RX_QUEUE_PRIO_STEP));
+        if (err != OS_ERR_NONE) {
+            uart_puts("[net-demo] Failed to create ");
+            uart_puts(iface->name);
+            uart_puts(" RX task\n");
+        }
+    }
+}
+
+/* Ports past LAN and WAN share one worker: queue 0 of each, woken by any RX */
+static void net_aux_rx_task(void *p_arg)
+{
+    (void)p_arg;
+    struct virtio_net_rx_frame burst[NET_RX_BURST_SIZE];
+
+    for (;;) {
+        for (size_t port = NET_DEMO_WAN_PORT + 1u; port < g_iface_count; ++port) {
+            struct net_interface *iface = &g_ifaces[port];
+            size_t count;
+
+            while ((count = virtio_net_rx_burst_dev(iface->dev, burst, NET_RX_BURST_SIZE)) > 0u) {
+                for (size_t i = 0u; i < count; ++i) {
+                    if (burst[i].len > 0u) {
+                        net_demo_process_frame(iface, 0u, &burst[i]);
+                    }
+                }
+                virtio_net_rx_release_burst_dev(iface->dev, burst, count);
+                g_aux_frames += (uint32_t)count;
+            }
+            virtio_net_rx_flush_dev(port);
+            virtio_net_tx_flush_dev(port);
+        }
+
+        (void)virtio_net_wait_rx_any(NET_AUX_RX_WAIT_MS);
+    }
+}
+
+/*
+ * Run-to-completion model: one task serves every queue of every port. Each
+ * RX queue gives up to NET_FWD_PORT_BUDGET frames per round, each forwarded
+ * (or answered) into its egress port's TX batch before the next is read; the
+ * round ends with one RX refill and one TX kick per device, and a round that
+ * found nothing sleeps until any device receives.
+ */
+static void net_fwd_task(void *p_arg)
+{
+    (void)p_arg;
+    struct virtio_net_rx_frame burst[NET_RX_BURST_SIZE];
+
+    for (;;) {
+        uint32_t work = 0u;
+
+        for (size_t port = 0u; port < g_iface_count; ++port) {
+            struct net_interface *iface = &g_ifaces[port];
+            if (iface->dev == NULL) {
+                continue;
+            }
+
+            uint16_t pairs = virtio_net_get_queue_pairs_dev(iface->dev);
+            for (uint16_t q = 0u; q < pairs; ++q) {
+                uint32_t budget = NET_FWD_PORT_BUDGET;
+                size_t count;
+
+                while (budget > 0u &&
+                       (count = virtio_net_rx_burst_queue(iface->dev, q, burst,
+                                                          (budget < NET_RX_BURST_SIZE) ? budget : NET_RX_BURST_SIZE)) > 0u) {
+                    for (size_t i = 0u; i < count; ++i) {
+                        if (burst[i].len > 0u) {
+                            net_demo_process_frame(iface, q, &burst[i]);
+                        }
+                    }
+                    virtio_net_rx_release_burst_queue(iface->dev, q, burst, count);
+                    budget -= (uint32_t)count;
+                    work += (uint32_t)count;
+                }
+            }
+        }
+
+        for (size_t port = 0u; port < g_iface_count; ++port) {
+            virtio_net_rx_flush_dev(port);
+            virtio_net_tx_flush_dev(port);
+        }
+        g_fwd_frames += work;
+        g_fwd_rounds++;
+
+        if (work == 0u) {
+            (void)virtio_net_wait_rx_any(NET_FWD_IDLE_WAIT_MS);
+        }
+    }
+}
+
+/* Frames processed so far by whichever model runs */
+static uint32_t net_demo_frames(void)
+{
+    uint32_t frames = g_aux_frames + g_fwd_frames;
+
+    for (size_t port = 0u; port < 2u; ++port) {
+        for (size_t q = 0u; q < NET_RX_QUEUES; ++q) {
+            frames += g_rx_workers[port][q].frames;
+        }
+    }
+    return frames;
+}
+
+/* Frames and context switches since the last report, for comparing the two models */
+static void net_demo_report(uint32_t frames, uint32_t switches)
+{
+    uart_puts("[net-demo] ");
+    uart_puts((NET_DEMO_FWD_MODEL == NET_DEMO_FWD_RTC) ? "run-to-completion" : "per-port tasks");
+    uart_puts(": ");
+    uart_write_dec(frames);
+    uart_puts(" frames, ");
+    uart_write_dec(switches);
+    uart_puts(" context switches");
+    if (frames > 0u) {
+        uint32_t hundredths = (uint32_t)(((uint64_t)switches * 100u) / frames);
+        uart_puts(" (");
+        uart_write_dec(hundredths / 100u);
+        uart_putc('.');
+        uart_putc((char)('0' + (hundredths / 10u) % 10u));
+        uart_putc((char)('0' + hundredths % 10u));
+        uart_puts(" per frame)");
+    }
+    if (NET_DEMO_FWD_MODEL == NET_DEMO_FWD_RTC) {
+        uart_puts(", ");
+        uart_write_dec(g_fwd_rounds);
+        uart_puts(" rounds");
+    }
+    uart_putc('\n');
+}
+
+static void net_demo_print_ip(const uint8_t ip[4])
+{
+    for (size_t i = 0u; i < 4u; ++i) {
+        uart_putc((char)('0' + ip[i] / 100u));
+        uart_putc((char)('0' + (ip[i] / 10u) % 10u));
+        uart_putc((char)('0' + ip[i] % 10u));
+        if (i < 3u) {
+            uart_putc('.');
+        }
+    }
+}
+
+static bool net_demo_addressed(const struct net_interface *iface)
+{
+    return iface->dev != NULL && iface->local_ip[0] != 0u;
+}
+
 void net_demo_run(void)
 {
     uart_puts("[net-demo] Initialising VirtIO net driver for all devices\n");
 
+    for (size_t port = 0u; port < NET_DEMO_MAX_IFACES; ++port) {
+        uint16_t depth = (g_ifaces[port].queue_size != 0u) ? g_ifaces[port].queue_size : NET_DEMO_AUX_QUEUE_SIZE;
+        (void)virtio_net_set_queue_size(port, depth, depth);
+    }
+    virtio_net_set_pci_ecam(NET_DEMO_PCI_ECAM);
+
     if (virtio_net_init_all() != 0) {
         uart_puts("[net-demo] Driver initialisation failed\n");
         return;
@@ -919,127 +1237,125 @@ void net_demo_run(void)
     uart_puts("[net-demo] NAT ready - LAN (192.168.1.0/24) <-> WAN (10.3.5.99)\n");
 
     /* Get available device count */
-    uint32_t device_count = virtio_net_get_device_count();
+    size_t device_count = virtio_net_get_device_count();
     uart_puts("[net-demo] Found ");
-    uart_putc((char)('0' + device_count));
+    uart_write_dec((uint32_t)device_count);
     uart_puts(" VirtIO net device(s)\n");
 
-    /* Assign devices to interfaces */
-    if (device_count >= 1u) {
-        g_lan_if.dev = virtio_net_get_device(0u);
-        if (g_lan_if.dev != NULL) {
-            const uint8_t *lan_mac = virtio_net_get_mac_dev(g_lan_if.dev);
-            uart_puts("[net-demo] ");
-            uart_puts(g_lan_if.name);
-            uart_puts(" interface:\n");
-            uart_puts("[net-demo]   MAC: ");
-            print_mac("", lan_mac);
-            uart_puts("[net-demo]   IP: ");
-            uart_putc((char)('0' + g_lan_if.local_ip[0] / 100u));
-            uart_putc((char)('0' + (g_lan_if.local_ip[0] / 10u) % 10u));
-            uart_putc((char)('0' + g_lan_if.local_ip[0] % 10u));
-            uart_putc('.');
-            uart_putc((char)('0' + g_lan_if.local_ip[1] / 100u));
-            uart_putc((char)('0' + (g_lan_if.local_ip[1] / 10u) % 10u));
-            uart_putc((char)('0' + g_lan_if.local_ip[1] % 10u));
-            uart_putc('.');
-            uart_putc((char)('0' + g_lan_if.local_ip[2] / 100u));
-            uart_putc((char)('0' + (g_lan_if.local_ip[2] / 10u) % 10u));
-            uart_putc((char)('0' + g_lan_if.local_ip[2] % 10u));
-            uart_putc('.');
-            uart_putc((char)('0' + g_lan_if.local_ip[3] / 100u));
-            uart_putc((char)('0' + (g_lan_if.local_ip[3] / 10u) % 10u));
-            uart_putc((char)('0' + g_lan_if.local_ip[3] % 10u));
-            uart_puts("/24\n");
-        }
+    /* Spare RX buffers for the ones lent to the other port's TX ring */
+    if (device_count > 1u && virtio_net_fwd_pool_init(NET_FWD_POOL_BUFFERS) != 0) {
+        uart_puts("[net-demo] Forwarding pool unavailable, forwarding copies frames\n");
     }
 
-    if (device_count >= 2u) {
-        g_wan_if.dev = virtio_net_get_device(1u);
-        if (g_wan_if.dev != NULL) {
-            const uint8_t *wan_mac = virtio_net_get_mac_dev(g_wan_if.dev);
-            uart_puts("[net-demo] ");
-            uart_puts(g_wan_if.name);
-            uart_puts(" interface:\n");
-            uart_puts("[net-demo]   MAC: ");
-            print_mac("", wan_mac);
+    /* One interface per device, in discovery order */
+    g_iface_count = (device_count < NET_DEMO_MAX_IFACES) ? device_count : NET_DEMO_MAX_IFACES;
+    for (size_t port = 0u; port < g_iface_count; ++port) {
+        struct net_interface *iface = &g_ifaces[port];
+
+        iface->dev = virtio_net_get_device(port);
+        if (iface->dev == NULL) {
+            continue;
+        }
+        if (iface->name == NULL) {
+            iface->name = "PORT";
+            iface->mtu = VIRTIO_NET_DEFAULT_MTU;
+        }
+        uart_puts("[net-demo] ");
+        uart_puts(iface->name);
+        uart_puts(" interface (device ");
+        uart_write_dec((uint32_t)port);
+        uart_puts("):\n");
+        uart_puts("[net-demo]   MAC: ");
+        print_mac("", virtio_net_get_mac_dev(iface->dev));
+        if (net_demo_addressed(iface)) {
             uart_puts("[net-demo]   IP: ");
-            uart_putc((char)('0' + g_wan_if.local_ip[0] / 100u));
-            uart_putc((char)('0' + (g_wan_if.local_ip[0] / 10u) % 10u));
-            uart_putc((char)('0' + g_wan_if.local_ip[0] % 10u));
-            uart_putc('.');
-            uart_putc((char)('0' + g_wan_if.local_ip[1] / 100u));
-            uart_putc((char)('0' + (g_wan_if.local_ip[1] / 10u) % 10u));
-            uart_putc((char)('0' + g_wan_if.local_ip[1] % 10u));
-            uart_putc('.');
-            uart_putc((char)('0' + g_wan_if.local_ip[2] / 100u));
-            uart_putc((char)('0' + (g_wan_if.local_ip[2] / 10u) % 10u));
-            uart_putc((char)('0' + g_wan_if.local_ip[2] % 10u));
-            uart_putc('.');
-            uart_putc((char)('0' + g_wan_if.local_ip[3] / 100u));
-            uart_putc((char)('0' + (g_wan_if.local_ip[3] / 10u) % 10u));
-            uart_putc((char)('0' + g_wan_if.local_ip[3] % 10u));
+            net_demo_print_ip(iface->local_ip);
             uart_puts("/24\n");
+        } else {
+            uart_puts("[net-demo]   no address, RX drained only\n");
         }
+        net_demo_apply_mtu(iface);
+        net_demo_apply_rx_filter(iface);
+        (void)virtio_net_set_tx_coalesce_dev(iface->dev, NET_TX_DEADLINE_US, 0u);
     }
 
-    if (g_lan_if.dev != NULL) {
-        net_demo_send_arp_request(&g_lan_if);
-        INT8U err = OSTaskCreate(net_rx_task,
-                                 (void *)&g_lan_if,
-                                 &net_lan_rx_task_stack[NET_RX_TASK_STACK_SIZE - 1u],
-                                 NET_LAN_RX_TASK_PRIO);
-        if (err != OS_ERR_NONE) {
-            uart_puts("[net-demo] Failed to create LAN RX task\n");
+    if (NET_DEMO_FWD_MODEL == NET_DEMO_FWD_RTC) {
+        uart_puts("[net-demo] Forwarding model: one run-to-completion task for all ports\n");
+        if (g_lan_if->dev != NULL) {
+            (void)net_demo_setup_queues(g_lan_if);
         }
-    }
-    if (g_wan_if.dev != NULL) {
-        net_demo_send_arp_request(&g_wan_if);
-        INT8U err = OSTaskCreate(net_rx_task,
-                                 (void *)&g_wan_if,
-                                 &net_wan_rx_task_stack[NET_RX_TASK_STACK_SIZE - 1u],
-                                 NET_WAN_RX_TASK_PRIO);
+        if (g_wan_if->dev != NULL) {
+            (void)net_demo_setup_queues(g_wan_if);
+        }
+        INT8U err = OSTaskCreate(net_fwd_task, NULL,
+                                 &net_fwd_task_stack[NET_RX_TASK_STACK_SIZE - 1u],
+                                 NET_FWD_TASK_PRIO);
         if (err != OS_ERR_NONE) {
-            uart_puts("[net-demo] Failed to create WAN RX task\n");
+            uart_puts("[net-demo] Failed to create the forwarding task\n");
+        }
+    } else {
+        uart_puts("[net-demo] Forwarding model: one RX task per port and queue\n");
+        if (g_lan_if->dev != NULL) {
+            net_demo_start_rx_workers(g_lan_if, 0u, NET_LAN_RX_TASK_PRIO);
+        }
+        if (g_wan_if->dev != NULL) {
+            net_demo_start_rx_workers(g_wan_if, 1u, NET_WAN_RX_TASK_PRIO);
+        }
+        if (g_iface_count > NET_DEMO_WAN_PORT + 1u) {
+            INT8U err = OSTaskCreate(net_aux_rx_task, NULL,
+                                     &net_aux_rx_task_stack[NET_RX_TASK_STACK_SIZE - 1u],
+                                     NET_AUX_RX_TASK_PRIO);
+            if (err != OS_ERR_NONE) {
+                uart_puts("[net-demo] Failed to create the shared RX task\n");
+            }
         }
     }
 
-    uint16_t lan_icmp_sequence = 1u;
-    uint16_t wan_icmp_sequence = 1u;
     INT32U last_arp_tick = OSTimeGet();
-    INT32U lan_last_ping_tick = last_arp_tick;
-    INT32U wan_last_ping_tick = last_arp_tick;
     INT32U last_nat_cleanup_tick = last_arp_tick;
+    INT32U last_report_tick = last_arp_tick;
+    uint32_t last_frames = net_demo_frames();
+    INT32U last_switches = OSCtxSwCtr;
+    for (size_t port = 0u; port < g_iface_count; ++port) {
+        g_ifaces[port].icmp_sequence = 1u;
+        g_ifaces[port].last_ping_tick = last_arp_tick;
+        if (net_demo_addressed(&g_ifaces[port])) {
+            net_demo_send_arp_request(&g_ifaces[port]);
+        }
+    }
 
     for (;;) {
         INT32U now = OSTimeGet();
+        bool arp_due = (now - last_arp_tick) >= NET_DEMO_ARP_INTERVAL_TICKS;
 
         if ((now - last_nat_cleanup_tick) >= (INT32U)OS_TICKS_PER_SEC) {
             last_nat_cleanup_tick = now;
             nat_cleanup_expired(now);
         }
-
-        if ((now - last_arp_tick) >= NET_DEMO_ARP_INTERVAL_TICKS) {
+        if (arp_due) {
             last_arp_tick = now;
-            if (g_lan_if.dev != NULL) {
-                net_demo_send_arp_request(&g_lan_if);
-            }
-            if (g_wan_if.dev != NULL) {
-                net_demo_send_arp_request(&g_wan_if);
-            }
         }
-
-        if (g_lan_if.dev != NULL && g_lan_if.peer_mac_valid) {
-            if ((now - lan_last_ping_tick) >= NET_DEMO_PING_INTERVAL_TICKS) {
-                lan_last_ping_tick = now;
-                net_demo_send_icmp_request(&g_lan_if, lan_icmp_sequence++);
-            }
+        if ((now - last_report_tick) >= NET_DEMO_REPORT_TICKS) {
+            uint32_t frames = net_demo_frames();
+            INT32U switches = OSCtxSwCtr;
+            last_report_tick = now;
+            net_demo_report(frames - last_frames, (uint32_t)(switches - last_switches));
+            last_frames = frames;
+            last_switches = switches;
         }
 
-        if (g_wan_if.dev != NULL && g_wan_if.peer_mac_valid) {
-            if ((now - wan_last_ping_tick) >= NET_DEMO_PING_INTERVAL_TICKS) {
-                wan_last_ping_tick = now;
-                net_demo_send_icmp_request(&g_wan_if, wan_icmp_sequence++);
+        for (size_t port = 0u; port < g_iface_count; ++port) {
+            struct net_interface *iface = &g_ifaces[port];
+
+            if (!net_demo_addressed(iface)) {
+                continue;
+            }
+            if (arp_due) {
+                net_demo_send_arp_request(iface);
+            }
+            if (iface->peer_mac_valid && (now - iface->last_ping_tick) >= NET_DEMO_PING_INTERVAL_TICKS) {
+                iface->last_ping_tick = now;
+                net_demo_send_icmp_request(iface, iface->icmp_sequence++);
             }
         }
 
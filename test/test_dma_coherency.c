@@ -0,0 +1,411 @@
+/*
+ * Test Case 5: DMA Coherency Modes
+ *
+ * Purpose: Verify that frames cross the virtio rings intact both with cache
+ *          maintenance elided (coherent DMA) and with it performed
+ *          (non-coherent DMA), and that the coherent mode really skips it
+ *
+ * Expected Behavior:
+ * - Device 0 is brought up once per mode (virtio_net_set_dma_policy())
+ * - The peer is resolved with ARP, then pinged with payloads that span
+ *   many cache lines and change on every request
+ * - Each echo reply is compared byte for byte with the request it answers
+ *
+ * Success Criteria:
+ * - Driver initialization successful in both modes
+ * - Every echo reply carries the payload that was sent
+ * - At least PING_MIN_REPLIES replies per mode
+ * - No ring cache maintenance in coherent mode, some in non-coherent mode
+ *
+ * Run Command: make test-dma
+ * Prerequisites: TAP interface 'qemu-lan' must be configured with IP 192.168.1.103
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <ucos_ii.h>
+
+#include "virtio_net.h"
+#include "uart.h"
+#include "lib.h"
+#include "gic.h"
+#include "timer.h"
+#include "bsp_int.h"
+#include "bsp_os.h"
+
+#define TASK_STACK_SIZE         1024u
+#define TEST_DMA_TASK_PRIO      3u
+#define ARP_TIMEOUT_MS          2000u
+#define PING_TIMEOUT_MS         500u
+#define PING_COUNT              16u
+#define PING_MIN_REPLIES        12u
+#define PING_PAYLOAD            1024u   /* 16 cache lines of payload per frame */
+#define RX_BURST                8u
+
+/* Network configuration */
+static const uint8_t g_local_ip[4] = {192u, 168u, 1u, 1u};
+static const uint8_t g_peer_ip[4]  = {192u, 168u, 1u, 103u};
+
+static uint8_t g_peer_mac[6];
+
+static OS_STK test_dma_task_stack[TASK_STACK_SIZE];
+
+struct eth_header {
+    uint8_t dest[6];
+    uint8_t src[6];
+    uint16_t type;
+} __attribute__((packed));
+
+struct arp_packet {
+    uint16_t htype;
+    uint16_t ptype;
+    uint8_t hlen;
+    uint8_t plen;
+    uint16_t oper;
+    uint8_t sha[6];
+    uint8_t spa[4];
+    uint8_t tha[6];
+    uint8_t tpa[4];
+} __attribute__((packed));
+
+struct ipv4_header {
+    uint8_t version_ihl;
+    uint8_t tos;
+    uint16_t total_length;
+    uint16_t identification;
+    uint16_t flags_fragment;
+    uint8_t ttl;
+    uint8_t protocol;
+    uint16_t header_checksum;
+    uint8_t src[4];
+    uint8_t dst[4];
+} __attribute__((packed));
+
+struct icmp_header {
+    uint8_t type;
+    uint8_t code;
+    uint16_t checksum;
+    uint16_t identifier;
+    uint16_t sequence;
+} __attribute__((packed));
+
+#define PING_FRAME_SIZE (sizeof(struct eth_header) + sizeof(struct ipv4_header) + \
+                         sizeof(struct icmp_header) + PING_PAYLOAD)
+
+/* Per-mode results */
+struct dma_result {
+    uint32_t sent;
+    uint32_t replies;
+    uint32_t corrupt;
+    uint32_t ring_lines;
+    uint8_t coherent;
+};
+
+static uint16_t checksum16(const void *data, size_t length)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t sum = 0u;
+
+    while (length > 1u) {
+        sum += ((uint32_t)bytes[0] << 8) | (uint32_t)bytes[1];
+        bytes += 2u;
+        length -= 2u;
+    }
+    if (length == 1u) {
+        sum += ((uint32_t)bytes[0] << 8);
+    }
+    while ((sum >> 16u) != 0u) {
+        sum = (sum & 0xFFFFu) + (sum >> 16u);
+    }
+    return (uint16_t)~sum;
+}
+
+/* Payload byte i of request 'seq' in mode 'pass': differs per frame and per line */
+static uint8_t pattern_byte(uint32_t pass, uint16_t seq, size_t i)
+{
+    return (uint8_t)((i * 7u) ^ (seq * 31u) ^ (pass * 0x5Au) ^ (i >> 6u));
+}
+
+static void send_arp_request(virtio_net_dev_t dev)
+{
+    uint8_t frame[64];
+    const uint8_t *mac = virtio_net_get_mac_dev(dev);
+    struct eth_header *eth = (struct eth_header *)frame;
+    struct arp_packet *arp = (struct arp_packet *)(frame + sizeof(*eth));
+
+    util_memset(frame, 0, sizeof(frame));
+    util_memset(eth->dest, 0xFF, sizeof(eth->dest));
+    util_memcpy(eth->src, mac, sizeof(eth->src));
+    eth->type = util_htons(0x0806u);
+
+    arp->htype = util_htons(1u);
+    arp->ptype = util_htons(0x0800u);
+    arp->hlen = 6u;
+    arp->plen = 4u;
+    arp->oper = util_htons(1u);
+    util_memcpy(arp->sha, mac, sizeof(arp->sha));
+    util_memcpy(arp->spa, g_local_ip, sizeof(arp->spa));
+    util_memcpy(arp->tpa, g_peer_ip, sizeof(arp->tpa));
+
+    (void)virtio_net_send_frame_dev(dev, frame, 60u);
+    virtio_net_tx_flush_dev(0u);
+}
+
+static int send_ping(virtio_net_dev_t dev, uint32_t pass, uint16_t seq)
+{
+    static uint8_t frame[PING_FRAME_SIZE];
+    struct eth_header *eth = (struct eth_header *)frame;
+    struct ipv4_header *ip = (struct ipv4_header *)(frame + sizeof(*eth));
+    struct icmp_header *icmp = (struct icmp_header *)(frame + sizeof(*eth) + sizeof(*ip));
+    uint8_t *payload = frame + sizeof(*eth) + sizeof(*ip) + sizeof(*icmp);
+    uint16_t total_length = (uint16_t)(sizeof(*ip) + sizeof(*icmp) + PING_PAYLOAD);
+
+    util_memcpy(eth->dest, g_peer_mac, sizeof(eth->dest));
+    util_memcpy(eth->src, virtio_net_get_mac_dev(dev), sizeof(eth->src));
+    eth->type = util_htons(0x0800u);
+
+    util_memset(ip, 0, sizeof(*ip));
+    ip->version_ihl = (4u << 4u) | 5u;
+    ip->total_length = util_htons(total_length);
+    ip->identification = util_htons(seq);
+    ip->ttl = 64u;
+    ip->protocol = 1u;
+    util_memcpy(ip->src, g_local_ip, sizeof(ip->src));
+    util_memcpy(ip->dst, g_peer_ip, sizeof(ip->dst));
+    ip->header_checksum = util_htons(checksum16(ip, sizeof(*ip)));
+
+    icmp->type = 8u;
+    icmp->code = 0u;
+    icmp->checksum = 0u;
+    icmp->identifier = util_htons(0xD3A5u);
+    icmp->sequence = util_htons(seq);
+    for (size_t i = 0u; i < PING_PAYLOAD; ++i) {
+        payload[i] = pattern_byte(pass, seq, i);
+    }
+    icmp->checksum = util_htons(checksum16(icmp, sizeof(*icmp) + PING_PAYLOAD));
+
+    int rc = virtio_net_send_frame_dev(dev, frame, sizeof(*eth) + total_length);
+    virtio_net_tx_flush_dev(0u);
+    return rc;
+}
+
+/* 1: the awaited reply arrived intact, -1: it arrived corrupted, 0: something else */
+static int check_frame(const uint8_t *frame, size_t length, uint32_t pass, uint16_t seq)
+{
+    const struct eth_header *eth = (const struct eth_header *)frame;
+
+    if (length < sizeof(*eth) + sizeof(struct arp_packet)) {
+        return 0;
+    }
+    if (util_ntohs(eth->type) == 0x0806u) {
+        const struct arp_packet *arp = (const struct arp_packet *)(frame + sizeof(*eth));
+        if (seq == 0u && util_ntohs(arp->oper) == 2u && util_memcmp(arp->spa, g_peer_ip, 4u) == 0) {
+            util_memcpy(g_peer_mac, arp->sha, sizeof(g_peer_mac));
+            return 1;
+        }
+        return 0;
+    }
+    if (seq == 0u || util_ntohs(eth->type) != 0x0800u || length < PING_FRAME_SIZE) {
+        return 0;
+    }
+
+    const struct ipv4_header *ip = (const struct ipv4_header *)(frame + sizeof(*eth));
+    const struct icmp_header *icmp = (const struct icmp_header *)(frame + sizeof(*eth) + sizeof(*ip));
+    const uint8_t *payload = frame + sizeof(*eth) + sizeof(*ip) + sizeof(*icmp);
+    if (ip->protocol != 1u || util_memcmp(ip->src, g_peer_ip, 4u) != 0 || icmp->type != 0u ||
+        util_ntohs(icmp->identifier) != 0xD3A5u || util_ntohs(icmp->sequence) != seq) {
+        return 0;
+    }
+    for (size_t i = 0u; i < PING_PAYLOAD; ++i) {
+        if (payload[i] != pattern_byte(pass, seq, i)) {
+            uart_puts("[TEST] Payload mismatch at byte ");
+            uart_write_dec((uint32_t)i);
+            uart_puts(" of seq ");
+            uart_write_dec(seq);
+            uart_putc('\n');
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/* Poll RX until the reply to 'seq' (0: the ARP reply) shows up or the timeout passes */
+static int wait_reply(virtio_net_dev_t dev, uint32_t pass, uint16_t seq, uint32_t timeout_ms)
+{
+    struct virtio_net_rx_frame frames[RX_BURST];
+    INT32U start = OSTimeGet();
+    int result = 0;
+
+    while (result == 0 && (OSTimeGet() - start) < timeout_ms) {
+        size_t count = virtio_net_rx_burst_dev(dev, frames, RX_BURST);
+        if (count == 0u) {
+            OSTimeDly(1u);
+            continue;
+        }
+        for (size_t i = 0u; i < count; ++i) {
+            if (result == 0 && frames[i].len > 0u) {
+                result = check_frame(frames[i].data, frames[i].len, pass, seq);
+            }
+        }
+        virtio_net_rx_release_burst_dev(dev, frames, count);
+        virtio_net_rx_flush_dev(0u);
+    }
+    return result;
+}
+
+static int run_mode(uint32_t pass, uint8_t policy, struct dma_result *result)
+{
+    struct virtio_net_stats before;
+    struct virtio_net_stats after;
+
+    util_memset(result, 0, sizeof(*result));
+    uart_puts(policy == VIRTIO_NET_DMA_COHERENT ? "\n[TEST] Mode: coherent DMA\n"
+                                                : "\n[TEST] Mode: non-coherent DMA\n");
+    if (virtio_net_set_dma_policy(0u, policy) != 0 || virtio_net_init(0u, 0u) != 0) {
+        uart_puts("[FAIL] Driver initialization failed\n");
+        return -1;
+    }
+    virtio_net_dev_t dev = virtio_net_get_device(0u);
+
+    OSTimeDlyHMSM(0, 0, 0, 100);
+    send_arp_request(dev);
+    if (wait_reply(dev, pass, 0u, ARP_TIMEOUT_MS) != 1) {
+        uart_puts("[FAIL] ARP resolution timeout (peer 192.168.1.103 on qemu-lan)\n");
+        return -1;
+    }
+
+    virtio_net_get_stats_dev(dev, &before);
+    for (uint16_t seq = 1u; seq <= PING_COUNT; ++seq) {
+        if (send_ping(dev, pass, seq) != 0) {
+            continue;
+        }
+        result->sent++;
+        int reply = wait_reply(dev, pass, seq, PING_TIMEOUT_MS);
+        if (reply > 0) {
+            result->replies++;
+        } else if (reply < 0) {
+            result->corrupt++;
+        }
+    }
+    virtio_net_get_stats_dev(dev, &after);
+
+    result->coherent = after.dma_coherent;
+    result->ring_lines = (after.tx_ring_lines - before.tx_ring_lines) +
+                         (after.rx_ring_lines - before.rx_ring_lines);
+    uart_puts("[TEST] Echo replies ");
+    uart_write_dec(result->replies);
+    uart_puts("/");
+    uart_write_dec(result->sent);
+    uart_puts(", corrupted ");
+    uart_write_dec(result->corrupt);
+    uart_puts(", ring cache lines maintained ");
+    uart_write_dec(result->ring_lines);
+    uart_putc('\n');
+    return 0;
+}
+
+static void test_dma_task(void *p_arg)
+{
+    (void)p_arg;
+    static const uint8_t policies[2] = {VIRTIO_NET_DMA_COHERENT, VIRTIO_NET_DMA_NONCOHERENT};
+    struct dma_result results[2];
+    uint8_t test_passed = 1u;
+
+    uart_puts("[TEST] DMA coherency task started\n");
+
+    BSP_IntVectSet(27u, 0u, 0u, BSP_OS_TmrTickHandler);
+    BSP_IntSrcEn(27u);
+    BSP_OS_TmrTickInit(1000u);
+
+    for (uint32_t pass = 0u; pass < 2u; ++pass) {
+        if (run_mode(pass, policies[pass], &results[pass]) != 0) {
+            test_passed = 0u;
+            goto test_end;
+        }
+    }
+
+    uart_puts("\n========================================\n");
+    uart_puts("TEST CASE 5: RESULTS\n");
+    uart_puts("========================================\n");
+    for (uint32_t pass = 0u; pass < 2u; ++pass) {
+        const struct dma_result *r = &results[pass];
+        uint8_t want_coherent = (uint8_t)(policies[pass] == VIRTIO_NET_DMA_COHERENT);
+
+        uart_puts(want_coherent != 0u ? "[TEST] coherent:     " : "[TEST] non-coherent: ");
+        uart_write_dec(r->replies);
+        uart_puts(" intact replies, ");
+        uart_write_dec(r->ring_lines);
+        uart_puts(" ring lines\n");
+
+        if (r->coherent != want_coherent) {
+            uart_puts("[FAIL] Device did not take the requested DMA policy\n");
+            test_passed = 0u;
+        }
+        if (r->corrupt != 0u) {
+            uart_puts("[FAIL] Corrupted echo payloads\n");
+            test_passed = 0u;
+        }
+        if (r->replies < PING_MIN_REPLIES) {
+            uart_puts("[FAIL] Too few echo replies\n");
+            test_passed = 0u;
+        }
+        if ((want_coherent != 0u) != (r->ring_lines == 0u)) {
+            uart_puts("[FAIL] Ring cache maintenance does not match the mode\n");
+            test_passed = 0u;
+        }
+    }
+
+test_end:
+    if (test_passed) {
+        uart_puts("\n[PASS] ✓ DMA coherency test PASSED\n");
+    } else {
+        uart_puts("\n[FAIL] ✗ DMA coherency test FAILED\n");
+    }
+    uart_puts("========================================\n\n");
+
+    /* Task complete - idle forever */
+    for (;;) {
+        OSTimeDlyHMSM(0, 0, 10, 0);
+    }
+}
+
+int main(void)
+{
+    uart_puts("\n========================================\n");
+    uart_puts("TEST CASE 5: DMA Coherency Modes\n");
+    uart_puts("========================================\n");
+    uart_puts("[BOOT] Initializing test environment\n");
+
+    uart_init();
+    gic_init();
+    uart_puts("[BOOT] GICv3 initialized\n");
+
+    /* Configure timer access */
+    uint64_t val = 0xd6;
+    __asm__ volatile("msr cntkctl_el1, %0" :: "r"(val));
+
+    OSInit();
+    uart_puts("[BOOT] uC/OS-II initialized\n");
+
+    INT8U err = OSTaskCreate(test_dma_task,
+                             NULL,
+                             &test_dma_task_stack[TASK_STACK_SIZE - 1u],
+                             TEST_DMA_TASK_PRIO);
+    if (err != OS_ERR_NONE) {
+        uart_puts("[ERROR] Failed to create test task\n");
+        return 1;
+    }
+
+    /* Enable IRQs before OSStart (timer will be initialized in task) */
+    __asm__ volatile("msr daifclr, #0x2");
+    uart_puts("[BOOT] Starting test...\n");
+    uart_puts("========================================\n\n");
+
+    OSStart();
+
+    /* Should never reach here */
+    uart_puts("[ERROR] Returned from OSStart()!\n");
+    while (1) { }
+}
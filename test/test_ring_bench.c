@@ -0,0 +1,318 @@
+/*
+ * Test Case 4: Virtqueue Ring Benchmark
+ *
+ * Purpose: Measure how many cache lines of ring memory the driver cleans or
+ *          invalidates, and how often it reads the split ring's used index,
+ *          per transmitted and per received frame. DMA is forced
+ *          non-coherent so ring maintenance is counted. Built in one of two
+ *          modes:
+ *          - RING_BENCH_LAYOUT (make bench-ring): split vs packed
+ *            (VIRTIO_F_RING_PACKED) layout
+ *          - RING_BENCH_IN_ORDER (make bench-inorder): split ring without and
+ *            with VIRTIO_F_IN_ORDER, NAPI RX so replies are consumed in batches
+ *
+ * Expected Behavior:
+ * - VirtIO-net driver initializes; the layout and IN_ORDER follow what QEMU
+ *   offers (virtio-net-device properties packed=on/off, in_order=on/off)
+ * - Bursts of ARP requests are sent to the peer, whose replies supply RX traffic
+ * - Ring counters are sampled before and after the traffic
+ *
+ * Success Criteria:
+ * - Driver initialization successful
+ * - All TX frames are completed by the device
+ * - At least one ARP reply per burst is received
+ * - In-order mode: with IN_ORDER, TX and RX each read the used index less
+ *   than once per frame
+ *
+ * Run Command: make bench-ring / make bench-inorder (each runs both settings back to back)
+ * Prerequisites: TAP interface 'qemu-lan' must be configured with IP 192.168.1.103,
+ *                QEMU 9.1 or later for the in_order property
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <ucos_ii.h>
+
+#include "virtio_net.h"
+#include "uart.h"
+#include "lib.h"
+#include "gic.h"
+#include "timer.h"
+#include "bsp_int.h"
+#include "bsp_os.h"
+
+#define RING_BENCH_LAYOUT       0u
+#define RING_BENCH_IN_ORDER     1u
+
+#ifndef RING_BENCH_MODE
+#define RING_BENCH_MODE         RING_BENCH_LAYOUT
+#endif
+
+#define TASK_STACK_SIZE         1024u
+#define TEST_BENCH_TASK_PRIO    3u
+#define BENCH_ROUNDS            32u
+#if RING_BENCH_MODE == RING_BENCH_IN_ORDER
+#define BENCH_BURST             48u     /* deep enough for batched completions */
+#define BENCH_NAPI_BUDGET       64u
+#else
+#define BENCH_BURST             16u
+#endif
+#define BENCH_DRAIN_MS          20u
+#define BENCH_RX_BURST          16u
+
+/* Network configuration */
+static const uint8_t g_local_ip[4] = {192u, 168u, 1u, 1u};
+static const uint8_t g_peer_ip[4]  = {192u, 168u, 1u, 103u};
+
+static OS_STK test_bench_task_stack[TASK_STACK_SIZE];
+
+struct eth_header {
+    uint8_t dest[6];
+    uint8_t src[6];
+    uint16_t type;
+} __attribute__((packed));
+
+struct arp_packet {
+    uint16_t htype;
+    uint16_t ptype;
+    uint8_t hlen;
+    uint8_t plen;
+    uint16_t oper;
+    uint8_t sha[6];
+    uint8_t spa[4];
+    uint8_t tha[6];
+    uint8_t tpa[4];
+} __attribute__((packed));
+
+static size_t build_arp_request(uint8_t *frame, const uint8_t *mac)
+{
+    const uint8_t broadcast[6] = {0xFFu, 0xFFu, 0xFFu, 0xFFu, 0xFFu, 0xFFu};
+    struct eth_header *eth = (struct eth_header *)frame;
+    struct arp_packet *arp = (struct arp_packet *)(frame + sizeof(*eth));
+
+    util_memset(frame, 0, 64u);
+    util_memcpy(eth->dest, broadcast, sizeof(eth->dest));
+    util_memcpy(eth->src, mac, sizeof(eth->src));
+    eth->type = util_htons(0x0806u);
+
+    arp->htype = util_htons(1u);
+    arp->ptype = util_htons(0x0800u);
+    arp->hlen = 6u;
+    arp->plen = 4u;
+    arp->oper = util_htons(1u);
+    util_memcpy(arp->sha, mac, sizeof(arp->sha));
+    util_memcpy(arp->spa, g_local_ip, sizeof(arp->spa));
+    util_memcpy(arp->tpa, g_peer_ip, sizeof(arp->tpa));
+
+    /* Pad to the Ethernet minimum */
+    return 60u;
+}
+
+static uint32_t drain_rx(virtio_net_dev_t dev)
+{
+    struct virtio_net_rx_frame frames[BENCH_RX_BURST];
+    uint32_t received = 0u;
+    size_t count;
+
+    while ((count = virtio_net_rx_burst_dev(dev, frames, BENCH_RX_BURST)) > 0u) {
+        received += (uint32_t)count;
+        virtio_net_rx_release_burst_dev(dev, frames, count);
+    }
+    virtio_net_rx_flush_dev(0u);
+    return received;
+}
+
+/* value / frames with two decimals */
+static void print_per_frame(const char *label, const char *unit, uint32_t value, uint32_t frames)
+{
+    uint32_t hundredths = (frames > 0u) ? (value * 100u) / frames : 0u;
+
+    uart_puts(label);
+    uart_write_dec(hundredths / 100u);
+    uart_putc('.');
+    uart_putc((char)('0' + (hundredths / 10u) % 10u));
+    uart_putc((char)('0' + hundredths % 10u));
+    uart_puts(unit);
+    uart_puts(" (");
+    uart_write_dec(value);
+    uart_puts(" for ");
+    uart_write_dec(frames);
+    uart_puts(" frames)\n");
+}
+
+static void test_bench_task(void *p_arg)
+{
+    (void)p_arg;
+    uint8_t frame[64];
+    struct virtio_net_stats before;
+    struct virtio_net_stats after;
+    uint32_t sent = 0u;
+    uint32_t received = 0u;
+    uint32_t quiet_rounds = 0u;
+    uint8_t test_passed = 1u;
+
+    uart_puts("[TEST] Ring benchmark task started\n");
+
+    BSP_IntVectSet(27u, 0u, 0u, BSP_OS_TmrTickHandler);
+    BSP_IntSrcEn(27u);
+    BSP_OS_TmrTickInit(1000u);
+
+    /* Coherent DMA (the QEMU default) maintains no ring lines at all; count them */
+    (void)virtio_net_set_dma_policy(0u, VIRTIO_NET_DMA_NONCOHERENT);
+    if (virtio_net_init(0u, 0u) != 0) {
+        uart_puts("[FAIL] Driver initialization failed\n");
+        test_passed = 0u;
+        goto test_end;
+    }
+    virtio_net_dev_t dev = virtio_net_get_device(0u);
+#if RING_BENCH_MODE == RING_BENCH_IN_ORDER
+    /* Replies pile up in the used ring while the task sleeps and are harvested as a batch */
+    (void)virtio_net_set_napi_dev(dev, 1u, BENCH_NAPI_BUDGET);
+#endif
+    size_t frame_len = build_arp_request(frame, virtio_net_get_mac_dev(dev));
+
+    /* Let the peer settle, then start from empty queues */
+    OSTimeDlyHMSM(0, 0, 0, 200);
+    (void)drain_rx(dev);
+    virtio_net_get_stats_dev(dev, &before);
+
+    for (uint32_t round = 0u; round < BENCH_ROUNDS; ++round) {
+        uint32_t got;
+
+        for (uint32_t i = 0u; i < BENCH_BURST; ++i) {
+            if (virtio_net_send_frame_dev(dev, frame, frame_len) == 0) {
+                sent++;
+            }
+        }
+        virtio_net_tx_flush_dev(0u);
+
+        OSTimeDlyHMSM(0, 0, 0, BENCH_DRAIN_MS);
+        got = drain_rx(dev);
+        received += got;
+        if (got == 0u) {
+            quiet_rounds++;
+        }
+    }
+
+    /* A ticket for one more frame: waiting on it pulls in every earlier completion */
+    OSTimeDlyHMSM(0, 0, 0, 50);
+    struct virtio_net_tx_frag frag = { frame, frame_len };
+    uint16_t ticket = 0u;
+    if (virtio_net_send_sg_dev(dev, &frag, 1u, NULL, &ticket) == 0) {
+        sent++;
+    }
+    virtio_net_tx_flush_dev(0u);
+    OSTimeDlyHMSM(0, 0, 0, 50);
+    (void)virtio_net_tx_done_queue(dev, 0u, ticket);
+    received += drain_rx(dev);
+    virtio_net_get_stats_dev(dev, &after);
+
+    uint32_t tx_done = after.tx_completions - before.tx_completions;
+    uint32_t rx_done = after.rx_completions - before.rx_completions;
+    uint32_t tx_reads = after.tx_used_reads - before.tx_used_reads;
+    uint32_t rx_reads = after.rx_used_reads - before.rx_used_reads;
+
+    uart_puts("\n========================================\n");
+    uart_puts("TEST CASE 4: RESULTS\n");
+    uart_puts("========================================\n");
+    uart_puts("[BENCH] Ring layout: ");
+    uart_puts(after.packed_ring != 0u ? "packed\n" : "split\n");
+#if RING_BENCH_MODE == RING_BENCH_IN_ORDER
+    uart_puts("[BENCH] VIRTIO_F_IN_ORDER: ");
+    uart_puts(after.in_order != 0u ? "on\n" : "off\n");
+#endif
+    uart_puts("[BENCH] Frames sent ");
+    uart_write_dec(sent);
+    uart_puts(", completed ");
+    uart_write_dec(tx_done);
+    uart_puts(", received ");
+    uart_write_dec(received);
+    uart_putc('\n');
+#if RING_BENCH_MODE == RING_BENCH_IN_ORDER
+    print_per_frame("[BENCH] TX used index: ", " reads/frame", tx_reads, tx_done);
+    print_per_frame("[BENCH] RX used index: ", " reads/frame", rx_reads, rx_done);
+#endif
+    print_per_frame("[BENCH] TX ring: ", " lines/frame", after.tx_ring_lines - before.tx_ring_lines, tx_done);
+    print_per_frame("[BENCH] RX ring: ", " lines/frame", after.rx_ring_lines - before.rx_ring_lines, rx_done);
+    virtio_net_dump_stats_dev(dev);
+
+    if (tx_done < sent) {
+        uart_puts("[FAIL] TX frames not completed by the device\n");
+        test_passed = 0u;
+    }
+    if (quiet_rounds > 0u || received == 0u) {
+        uart_puts("[FAIL] Missing ARP replies (peer 192.168.1.103 on qemu-lan)\n");
+        test_passed = 0u;
+    }
+#if RING_BENCH_MODE == RING_BENCH_IN_ORDER
+    if (after.packed_ring != 0u) {
+        uart_puts("[FAIL] Packed ring negotiated; run with packed=off\n");
+        test_passed = 0u;
+    }
+    if (after.in_order != 0u && tx_reads >= tx_done) {
+        uart_puts("[FAIL] In-order TX still reads the used index once per frame\n");
+        test_passed = 0u;
+    }
+    if (after.in_order != 0u && rx_reads >= rx_done) {
+        uart_puts("[FAIL] In-order RX still reads the used index once per frame\n");
+        test_passed = 0u;
+    }
+#else
+    (void)tx_reads;
+    (void)rx_reads;
+#endif
+
+test_end:
+    if (test_passed) {
+        uart_puts("\n[PASS] ✓ Ring benchmark PASSED\n");
+    } else {
+        uart_puts("\n[FAIL] ✗ Ring benchmark FAILED\n");
+    }
+    uart_puts("========================================\n\n");
+
+    /* Task complete - idle forever */
+    for (;;) {
+        OSTimeDlyHMSM(0, 0, 10, 0);
+    }
+}
+
+int main(void)
+{
+    uart_puts("\n========================================\n");
+    uart_puts("TEST CASE 4: Virtqueue Ring Benchmark\n");
+    uart_puts("========================================\n");
+    uart_puts("[BOOT] Initializing test environment\n");
+
+    uart_init();
+    gic_init();
+    uart_puts("[BOOT] GICv3 initialized\n");
+
+    /* Configure timer access */
+    uint64_t val = 0xd6;
+    __asm__ volatile("msr cntkctl_el1, %0" :: "r"(val));
+
+    OSInit();
+    uart_puts("[BOOT] uC/OS-II initialized\n");
+
+    INT8U err = OSTaskCreate(test_bench_task,
+                             NULL,
+                             &test_bench_task_stack[TASK_STACK_SIZE - 1u],
+                             TEST_BENCH_TASK_PRIO);
+    if (err != OS_ERR_NONE) {
+        uart_puts("[ERROR] Failed to create benchmark task\n");
+        return 1;
+    }
+
+    /* Enable IRQs before OSStart (timer will be initialized in task) */
+    __asm__ volatile("msr daifclr, #0x2");
+    uart_puts("[BOOT] Starting test...\n");
+    uart_puts("========================================\n\n");
+
+    OSStart();
+
+    /* Should never reach here */
+    uart_puts("[ERROR] Returned from OSStart()!\n");
+    while (1) { }
+}
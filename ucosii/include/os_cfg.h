@@ -11,12 +11,12 @@
 #define OS_EVENT_MULTI_EN         0u
 #define OS_EVENT_NAME_EN          0u
 
-#define OS_LOWEST_PRIO           10u
-#define OS_MAX_EVENTS             8u
+#define OS_LOWEST_PRIO           12u
+#define OS_MAX_EVENTS            80u   /* an RX semaphore per queue on up to 32 devices, plus TX waiters */
 #define OS_MAX_FLAGS              1u
 #define OS_MAX_MEM_PART           0u
 #define OS_MAX_QS                 0u
-#define OS_MAX_TASKS              8u
+#define OS_MAX_TASKS             10u
 
 #define OS_SCHED_LOCK_EN          1u
 